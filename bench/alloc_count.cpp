@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "alloc_count.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> g_allocs{0};
+
+}  // namespace
+
+namespace bench {
+
+uint64_t AllocCount() {
+    return g_allocs.load(std::memory_order_relaxed);
+}
+
+}  // namespace bench
+
+void* operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+// std::pmr::new_delete_resource() allocates through the aligned forms
+void* operator new(size_t size, std::align_val_t align) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    size_t a = static_cast<size_t>(align);
+    // aligned_alloc wants a multiple of the alignment
+    if (void* p = aligned_alloc(a, (size + a - 1) / a * a)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
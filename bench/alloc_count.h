@@ -0,0 +1,30 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef BENCH_ALLOC_COUNT_H_
+#define BENCH_ALLOC_COUNT_H_
+
+#include <stdint.h>
+
+namespace bench {
+
+// Number of calls to the global operator new, plain or aligned, since
+// program start, counted by the replacement operator new linked into
+// arc_bench.
+uint64_t AllocCount();
+
+}  // namespace bench
+
+#endif  // BENCH_ALLOC_COUNT_H_
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <math.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// A minimal benchmark harness. Each ARC_BENCH(name) registers a function
+// which prints its own result lines through Report(), arc_bench runs all
+// registered functions whose name contains the command line filter.
+namespace bench {
+
+typedef void (*BenchFn)();
+
+struct BenchCase {
+    const char* name;
+    BenchFn fn;
+};
+
+inline std::vector<BenchCase>& Registry() {
+    static std::vector<BenchCase> cases;
+    return cases;
+}
+
+struct Registrar {
+    Registrar(const char* name, BenchFn fn) {
+        Registry().push_back({name, fn});
+    }
+};
+
+class Timer {
+ public:
+    Timer() : start_(std::chrono::steady_clock::now()) {}
+    double Seconds() const {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start_).count();
+    }
+
+ private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// One result line: label, throughput, latency and a free form suffix.
+inline void Report(const std::string& label, uint64_t ops, double seconds,
+                   const std::string& extra = std::string()) {
+    printf("  %-44s %10.2f Mops/s %9.1f ns/op  %s\n", label.c_str(),
+           ops / seconds / 1e6, seconds * 1e9 / ops, extra.c_str());
+}
+
+// xorshift, cheap enough not to show up in the measured loops
+class Rng {
+ public:
+    explicit Rng(uint64_t seed) : s_(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+    uint64_t Next() {
+        s_ ^= s_ << 13;
+        s_ ^= s_ >> 7;
+        s_ ^= s_ << 17;
+        return s_;
+    }
+    uint64_t Uniform(uint64_t n) { return Next() % n; }
+
+ private:
+    uint64_t s_;
+};
+
+// Zipfian distribution over [0, n), item 0 is the most popular. Uses the
+// method of Gray et al. "Quickly Generating Billion-Record Synthetic
+// Databases", as YCSB does; construction is O(n), sampling O(1).
+class Zipf {
+ public:
+    Zipf(uint64_t n, double theta) : n_(n), theta_(theta) {
+        double zeta2 = 1.0 + pow(0.5, theta);
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; ++i) zetan_ += pow(1.0 / i, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+    uint64_t Next(Rng* rng) {
+        double u = (rng->Next() >> 11) * (1.0 / 9007199254740992.0);
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta_)) return 1;
+        uint64_t v = static_cast<uint64_t>(n_ * pow(eta_ * u - eta_ + 1.0,
+                                                    alpha_));
+        return v < n_ ? v : n_ - 1;
+    }
+
+ private:
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+// Keep the optimizer from discarding a computed value.
+template <typename T>
+inline void DoNotOptimize(const T& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+}  // namespace bench
+
+#define ARC_BENCH(name)                                          \
+    static void name();                                          \
+    static ::bench::Registrar name##_registrar(#name, name);     \
+    static void name()
+
+#endif  // BENCH_BENCH_H_
@@ -0,0 +1,29 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "bench.h"
+
+#include <string.h>
+
+// usage: arc_bench [filter]
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : "";
+    for (auto& c : bench::Registry()) {
+        if (strstr(c.name, filter) == nullptr) continue;
+        printf("%s\n", c.name);
+        c.fn();
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+#include <fengge/car.h>
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+
+namespace {
+
+const size_t kCapacity = 1 << 16;
+const uint64_t kKeySpace = 1 << 18;
+const uint64_t kOpsPerThread = 1 << 20;
+
+// A Get reorders the ARC lists, readers take the lock exclusively.
+class LockedARC {
+ public:
+    explicit LockedARC(size_t c) : cache_(c) {}
+    bool Get(uint64_t k, uint64_t* v) {
+        std::lock_guard<std::shared_mutex> guard(mu_);
+        return cache_.Get(k, v);
+    }
+    void Put(uint64_t k, uint64_t v) {
+        std::lock_guard<std::shared_mutex> guard(mu_);
+        cache_.Put(k, v);
+    }
+
+ private:
+    std::shared_mutex mu_;
+    fengge::ARC<uint64_t, uint64_t> cache_;
+};
+
+// A CAR hit only sets a reference bit, readers share the lock.
+class LockedCAR {
+ public:
+    explicit LockedCAR(size_t c) : cache_(c) {}
+    bool Get(uint64_t k, uint64_t* v) {
+        std::shared_lock<std::shared_mutex> guard(mu_);
+        return cache_.SharedGet(k, v);
+    }
+    void Put(uint64_t k, uint64_t v) {
+        std::lock_guard<std::shared_mutex> guard(mu_);
+        cache_.Put(k, v);
+    }
+
+ private:
+    std::shared_mutex mu_;
+    fengge::CAR<uint64_t, uint64_t> cache_;
+};
+
+// read-through on Zipfian keys, mostly hits
+template <typename Cache>
+void Run(const std::string& label, int threads, const bench::Zipf& zipf) {
+    Cache cache(kCapacity);
+    for (uint64_t k = 0; k < kCapacity; ++k) cache.Put(k, k);
+    std::vector<std::thread> workers;
+    std::vector<uint64_t> hits(threads);
+    bench::Timer timer;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, &hits, &zipf, t] {
+            bench::Zipf z = zipf;
+            bench::Rng rng(t + 1);
+            for (uint64_t i = 0; i < kOpsPerThread; ++i) {
+                uint64_t k = z.Next(&rng);
+                uint64_t v;
+                if (cache.Get(k, &v))
+                    hits[t]++;
+                else
+                    cache.Put(k, k);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    double s = timer.Seconds();
+    uint64_t total = 0;
+    for (uint64_t h : hits) total += h;
+    char extra[64];
+    snprintf(extra, sizeof(extra), "hit ratio %6.2f%%",
+             100.0 * total / (kOpsPerThread * threads));
+    bench::Report(label + " threads=" + std::to_string(threads),
+                  kOpsPerThread * threads, s, extra);
+}
+
+}  // namespace
+
+// Concurrent read-through behind a std::shared_mutex: ARC readers must
+// lock exclusively, CAR readers share the lock.
+ARC_BENCH(car_concurrent_reads) {
+    bench::Zipf zipf(kKeySpace, 0.99);
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        Run<LockedARC>("zipf ARC", threads, zipf);
+        Run<LockedCAR>("zipf CAR", threads, zipf);
+    }
+}
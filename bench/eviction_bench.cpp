@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+#include <fengge/eviction_queue.h>
+
+#include <stdint.h>
+
+#include <utility>
+
+#include "bench.h"
+
+namespace {
+
+const size_t kCapacity = 1 << 14;
+const uint64_t kOps = 1 << 21;
+
+using IntARC = fengge::ARC<uint64_t, uint64_t>;
+
+template <typename F>
+void PutAll(const char* label, F&& put) {
+    IntARC cache(kCapacity);
+    bench::Timer timer;
+    for (uint64_t i = 0; i < kOps; ++i) put(&cache, i);
+    bench::Report(label, kOps, timer.Seconds());
+}
+
+}  // namespace
+
+// Inserts on a full cache, every Put evicts one entry. The callback only
+// sums the evicted values, what is measured is the cost of reaching it.
+ARC_BENCH(eviction_callback) {
+    uint64_t sum = 0;
+    auto add = [&sum](const uint64_t&, uint64_t&& v) { sum += v; };
+
+    PutAll("Put(key, value)", [](IntARC* c, uint64_t i) { c->Put(i, i); });
+    PutAll("Put(key, value, lambda)",
+           [&add](IntARC* c, uint64_t i) { c->Put(i, i, add); });
+    IntARC::EvictionCB function = add;
+    PutAll("Put(key, value, EvictionCB)",
+           [&function](IntARC* c, uint64_t i) { c->Put(i, i, function); });
+
+    fengge::EvictionQueue<uint64_t, uint64_t> queue;
+    auto drain = [&sum](std::pair<uint64_t, uint64_t>& item) {
+        sum += item.second;
+    };
+    PutAll("Put(key, value, EvictionQueue), drain/64",
+           [&](IntARC* c, uint64_t i) {
+               c->Put(i, i, queue);
+               if (i % 64 == 0) queue.Drain(drain);
+           });
+    bench::DoNotOptimize(sum);
+}
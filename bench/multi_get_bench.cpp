@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+namespace {
+
+// ~8M resident entries, some 600MB with NodeStorage: far beyond the last
+// level cache, every lookup misses it.
+const size_t kCapacity = 1 << 23;
+const size_t kBatch = 64;
+const uint64_t kOps = 1 << 22;
+
+struct FlatPolicy : fengge::DefaultARCPolicy {
+    using Storage = fengge::FlatStorage;
+};
+
+template <typename Cache>
+void Run(const char* name) {
+    Cache cache(kCapacity);
+    for (uint64_t k = 0; k < kCapacity; ++k) cache.Put(k, k);
+
+    // half of the looked up keys were never inserted
+    std::vector<uint64_t> keys(kOps);
+    bench::Rng rng(7);
+    for (auto& k : keys) k = rng.Uniform(kCapacity * 2);
+    std::vector<uint64_t> values(kBatch);
+    std::unique_ptr<bool[]> found(new bool[kBatch]);
+
+    uint64_t hits = 0;
+    bench::Timer single;
+    for (uint64_t i = 0; i < kOps; ++i) hits += cache.Get(keys[i], &values[0]);
+    double s = single.Seconds();
+    bench::DoNotOptimize(hits);
+    bench::Report(std::string(name) + " Get loop", kOps, s);
+
+    hits = 0;
+    bench::Timer batched;
+    for (uint64_t i = 0; i < kOps; i += kBatch) {
+        hits += cache.MultiGet(&keys[i], kBatch, values.data(),
+                               found.get());
+    }
+    s = batched.Seconds();
+    bench::DoNotOptimize(hits);
+    bench::Report(std::string(name) + " MultiGet", kOps, s);
+}
+
+}  // namespace
+
+ARC_BENCH(multi_get) {
+    printf("  %zu resident keys, batches of %zu uniform keys\n", kCapacity,
+           kBatch);
+    Run<fengge::ARC<uint64_t, uint64_t>>("NodeStorage");
+    Run<fengge::ARC<uint64_t, uint64_t, fengge::CacheTraits<uint64_t>,
+                    fengge::CacheTraits<uint64_t>, FlatPolicy>>(
+        "FlatStorage");
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+#include <fengge/slab_pool.h>
+
+#include <stdio.h>
+
+#include <memory_resource>
+#include <string>
+
+#include "alloc_count.h"
+#include "bench.h"
+
+namespace {
+
+const size_t kCapacity = 1 << 16;
+const uint64_t kOps = 1 << 22;
+
+struct FlatPolicy : fengge::DefaultARCPolicy {
+    using Storage = fengge::FlatStorage;
+};
+
+template <typename Policy>
+using Cache = fengge::ARC<uint64_t, uint64_t, fengge::CacheTraits<uint64_t>,
+                          fengge::CacheTraits<uint64_t>, Policy>;
+
+std::string AllocsPerOp(uint64_t allocs, uint64_t ops) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.4f allocs/op", double(allocs) / ops);
+    return buf;
+}
+
+// Puts on keys drawn from 8x the capacity, most of them miss and evict.
+// The cache is warmed up first so that only the steady state is measured.
+template <typename C>
+void Churn(const char* label, C* cache) {
+    bench::Rng rng(3);
+    for (uint64_t i = 0; i < 4 * kCapacity; ++i)
+        cache->Put(rng.Uniform(8 * kCapacity), i);
+
+    uint64_t allocs = bench::AllocCount();
+    bench::Timer timer;
+    for (uint64_t i = 0; i < kOps; ++i)
+        cache->Put(rng.Uniform(8 * kCapacity), i);
+    double s = timer.Seconds();
+    bench::Report(label, kOps, s,
+                  AllocsPerOp(bench::AllocCount() - allocs, kOps));
+}
+
+}  // namespace
+
+// Allocator of the entries under churn. With std::allocator every insert
+// allocates a node and every eviction frees one, a SlabPool recycles them.
+ARC_BENCH(node_alloc_churn) {
+    {
+        Cache<fengge::DefaultARCPolicy> cache(kCapacity);
+        Churn("NodeStorage std::allocator", &cache);
+    }
+    {
+        fengge::SlabPool pool;
+        Cache<fengge::PmrPolicy> cache(kCapacity, &pool);
+        Churn("NodeStorage SlabPool", &cache);
+    }
+    {
+        std::pmr::unsynchronized_pool_resource pool;
+        Cache<fengge::PmrPolicy> cache(kCapacity, &pool);
+        Churn("NodeStorage unsynchronized_pool_resource", &cache);
+    }
+    {
+        Cache<FlatPolicy> cache(kCapacity);
+        Churn("FlatStorage std::allocator", &cache);
+    }
+}
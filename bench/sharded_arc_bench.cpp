@@ -0,0 +1,166 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/sharded_arc.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+
+namespace {
+
+const size_t kCapacity = 1 << 20;
+const uint64_t kKeySpace = kCapacity * 2;
+const uint64_t kOpsPerThread = 1 << 20;
+
+// The setup ShardedARC replaces: one ARC behind one mutex.
+class GlobalLockARC {
+ public:
+    explicit GlobalLockARC(size_t c) : cache_(c) {}
+    bool Get(uint64_t k, uint64_t* v) {
+        std::lock_guard<std::mutex> guard(mu_);
+        return cache_.Get(k, v);
+    }
+    void Put(uint64_t k, uint64_t v) {
+        std::lock_guard<std::mutex> guard(mu_);
+        cache_.Put(k, v);
+    }
+
+ private:
+    std::mutex mu_;
+    fengge::ARC<uint64_t, uint64_t> cache_;
+};
+
+// read-through on a uniform key distribution
+template <typename Cache>
+double Run(Cache* cache, int threads) {
+    std::vector<std::thread> workers;
+    bench::Timer timer;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([cache, t] {
+            bench::Rng rng(t + 1);
+            for (uint64_t i = 0; i < kOpsPerThread; ++i) {
+                uint64_t k = rng.Uniform(kKeySpace);
+                uint64_t v;
+                if (!cache->Get(k, &v)) cache->Put(k, k);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    return timer.Seconds();
+}
+
+std::vector<int> ThreadCounts() {
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::vector<int> counts;
+    for (int t = 1; t <= max_threads; t *= 2) counts.push_back(t);
+    return counts;
+}
+
+}  // namespace
+
+ARC_BENCH(sharded_scaling) {
+    printf("  uniform keys, capacity %zu, %u hardware threads\n", kCapacity,
+           std::thread::hardware_concurrency());
+    for (int threads : ThreadCounts()) {
+        uint64_t ops = kOpsPerThread * threads;
+        {
+            GlobalLockARC cache(kCapacity);
+            double s = Run(&cache, threads);
+            bench::Report("global mutex, threads=" + std::to_string(threads),
+                          ops, s);
+        }
+        {
+            fengge::ShardedARC<uint64_t, uint64_t> cache(kCapacity, 64);
+            double s = Run(&cache, threads);
+            char hit[32];
+            snprintf(hit, sizeof(hit), "hit %.3f",
+                     double(cache.HitCount()) /
+                     (cache.HitCount() + cache.MissCount()));
+            bench::Report("sharded x64, threads=" + std::to_string(threads),
+                          ops, s, hit);
+        }
+    }
+}
+
+namespace {
+
+const uint64_t kZipfKeys = kCapacity * 8;
+
+// Pre-generated so that all configurations replay the same accesses.
+const std::vector<uint64_t>& ZipfTrace() {
+    static std::vector<uint64_t> trace = [] {
+        bench::Zipf zipf(kZipfKeys, 0.99);
+        bench::Rng rng(42);
+        std::vector<uint64_t> t(kOpsPerThread * 4);
+        for (auto& k : t) k = zipf.Next(&rng);
+        return t;
+    }();
+    return trace;
+}
+
+template <typename Cache>
+double RunTrace(Cache* cache, int threads) {
+    const auto& trace = ZipfTrace();
+    std::vector<std::thread> workers;
+    bench::Timer timer;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([cache, t, threads, &trace] {
+            for (size_t i = t; i < trace.size(); i += threads) {
+                uint64_t v;
+                if (!cache->Get(trace[i], &v)) cache->Put(trace[i], v);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    return timer.Seconds();
+}
+
+template <typename Cache>
+std::string HitRatio(const Cache& cache) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "hit %.4f",
+             double(cache.HitCount()) /
+             (cache.HitCount() + cache.MissCount()));
+    return buf;
+}
+
+}  // namespace
+
+ARC_BENCH(sharded_buffered_reads) {
+    const size_t n = ZipfTrace().size();
+    printf("  zipf 0.99 over %llu keys, capacity %zu\n",
+           static_cast<unsigned long long>(kZipfKeys), kCapacity);
+    {
+        fengge::ARC<uint64_t, uint64_t> cache(kCapacity);
+        double s = RunTrace(&cache, 1);
+        bench::Report("single-threaded ARC", n, s, HitRatio(cache));
+    }
+    for (int threads : ThreadCounts()) {
+        for (bool buffered : {false, true}) {
+            fengge::ShardedARCOptions options;
+            options.num_shards = 16;
+            options.buffered_reads = buffered;
+            fengge::ShardedARC<uint64_t, uint64_t> cache(kCapacity, options);
+            double s = RunTrace(&cache, threads);
+            bench::Report(std::string(buffered ? "buffered" : "locked") +
+                          " reads x16, threads=" + std::to_string(threads),
+                          n, s, HitRatio(cache));
+        }
+    }
+}
@@ -0,0 +1,133 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "alloc_count.h"
+#include "bench.h"
+
+namespace {
+
+const size_t kCapacity = 1 << 14;
+const uint64_t kOps = 1 << 20;
+const size_t kValueSize = 4096;
+
+using StringARC = fengge::ARC<uint64_t, std::string>;
+
+std::string AllocsPerOp(uint64_t allocs, uint64_t ops) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.2f allocs/op", double(allocs) / ops);
+    return buf;
+}
+
+void Fill(StringARC* cache) {
+    for (uint64_t k = 0; k < kCapacity; ++k) {
+        cache->Put(k, std::string(kValueSize, 'v'));
+    }
+}
+
+}  // namespace
+
+// Reads of resident 4KB values: Get(key, &value) copies the value out, the
+// pointer and visitor forms do not.
+ARC_BENCH(value_copy_get) {
+    StringARC cache(kCapacity);
+    Fill(&cache);
+
+    {
+        bench::Rng rng(1);
+        std::string v;
+        uint64_t allocs = bench::AllocCount();
+        bench::Timer timer;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            cache.Get(rng.Uniform(kCapacity), &v);
+            bench::DoNotOptimize(v.data()[i % kValueSize]);
+        }
+        double s = timer.Seconds();
+        bench::Report("Get(key, &value)", kOps, s,
+                      AllocsPerOp(bench::AllocCount() - allocs, kOps));
+    }
+    {
+        bench::Rng rng(1);
+        uint64_t allocs = bench::AllocCount();
+        bench::Timer timer;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            const std::string* v = cache.Get(rng.Uniform(kCapacity));
+            bench::DoNotOptimize(v->data()[i % kValueSize]);
+        }
+        double s = timer.Seconds();
+        bench::Report("Get(key) -> const V*", kOps, s,
+                      AllocsPerOp(bench::AllocCount() - allocs, kOps));
+    }
+    {
+        bench::Rng rng(1);
+        uint64_t allocs = bench::AllocCount();
+        bench::Timer timer;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            cache.Get(rng.Uniform(kCapacity), [i](const std::string& v) {
+                bench::DoNotOptimize(v.data()[i % kValueSize]);
+            });
+        }
+        double s = timer.Seconds();
+        bench::Report("Get(key, visitor)", kOps, s,
+                      AllocsPerOp(bench::AllocCount() - allocs, kOps));
+    }
+}
+
+// Inserts of freshly built 4KB values on a full cache, so that every Put
+// evicts. A copying Put allocates the value once more than a moving Put.
+ARC_BENCH(value_copy_put) {
+    {
+        StringARC cache(kCapacity);
+        uint64_t allocs = bench::AllocCount();
+        bench::Timer timer;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            std::string v(kValueSize, 'v');
+            cache.Put(i, v);
+        }
+        double s = timer.Seconds();
+        bench::Report("Put(key, const V&)", kOps, s,
+                      AllocsPerOp(bench::AllocCount() - allocs, kOps));
+    }
+    {
+        StringARC cache(kCapacity);
+        uint64_t allocs = bench::AllocCount();
+        bench::Timer timer;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            std::string v(kValueSize, 'v');
+            cache.Put(i, std::move(v));
+        }
+        double s = timer.Seconds();
+        bench::Report("Put(key, V&&)", kOps, s,
+                      AllocsPerOp(bench::AllocCount() - allocs, kOps));
+    }
+    {
+        StringARC cache(kCapacity);
+        uint64_t allocs = bench::AllocCount();
+        bench::Timer timer;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            cache.Emplace(i, kValueSize, 'v');
+        }
+        double s = timer.Seconds();
+        bench::Report("Emplace(key, args...)", kOps, s,
+                      AllocsPerOp(bench::AllocCount() - allocs, kOps));
+    }
+}
@@ -0,0 +1,182 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+#include <fengge/car.h>
+
+#include <stdio.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+
+namespace {
+
+const uint64_t kKeySpace = 1 << 20;
+const uint64_t kOps = 1 << 20;
+const size_t kCapacities[] = {1 << 10, 1 << 14, 1 << 17};
+
+// Baseline: textbook LRU over std::list and std::unordered_map.
+template <typename K, typename V>
+class LRUCache {
+ public:
+    explicit LRUCache(size_t capacity) : capacity_(capacity) {
+        index_.reserve(capacity);
+    }
+
+    bool Get(const K& key, V* value) {
+        auto it = index_.find(key);
+        if (it == index_.end()) return false;
+        items_.splice(items_.end(), items_, it->second);
+        if (value) *value = it->second->second;
+        return true;
+    }
+
+    void Put(const K& key, const V& value) {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            it->second->second = value;
+            items_.splice(items_.end(), items_, it->second);
+            return;
+        }
+        if (items_.size() == capacity_) {
+            index_.erase(items_.front().first);
+            items_.pop_front();
+        }
+        items_.emplace_back(key, value);
+        index_.emplace(key, std::prev(items_.end()));
+    }
+
+ private:
+    typedef std::list<std::pair<K, V>> List;
+
+    size_t capacity_;
+    List items_;  // LRU first
+    std::unordered_map<K, typename List::iterator> index_;
+};
+
+struct TinyLFUPolicy : fengge::DefaultARCPolicy {
+    using Admission = fengge::TinyLFUAdmission;
+};
+
+enum class Workload { kZipf, kUniform, kScan, kLoop, kMixed };
+
+const char* NameOf(Workload w) {
+    switch (w) {
+    case Workload::kZipf: return "zipf";
+    case Workload::kUniform: return "uniform";
+    case Workload::kScan: return "scan";
+    case Workload::kLoop: return "loop";
+    case Workload::kMixed: return "scan+hot";
+    }
+    return "";
+}
+
+// Key sequence of a workload for a cache of the given capacity:
+//   zipf      Zipfian (theta 0.99) over the key space
+//   uniform   uniform over the key space
+//   scan      one sequential pass, no key repeats
+//   loop      sequential loop over 1.25x the capacity, LRU never hits
+//   scan+hot  zipf traffic with every 4th access from a one-time scan
+std::vector<uint64_t> MakeTrace(Workload w, size_t capacity) {
+    std::vector<uint64_t> trace(kOps);
+    bench::Rng rng(11);
+    switch (w) {
+    case Workload::kZipf:
+    case Workload::kMixed: {
+        bench::Zipf zipf(kKeySpace, 0.99);
+        uint64_t scan = kKeySpace;
+        for (uint64_t i = 0; i < kOps; ++i) {
+            if (w == Workload::kMixed && i % 4 == 0)
+                trace[i] = scan++;
+            else
+                trace[i] = zipf.Next(&rng);
+        }
+        break;
+    }
+    case Workload::kUniform:
+        for (auto& k : trace) k = rng.Uniform(kKeySpace);
+        break;
+    case Workload::kScan:
+        for (uint64_t i = 0; i < kOps; ++i) trace[i] = i;
+        break;
+    case Workload::kLoop:
+        for (uint64_t i = 0; i < kOps; ++i) trace[i] = i % (capacity * 5 / 4);
+        break;
+    }
+    return trace;
+}
+
+// Read-through replay of trace: Get, Put on a miss.
+template <typename Cache, typename K, typename V>
+void Replay(const std::string& label, size_t capacity,
+            const std::vector<K>& trace, const V& value) {
+    Cache cache(capacity);
+    uint64_t hits = 0;
+    bench::Timer timer;
+    for (const K& k : trace) {
+        if (cache.Get(k, nullptr))
+            hits++;
+        else
+            cache.Put(k, value);
+    }
+    double s = timer.Seconds();
+    char extra[64];
+    snprintf(extra, sizeof(extra), "hit ratio %6.2f%%",
+             100.0 * hits / trace.size());
+    bench::Report(label, trace.size(), s, extra);
+}
+
+template <typename K, typename V, typename MakeKey>
+void RunAll(MakeKey make_key, const V& value) {
+    for (Workload w : {Workload::kZipf, Workload::kUniform, Workload::kScan,
+                       Workload::kLoop, Workload::kMixed}) {
+        for (size_t capacity : kCapacities) {
+            std::vector<K> trace;
+            trace.reserve(kOps);
+            for (uint64_t k : MakeTrace(w, capacity))
+                trace.push_back(make_key(k));
+            std::string label = std::string(NameOf(w)) + " c=" +
+                                std::to_string(capacity);
+            Replay<fengge::ARC<K, V>>(label + " ARC", capacity, trace,
+                                      value);
+            Replay<fengge::ARC<K, V, fengge::CacheTraits<K>,
+                               fengge::CacheTraits<V>, TinyLFUPolicy>>(
+                label + " ARC+TinyLFU", capacity, trace, value);
+            Replay<fengge::CAR<K, V>>(label + " CAR", capacity, trace,
+                                      value);
+            Replay<LRUCache<K, V>>(label + " LRU", capacity, trace, value);
+        }
+    }
+}
+
+}  // namespace
+
+// Standard cache workloads replayed read-through on ARC (with and without
+// TinyLFU admission), CAR and a plain LRU,
+// over 2^20 keys at several capacities.
+ARC_BENCH(workload_int) {
+    RunAll<int, int>([](uint64_t k) { return static_cast<int>(k); }, 1);
+}
+
+ARC_BENCH(workload_string) {
+    RunAll<std::string, std::string>(
+        [](uint64_t k) { return "key:" + std::to_string(k); },
+        std::string(32, 'v'));
+}
@@ -16,16 +16,26 @@
 #ifndef SRC_INCLUDE_FENGGE_ARC_H_
 #define SRC_INCLUDE_FENGGE_ARC_H_
 
+#include <fengge/arc_admission.h>
+#include <fengge/arc_expiry.h>
+#include <fengge/arc_ghosts.h>
+#include <fengge/arc_snapshot.h>
+#include <fengge/arc_storage.h>
 #include <fengge/cache_traits.h>
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
+#include <chrono>
 #include <functional>
-#include <list>
+#include <iterator>
 #include <memory>
-#include <unordered_map>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <iostream>
@@ -49,579 +59,2254 @@ struct ARCSizeInfo {
 
 enum class ARCQId { B1, T1, B2, T2 };
 
+// Counters of ARC::GetStats(). ShardedARC sums them over its shards, p
+// included.
+struct ARCStats {
+    uint64_t hits;            // HitCount(), Put on a resident key included
+    uint64_t misses;          // MissCount()
+    uint64_t t1_hits;         // reads of a T1 entry, promoted to T2
+    uint64_t t2_hits;         // reads of a T2 entry
+    uint64_t b1_ghost_hits;   // Put of a key in B1, p grows
+    uint64_t b2_ghost_hits;   // Put of a key in B2, p shrinks
+    uint64_t t1_evictions;    // entries evicted from T1
+    uint64_t t2_evictions;    // entries evicted from T2
+    uint64_t b1_drops;        // ghosts dropped from B1
+    uint64_t b2_drops;        // ghosts dropped from B2
+    uint64_t inserts;         // keys made resident by Put
+    uint64_t updates;         // Put on a resident key
+    uint64_t removes;         // Remove() of a resident key
+    uint64_t expirations;     // entries removed by their ttl
+    uint64_t rejections;      // new keys turned away by Policy::Admission
+    size_t p;                 // target charge of T1, see ARC::P()
+    size_t min_p;             // since construction or Clear()
+    size_t max_p;
+
+    ARCStats()
+        : hits(0), misses(0), t1_hits(0), t2_hits(0), b1_ghost_hits(0),
+          b2_ghost_hits(0), t1_evictions(0), t2_evictions(0), b1_drops(0),
+          b2_drops(0), inserts(0), updates(0), removes(0), expirations(0),
+          rejections(0), p(0), min_p(0), max_p(0) {}
+    ARCStats& operator+=(const ARCStats& o) {
+        hits += o.hits;
+        misses += o.misses;
+        t1_hits += o.t1_hits;
+        t2_hits += o.t2_hits;
+        b1_ghost_hits += o.b1_ghost_hits;
+        b2_ghost_hits += o.b2_ghost_hits;
+        t1_evictions += o.t1_evictions;
+        t2_evictions += o.t2_evictions;
+        b1_drops += o.b1_drops;
+        b2_drops += o.b2_drops;
+        inserts += o.inserts;
+        updates += o.updates;
+        removes += o.removes;
+        expirations += o.expirations;
+        rejections += o.rejections;
+        p += o.p;
+        min_p += o.min_p;
+        max_p += o.max_p;
+        return *this;
+    }
+};
+
+// Loader activity of GetOrLoad().
+struct LoadStats {
+    uint64_t loads;           // loader calls
+    uint64_t load_failures;   // loader calls which returned false
+    uint64_t coalesced;       // misses served by another caller's load
+    uint64_t load_nanos;      // total time spent in the loader
+    uint64_t max_load_nanos;
+
+    LoadStats()
+        : loads(0), load_failures(0), coalesced(0), load_nanos(0),
+          max_load_nanos(0) {}
+    LoadStats& operator+=(const LoadStats& o) {
+        loads += o.loads;
+        load_failures += o.load_failures;
+        coalesced += o.coalesced;
+        load_nanos += o.load_nanos;
+        max_load_nanos = std::max(max_load_nanos, o.max_load_nanos);
+        return *this;
+    }
+};
+
+namespace detail {
+
+// Run loader(key, value) and account for it in stats.
+template <typename Loader, typename K, typename V>
+bool TimedLoad(Loader& loader, const K& key, V* value, LoadStats* stats) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = loader(key, value);
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    stats->loads++;
+    if (!ok) stats->load_failures++;
+    stats->load_nanos += nanos;
+    stats->max_load_nanos = std::max(stats->max_load_nanos, nanos);
+    return ok;
+}
+
+// Eviction callback of the Put overloads without one.
+struct NoEviction {
+    template <typename K, typename V>
+    void operator()(const K&, V&&) const {}
+};
+
+// true if f is an empty std::function or a null function pointer
+template <typename F>
+bool IsNullCallback(const F&) { return false; }
+template <typename R, typename... Args>
+bool IsNullCallback(const std::function<R(Args...)>& f) { return !f; }
+template <typename R, typename... Args>
+bool IsNullCallback(R (*f)(Args...)) { return f == nullptr; }
+
+}  // namespace detail
+
+// Units of ARC's capacity, selected through the Charge member of the
+// policy. The target size p and the limits of the ghost lists B1/B2 are
+// expressed in the same unit; a ghost keeps the charge its entry had while
+// it was resident.
+
+// Every entry counts 1, the capacity is a number of entries.
+struct EntryCountCharge {
+    static constexpr bool kUnit = true;
+
+    template <typename KeyTraits, typename ValueTraits, typename K,
+              typename V>
+    static size_t Of(const K&, const V&) { return 1; }
+};
+
+// Every entry counts KeyTraits::CountBytes(key) +
+// ValueTraits::CountBytes(value), the capacity is a byte budget. Put evicts
+// as many entries as needed to make room for a large value, a value larger
+// than the whole budget is not cached.
+struct ByteCharge {
+    static constexpr bool kUnit = false;
+
+    template <typename KeyTraits, typename ValueTraits, typename K,
+              typename V>
+    static size_t Of(const K& k, const V& v) {
+        return std::max<size_t>(1, KeyTraits::CountBytes(k) +
+                                   ValueTraits::CountBytes(v));
+    }
+};
+
+// Compile-time knobs of ARC. To change one of them, derive from this struct
+// and shadow the member, e.g.
+//
+//     struct FlatPolicy : fengge::DefaultARCPolicy {
+//         using Storage = fengge::FlatStorage;
+//     };
+//     fengge::ARC<int, int, fengge::CacheTraits<int>,
+//                 fengge::CacheTraits<int>, FlatPolicy> cache(1024);
+struct DefaultARCPolicy {
+    // NodeStorage or FlatStorage, see arc_storage.h
+    using Storage = NodeStorage;
+    // EntryCountCharge or ByteCharge
+    using Charge = EntryCountCharge;
+    // KeyGhosts or FingerprintGhosts, see arc_ghosts.h
+    using Ghosts = KeyGhosts;
+    // Hash and equality of keys. When both are transparent (define
+    // is_transparent), lookups take any key type they accept without
+    // building a K, see StringKeyPolicy.
+    template <typename Key>
+    using Hash = std::hash<Key>;
+    template <typename Key>
+    using KeyEqual = std::equal_to<Key>;
+    // Allocator of the table, rebound to its nodes or slots and its index.
+    template <typename T>
+    using Allocator = std::allocator<T>;
+    // Maintain the event counters of GetStats(), false compiles them out.
+    static constexpr bool kStats = true;
+    // NoExpiry or WheelExpiry, see arc_expiry.h
+    using Expiry = NoExpiry;
+    // NoAdmission or TinyLFUAdmission, see arc_admission.h
+    using Admission = NoAdmission;
+};
+
+// Policy of caches allocating from a std::pmr::memory_resource passed to
+// the constructor, e.g. a SlabPool (see slab_pool.h).
+struct PmrPolicy : DefaultARCPolicy {
+    template <typename T>
+    using Allocator = std::pmr::polymorphic_allocator<T>;
+};
+
+// Transparent hash of std::string keys, std::string_view and const char*
+// hash to the same value as the equal std::string.
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+// Policy of ARC<std::string, V> caches looked up by std::string_view.
+struct StringKeyPolicy : DefaultARCPolicy {
+    template <typename Key>
+    using Hash = StringHash;
+    template <typename Key>
+    using KeyEqual = std::equal_to<>;
+};
+
+namespace detail {
+
+template <typename T, typename = void>
+struct IsTransparent : std::false_type {};
+template <typename T>
+struct IsTransparent<T, std::void_t<typename T::is_transparent>>
+    : std::true_type {};
+
+}  // namespace detail
+
 template <typename K, typename V, typename KeyTraits = CacheTraits<K>,
-          typename ValueTraits = CacheTraits<V>>
+          typename ValueTraits = CacheTraits<V>,
+          typename Policy = DefaultARCPolicy>
 class ARC {
  public:
     using EvictionCB = std::function<void(const K&, V&&)>;
-
-    ARC(size_t max_count)
-     : c_(max_count), p_(0), cached_bytes_(0), cache_hit_(0), cache_miss_(0)
-    {}
-
-    void Put(const K& key, const V& value);
-    void Put(const K& key, const V& value, const EvictionCB& cb);
-    bool Get(const K& key, V* value);
-    void Remove(const K& key);
+    using allocator_type =
+        typename Policy::template Allocator<std::pair<const K, V>>;
+    // Opaque reference to a pinned entry, see Lookup().
+    struct Handle;
+
+    // max_count is in units of Policy::Charge, a number of entries by
+    // default. It is clamped to the entries Policy::Storage can hold, see
+    // StaticStorage.
+    ARC(size_t max_count) : ARC(max_count, allocator_type()) {}
+    // With PmrPolicy, allocate from mr.
+    ARC(size_t max_count, std::pmr::memory_resource* mr)
+        : ARC(max_count, allocator_type(mr)) {}
+    ARC(size_t max_count, const allocator_type& alloc)
+     : c_(std::min(max_count, kMaxCapacity)), target_c_(c_), p_(0),
+       table_(EntryAlloc(alloc)), ghosts_(EntryAlloc(alloc)),
+       b1_(ARCQId::B1), t1_(ARCQId::T1),
+       b2_(ARCQId::B2), t2_(ARCQId::T2), cached_bytes_(0),
+       cache_hit_(0), cache_miss_(0), stamp_(0), handles_(0) {
+        if (Policy::Storage::kPreallocate && Policy::Charge::kUnit) {
+            // B1/T1/B2/T2 never hold more than 2 * c_ keys together, the
+            // table only holds T1/T2 with fingerprint ghosts
+            table_.Reserve(kFingerprintGhosts ? c_ + 1 : 2 * c_ + 1);
+        }
+        if constexpr (kFingerprintGhosts) {
+            if (Policy::Charge::kUnit) ghosts_.Reserve(c_ + 1);
+        }
+        if (Policy::Charge::kUnit) sketch_.EnsureCapacity(c_);
+    }
+    // All handles must have been released.
+    ~ARC() { assert(handles_ == 0); }
+
+    // The members taking a `const Q& key` accept a K, or any type the
+    // Hash and KeyEqual of the policy accept if they are transparent; Put
+    // only builds a K when the key is inserted. Without a transparent
+    // policy a Q other than K is converted to K first.
+    //
+    // The overloads taking a hash expect HashOf(key), computed by the
+    // caller once for several calls or shared with a sharding layer.
+    template <typename Q>
+    size_t HashOf(const Q& key) const;
+
+    template <typename Q>
+    void Put(const Q& key, const V& value);
+    template <typename Q>
+    void Put(const Q& key, V&& value);
+    void Put(K&& key, V&& value);
+    // on_evict(const K&, V&&) receives the entries this Put evicts from
+    // T1/T2. It is a template parameter and called directly, a lambda or an
+    // EvictionQueue (see eviction_queue.h) costs no std::function call; an
+    // EvictionCB works too.
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    void Put(const Q& key, const V& value, F&& on_evict);
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    void Put(const Q& key, V&& value, F&& on_evict);
+    template <typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    void Put(K&& key, V&& value, F&& on_evict);
+    template <typename Q>
+    void Put(const Q& key, size_t hash, const V& value);
+    template <typename Q>
+    void Put(const Q& key, size_t hash, V&& value);
+    void Put(K&& key, size_t hash, V&& value);
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    void Put(const Q& key, size_t hash, const V& value, F&& on_evict);
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    void Put(const Q& key, size_t hash, V&& value, F&& on_evict);
+    // Put a value which expires after ttl, with a policy whose Expiry is
+    // WheelExpiry. A later Put without ttl keeps the value forever. An
+    // expired entry is removed without leaving a ghost, so it does not
+    // count as a B1/B2 hit when it is Put again.
+    template <typename Q, typename Rep, typename Period>
+    void Put(const Q& key, const V& value,
+             std::chrono::duration<Rep, Period> ttl);
+    template <typename Q, typename Rep, typename Period>
+    void Put(const Q& key, V&& value, std::chrono::duration<Rep, Period> ttl);
+    template <typename Q, typename Rep, typename Period>
+    void Put(const Q& key, size_t hash, V&& value,
+             std::chrono::duration<Rep, Period> ttl);
+    // Put a value constructed from args. It is built once and moved into
+    // the cache, it is never copied.
+    template <typename Q, typename... Args>
+    void Emplace(const Q& key, Args&&... args);
+    template <typename Q>
+    bool Get(const Q& key, V* value);
+    template <typename Q>
+    bool Get(const Q& key, size_t hash, V* value);
+    // Same as Get()/Put() on keys[0..n) in order, but the keys are hashed
+    // and their entries prefetched a batch at a time before they are
+    // looked up, so that the cache misses of different keys overlap.
+    // values and found may be null. Returns the number of hits.
+    size_t MultiGet(const K* keys, size_t n, V* values, bool* found);
+    void MultiPut(const K* keys, const V* values, size_t n);
+    // Same as Get(key, &value) but without copying the value. The returned
+    // pointer is valid until the next non-const call on the cache.
+    template <typename Q>
+    const V* Get(const Q& key);
+    // On a hit, call visitor(const V&) with the cached value.
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const V&>::value>>
+    bool Get(const Q& key, F&& visitor);
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const V&>::value>>
+    bool Get(const Q& key, size_t hash, F&& visitor);
+    // Look the key up without reordering the queues or counting a hit/miss,
+    // safe to call concurrently with other const members.
+    template <typename Q>
+    bool Peek(const Q& key, V* value) const;
+    template <typename Q>
+    bool Peek(const Q& key, size_t hash, V* value) const;
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const V&>::value>>
+    bool Peek(const Q& key, F&& visitor) const;
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const V&>::value>>
+    bool Peek(const Q& key, size_t hash, F&& visitor) const;
+    // Get(key, value), on a miss call loader(key, &v) and Put the loaded
+    // value unless the loader returns false. The loaded key takes the
+    // normal Put path, a ghost hit adapts p as usual.
+    template <typename Loader>
+    bool GetOrLoad(const K& key, V* value, Loader&& loader);
+    LoadStats GetLoadStats() const;
+    // Same as Get(key) but the entry is pinned: its value stays valid and
+    // unchanged until Release(), whatever happens to the key meanwhile. A
+    // pinned entry is evicted, removed or overwritten as usual, its memory
+    // is only freed by the last Release(). Returns nullptr on a miss.
+    // Requires a storage with stable addresses (NodeStorage).
+    template <typename Q>
+    Handle* Lookup(const Q& key);
+    template <typename Q>
+    Handle* Lookup(const Q& key, size_t hash);
+    const K& Key(Handle* handle) const;
+    const V& Value(Handle* handle) const;
+    void Release(Handle* handle);
+    // Apply the queue update of a cache hit on key (T1 -> T2, or T2 MRU)
+    // without counting it. Returns false if the key is not resident.
+    template <typename Q>
+    bool Promote(const Q& key);
+    template <typename Q>
+    void Remove(const Q& key);
+    template <typename Q>
+    void Remove(const Q& key, size_t hash);
+    // Remove the entries whose ttl has run out. Lookups and Put do this
+    // first, Peek() ignores expired entries; call it to reclaim them while
+    // the cache is otherwise idle.
+    void Expire();
     void Clear();
     size_t Size() const;
+    // Change the capacity, keeping the content and scaling p by
+    // new_capacity / Capacity(). Growing takes effect at once. Shrinking
+    // lowers the effective capacity a few entries at a time: every Put
+    // evicts up to kShrinkStep entries beyond its own, or call Trim() to
+    // shrink on a schedule of your own. Meanwhile Capacity() is
+    // new_capacity and the cache holds more than that. new_capacity is
+    // clamped like max_count in the constructor.
+    void SetCapacity(size_t new_capacity);
+    // Shrink by up to budget entries (of average charge with ByteCharge)
+    // towards Capacity(), on_evict gets the evicted entries. Returns true
+    // once the cache is within Capacity().
+    bool Trim(size_t budget);
+    template <typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    bool Trim(size_t budget, F&& on_evict);
     size_t Capacity() const;
+    // Charge of the resident entries, equals Size() with EntryCountCharge.
+    size_t TotalCharge() const;
+    // Target charge of T1, the adaptive parameter p of the ARC paper.
+    size_t P() const;
     ARCSizeInfo ARCSize() const;
+    // Bytes of the resident keys and values, plus the keys of B1/B2 unless
+    // the policy uses FingerprintGhosts.
     size_t CachedByteCount() const;
     uint64_t HitCount() const;
     uint64_t MissCount() const;
-
-    // for test purpose
+    // Snapshot of the counters. Without Policy::kStats only hits, misses
+    // and p are set.
+    ARCStats GetStats() const;
+    // Write T1 and T2 with their values, the ghosts of B1 and B2 and p to
+    // path, each queue in LRU order. Keys and values are written by
+    // SnapshotTraits, see cache_traits.h.
+    bool SaveSnapshot(const std::string& path) const;
+    // Replace the content of the cache by a snapshot: the same queues in
+    // the same order and the same p, so that a restarted process gets the
+    // hit ratio it had before. A snapshot of a larger cache is evicted down
+    // to Capacity(), its ghosts above Capacity() are dropped; p is scaled
+    // to Capacity(). Returns false if path cannot be read, is not a
+    // snapshot or was saved with other ghosts or another Charge, the cache
+    // is empty then.
+    // Snapshots are in native byte order; with FingerprintGhosts they are
+    // only valid for the same Hash.
+    bool LoadSnapshot(const std::string& path);
+
+    // A key and its value as visited in a queue, the value is V() in B1
+    // and B2.
+    struct QueueItem {
+        const K& key;
+        const V& value;
+    };
+    class QueueIterator;
+    class QueueRange;
+    // Call f(const K& key, const V& value) for every entry of q from the
+    // LRU to the MRU end, in place. Expired entries are skipped, B1/B2 are
+    // empty with FingerprintGhosts. If f returns bool, false stops the
+    // walk. f must not modify the cache.
+    template <typename F>
+    void ForEachInQ(ARCQId q, F&& f) const;
+    // The walk of ForEachInQ() as a range of QueueItem, e.g.
+    //     for (auto item : cache.EntriesOfQ(ARCQId::T2)) ...
+    // Any modification of the cache, Get() included, invalidates it.
+    QueueRange EntriesOfQ(ARCQId q) const;
+    // Position of a ForEachInQFrom() walk, a default constructed cursor is
+    // at the LRU end.
+    struct QueueCursor {
+        bool resume = false;
+        K key{};             // the next entry to visit
+        uint32_t stamp = 0;  // when key was linked to its queue
+    };
+    // ForEachInQ() in steps for a caller which lets go of the cache between
+    // them, see ShardedARC::Scan(). Visit up to *budget entries, skipped
+    // ones included, decrementing *budget, and advance *cursor. Returns
+    // false once the walk reached the MRU end.
+    // Entries enter a queue at the MRU end only, so the walk resumes at the
+    // first entry linked to q since the entry of the cursor, whatever
+    // happened to that one. An entry which stays in q is visited once, one
+    // which is linked to q again, e.g. by a T2 hit, may be visited again.
+    template <typename F>
+    bool ForEachInQFrom(ARCQId q, QueueCursor* cursor, size_t* budget,
+                        F&& f) const;
+
+    // for test purpose, B1/B2 look empty with FingerprintGhosts
     std::vector<K> GetKeysOfQ(ARCQId q) const;
     std::vector<V> GetValuesOfQ(ARCQId q) const;
 
  private:
-    struct B;
-    struct T;
-    struct BMapVal;
-    struct TMapVal;
-    struct BListVal;
-    struct TListVal;
-    typedef std::unordered_map<K, BMapVal> BMap;
-    typedef typename BMap::iterator BMapIter;
-    typedef std::unordered_map<K, TMapVal> TMap;
-    typedef typename TMap::iterator TMapIter;
-
-    typedef typename std::list<BListVal> BList;
-    typedef typename BList::iterator BListIter;
-    typedef typename std::list<TListVal> TList;
-    typedef typename TList::iterator TListIter;
+    // A key lives in exactly one entry, whatever queue it is in. Ghost
+    // entries (B1/B2) keep the key only, their value is reset. With
+    // FingerprintGhosts the table only holds T1/T2 and the ghosts live in
+    // ghosts_.
+    // A pinned entry which leaves the cache is detached: taken out of the
+    // index and the queues but kept alive for its handles.
+    // With WheelExpiry, an entry Put with a ttl holds its timer.
+    typedef typename Policy::Expiry Expiry;
+    static constexpr bool kExpiry = Expiry::kEnabled;
+    struct Entry : detail::EntryTimer<kExpiry> {
+        K key;
+        V value;
+        ARCQId q;
+        uint32_t charge;
+        uint32_t refs;  // handles, kDetached is set once detached
+        uint32_t stamp;  // stamp_ when it was linked to q
+
+        template <typename KArg, typename VArg>
+        Entry(KArg&& k, VArg&& v, ARCQId id, uint32_t w)
+            : key(std::forward<KArg>(k)), value(std::forward<VArg>(v)),
+              q(id), charge(w), refs(0), stamp(0) {}
+        bool Pinned() const { return refs != 0; }
+    };
+    static constexpr uint32_t kDetached = 1u << 31;
+    // entries a Put evicts towards a lower capacity, see SetCapacity()
+    static constexpr size_t kShrinkStep = 16;
+    // keys per MultiGet/MultiPut prefetch batch
+    static constexpr size_t kPrefetchBatch = 32;
+    typedef typename Policy::template Hash<K> Hash;
+    typedef typename Policy::template KeyEqual<K> KeyEqual;
+    typedef typename Policy::template Allocator<Entry> EntryAlloc;
+    typedef typename Policy::Storage::template Table<Entry, Hash, KeyEqual,
+                                                     EntryAlloc> Table;
+    static constexpr bool kTransparent =
+        detail::IsTransparent<Hash>::value &&
+        detail::IsTransparent<KeyEqual>::value;
+    typedef typename Table::Handle Slot;
+    typedef typename Policy::Ghosts::template Table<EntryAlloc> GhostTable;
+    static constexpr bool kFingerprintGhosts = Policy::Ghosts::kFingerprint;
+    // the table holds up to c_ + 1 entries, 2 * c_ + 1 with key ghosts;
+    // every charge is at least 1, this bounds ByteCharge too
+    static constexpr size_t kMaxCapacity =
+        kFingerprintGhosts ? Policy::Storage::kMaxEntries - 1
+                           : (Policy::Storage::kMaxEntries - 1) / 2;
+    typedef std::conditional_t<kExpiry, detail::TimerWheel<Slot>,
+                               detail::NoTimerWheel> Wheel;
+    static constexpr bool kAdmission = Policy::Admission::kEnabled;
+    typedef std::conditional_t<kAdmission, detail::FrequencySketch,
+                               detail::NoFrequencySketch> Sketch;
+
+    // Intrusive LRU queue, head is the LRU end and tail is the MRU end.
+    struct Queue {
+        Slot head;
+        Slot tail;
+        size_t count;
+        size_t charge;  // sum of the charges of its entries
+        const ARCQId id;
+
+        explicit Queue(ARCQId q)
+            : head(Table::Nil()), tail(Table::Nil()), count(0), charge(0),
+              id(q) {}
+        size_t Count() const { return count; }
+    };
 
     ARC(const ARC&) = delete;
     void operator=(const ARC&) = delete;
 
-    void Replace(const K& k, const EvictionCB& evict_cb);
-    bool Move_T_B(T* t, B* b, const EvictionCB& evict_cb);
-    bool IsCacheFull() const;
-    void IncreaseP(size_t delta);
-    void DecreaseP(size_t delta);
+    static bool IsResident(ARCQId q) {
+        return q == ARCQId::T1 || q == ARCQId::T2;
+    }
+    Queue* QueueOf(ARCQId q);
+    const Queue* QueueOf(ARCQId q) const;
+    // visit up to budget entries from h on, returns the first one not
+    // visited, Nil if the walk reached the MRU end or f stopped it
+    template <typename F>
+    Slot Walk(Slot h, size_t* budget, F& f) const;
+    // stamp a was taken before b, stamp_ wraps around
+    static bool StampBefore(uint32_t a, uint32_t b) {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+    void Link(Queue* q, Slot h);
+    void Unlink(Slot h);
+
+    static size_t ChargeOf(const K& k, const V& v);
+    // key itself if it can probe the table, else key converted to K
+    template <typename Q>
+    static decltype(auto) LookupKey(const Q& key);
+    template <typename Q>
+    Slot FindResident(const Q& key, size_t hash) const;
+    // FindResident() for a lookup, which counts as an access of the key
+    // for the admission sketch
+    template <typename Q>
+    Slot FindAccessed(const Q& key, size_t hash);
+    // true if a new key of hash may evict the next victim
+    bool Admit(size_t hash) const;
+    // Evict is the type of the eviction callback, detail::NoEviction if
+    // there is none
+    template <typename KArg, typename VArg, typename Evict>
+    void PutImpl(size_t hash, KArg&& key, VArg&& value, Evict& evict);
+    // Put of a key which is not in the table, KArg is K
+    template <typename KArg, typename VArg, typename Evict>
+    void PutMiss(size_t hash, KArg&& key, VArg&& value, Evict& evict);
+    // hash keys[0..n) into hashes and prefetch their index positions and
+    // entries, n <= kPrefetchBatch
+    void PrefetchBatch(const K* keys, size_t n, size_t* hashes) const;
+    // adapt p to a ghost hit in B1 (B2 if b2_hit) of charge units and make
+    // room for it
+    template <typename Evict>
+    void OnGhostHit(bool b2_hit, size_t charge, Evict& evict);
+    template <typename KArg, typename VArg>
+    void Insert(Queue* q, size_t hash, KArg&& k, VArg&& v, size_t charge);
+    template <typename VArg>
+    void Assign(Slot h, VArg&& v);
+    void Touch(Slot h);
+    template <typename VArg>
+    void Revive(Slot h, VArg&& v, size_t charge);
+    void Erase(Slot h);
+    // Take h out of the index, it is freed now unless it is pinned.
+    void Discard(Slot h);
+    // Replace pinned h with a fresh entry of the same key, queue position
+    // and charge, with a default value. h is discarded.
+    Slot Detach(Slot h);
+    // hand the value of an entry leaving the cache to evict
+    template <typename Evict>
+    void Evicted(Entry& e, Evict& evict);
+    template <typename Evict>
+    bool RemoveLRU(Queue* t, Evict& evict);
+    void RemoveGhostLRU(Queue* b);
+    // FingerprintGhosts only
+    void PushGhost(Queue* b, size_t hash, uint32_t charge);
+    void EraseGhost(typename GhostTable::Handle g);
+    template <typename VArg, typename Evict>
+    void Update(Slot h, VArg&& v, Evict& evict);
+    // WheelExpiry only. Clock::now() in ticks.
+    static uint64_t NowTick();
+    bool Expired(Slot h) const;
+    // expire resident key in ttl ticks, at once if ttl <= 0
+    template <typename Q>
+    void SetTTL(const Q& key, size_t hash, int64_t ttl);
+    void CancelTimer(Slot h);
+    static uint32_t SnapshotFlags();
+    static int64_t WallClockNanos();
+    // parse the entries of a snapshot into the empty cache
+    bool LoadEntries(const detail::SnapshotHeader& header, const char* p,
+                     const char* end);
+
+    template <typename Evict>
+    void Replace(bool b2_hit, size_t charge, Evict& evict);
+    // lower c_ by up to budget entries towards target_c_
+    template <typename Evict>
+    void Shrink(size_t budget, Evict& evict);
+    // evict T1/T2 into B1/B2 and drop ghosts until the queues fit c_
+    template <typename Evict>
+    void FitCapacity(Evict& evict);
+    template <typename Evict>
+    bool Move_T_B(Queue* t, Queue* b, Evict& evict);
+    // true if the resident entries leave no room for charge more units
+    bool IsCacheFull(size_t charge = 1) const;
+    void IncreaseP(size_t delta, size_t charge);
+    void DecreaseP(size_t delta, size_t charge);
     void OnCacheHit();
     void OnCacheMiss();
+    // Count an event in stats_, a no-op without Policy::kStats.
+    void Count(uint64_t ARCStats::*counter);
+    // count a read hit on resident h before it is touched
+    void CountHit(Slot h);
     void UpdateRemoveFromCacheBytes(size_t bytes);
     void UpdateAddToCacheBytes(size_t bytes);
 
-    struct BMapVal {
-        BListIter list_iter;
-
-        BMapVal() = default;
-        BMapVal(const BMapVal& o) = default;
-        BMapVal& operator=(const BMapVal& o) = default;
-        BMapVal(const BListIter& iter)  // NOLINT
-            : list_iter(iter) {}
-    };
-    struct TMapVal {
-        TListIter list_iter;
-
-        TMapVal() = default;
-        TMapVal(const TMapVal& o) = default;
-        TMapVal& operator=(const TMapVal& o) = default;
-        TMapVal(const TListIter& iter)  // NOLINT
-            : list_iter(iter) {}
-    };
-    struct BListVal {
-        BMapIter map_iter;
-
-        BListVal() = default;
-        BListVal(const BListVal& o) = default;
-        BListVal& operator=(const BListVal& o) = default;
-        BListVal(const BMapIter& iter)  // NOLINT
-            :map_iter(iter) {}
-    };
-    struct TListVal {
-        TMapIter map_iter;
-        V value;
-
-        TListVal() = default;
-        TListVal(const TListVal& o) = default;
-        TListVal(const TMapIter& iter, const V& v)
-            : map_iter(iter), value(v) {}
-        TListVal& operator=(const TListVal& o) = default;
-    };
-
-    struct B {
-        BMap map_;
-        BList list_;
-
-        bool Find(const K& k, BMapIter* iter);
-        void Insert(const K& k);
-        void Remove(BMapIter&& map_iter, ARC* cache);
-        void RemoveLRU(ARC* cache);
-        size_t Count() const { return map_.size(); }
-        void Clear() { list_.clear(); map_.clear(); }
-    };
-
-    struct T {
-        TMap map_;
-        TList list_;
-
-        void Insert(const K& k, const V& v, ARC* cache);
-        void Move(const K& k, T* other, TMapIter&& other_it, const V *v,
-                  ARC *cache);
-        bool Find(const K& k, TMapIter* map_iter);
-        void Remove(TMapIter&& map_iter, ARC* cache);
-        bool RemoveLRU(const EvictionCB& evict_cb, ARC* cache);
-        void Touch(const TMapIter& map_iter, const V* v, ARC* cache);
-        size_t Count() const { return map_.size(); }
-        TMapIter GetLRU() const { return list_.begin()->map_iter; }
-        void Clear() { list_.clear(); map_.clear(); }
-    };
-
     size_t c_;
+    size_t target_c_;  // c_ is above it while shrinking
     size_t p_;
-    B b1_;
-    B b2_;
-    T t1_;
-    T t2_;
+    Table table_;
+    GhostTable ghosts_;
+    Wheel wheel_;
+    Sketch sketch_;
+    Queue b1_;
+    Queue t1_;
+    Queue b2_;
+    Queue t2_;
     size_t cached_bytes_;
     uint64_t cache_hit_;
     uint64_t cache_miss_;
+    uint32_t stamp_;  // count of Link() calls
+    size_t handles_;
+    LoadStats load_stats_;
+    ARCStats stats_;
 };
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-bool ARC<K, V, KeyTraits, ValueTraits>::B::Find(const K& k,
-    BMapIter *iter) {
-    auto it = map_.find(k);
-    if (it != map_.end()) {
-        if (iter != nullptr) *iter = it;
-        return true;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Queue*
+ARC<K, V, KeyTraits, ValueTraits, Policy>::QueueOf(ARCQId q) {
+    switch (q) {
+    case ARCQId::B1: return &b1_;
+    case ARCQId::T1: return &t1_;
+    case ARCQId::B2: return &b2_;
+    case ARCQId::T2: return &t2_;
     }
-    return false;
+    return nullptr;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::B::Insert(const K& k) {
-    auto r = map_.insert({k, BListIter{}});
-    assert(r.second);
-    list_.push_back(r.first);
-    r.first->second.list_iter = --list_.end();
-}
-
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::B::Remove(BMapIter&& map_iter,
-    ARC* cache) {
-    if (cache) {
-        cache->UpdateRemoveFromCacheBytes(
-            KeyTraits::CountBytes(map_iter->first));
-    }
-    list_.erase(map_iter->second.list_iter);
-    map_.erase(map_iter);
-}
-
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::B::RemoveLRU(ARC* cache) {
-    if (list_.empty()) return;
-    if (cache) {
-        cache->UpdateRemoveFromCacheBytes(
-            KeyTraits::CountBytes(list_.front().map_iter->first));
-    }
-    map_.erase(list_.front().map_iter);
-    list_.pop_front();
-}
-
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::T::Insert(const K& k, const V& v,
-    ARC* cache) {
-    auto r = map_.insert({k, TListIter{}});
-    assert(r.second);
-    list_.emplace_back(r.first, v);
-    r.first->second.list_iter = --list_.end();
-    if (cache != nullptr) {
-        cache->UpdateAddToCacheBytes(KeyTraits::CountBytes(k) +
-                ValueTraits::CountBytes(v));
-    }
-}
-
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::T::Move(const K& k, T* other,
-    TMapIter&& other_it, const V *v, ARC *cache) {
-    // Move key-value from another to this. For C++17 and later,
-    // we use extract() and insert() to improve performance.
-    list_.splice(list_.end(), other->list_, other_it->second.list_iter);
-    if (v != nullptr) {
-        if (cache != nullptr) {
-            size_t oldSize =
-                ValueTraits::CountBytes(list_.back().value);
-            size_t newSize = ValueTraits::CountBytes(*v);
-            if (oldSize != newSize) {
-                cache->UpdateRemoveFromCacheBytes(oldSize);
-                cache->UpdateAddToCacheBytes(newSize);
-            }
-        }
-        list_.back().value = *v;
-    }
-#if __cplusplus >= 201703L
-    auto node = other->map_.extract(other_it);
-    auto r = map_.insert(std::move(node));
-    assert(r.inserted);
-    list_.back().map_iter = r.position;
-    r.position->second.list_iter = --list_.end();
-#else
-    auto r = map_.insert({k, TListIter()});
-    assert(r.second);
-    list_.back().map_iter = r.first;
-    r.first->second.list_iter = --list_.end();
-    other->map_.erase(other_it);
-#endif
-}
-
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-bool ARC<K, V, KeyTraits, ValueTraits>::T::Find(const K& k,
-    TMapIter* map_iter) {
-    auto it = map_.find(k);
-    if (it != map_.end()) {
-        if (map_iter != nullptr) *map_iter = it;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+const typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Queue*
+ARC<K, V, KeyTraits, ValueTraits, Policy>::QueueOf(ARCQId q) const {
+    return const_cast<ARC*>(this)->QueueOf(q);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Link(Queue* q, Slot h) {
+    // append h to q as MRU item
+    table_.Prev(h) = q->tail;
+    table_.Next(h) = Table::Nil();
+    if (q->tail != Table::Nil())
+        table_.Next(q->tail) = h;
+    else
+        q->head = h;
+    q->tail = h;
+    q->count++;
+    q->charge += table_.At(h).charge;
+    table_.At(h).q = q->id;
+    table_.At(h).stamp = stamp_++;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Unlink(Slot h) {
+    Queue* q = QueueOf(table_.At(h).q);
+    Slot prev = table_.Prev(h);
+    Slot next = table_.Next(h);
+    if (prev != Table::Nil())
+        table_.Next(prev) = next;
+    else
+        q->head = next;
+    if (next != Table::Nil())
+        table_.Prev(next) = prev;
+    else
+        q->tail = prev;
+    q->count--;
+    q->charge -= table_.At(h).charge;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::ChargeOf(const K& k,
+    const V& v) {
+    return Policy::Charge::template Of<KeyTraits, ValueTraits>(k, v);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+decltype(auto) ARC<K, V, KeyTraits, ValueTraits, Policy>::LookupKey(
+    const Q& key) {
+    if constexpr (kTransparent || std::is_same<Q, K>::value)
+        return (key);
+    else
+        return K(key);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::HashOf(const Q& key) const {
+    return table_.HashOf(LookupKey(key));
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Slot
+ARC<K, V, KeyTraits, ValueTraits, Policy>::FindResident(const Q& key,
+    size_t hash) const {
+    Slot h = table_.Find(LookupKey(key), hash);
+    if (h != Table::Nil() && IsResident(table_.At(h).q)) return h;
+    return Table::Nil();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Slot
+ARC<K, V, KeyTraits, ValueTraits, Policy>::FindAccessed(const Q& key,
+    size_t hash) {
+    if constexpr (kAdmission) sketch_.Increment(hash);
+    return FindResident(key, hash);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Admit(size_t hash) const {
+    if constexpr (kAdmission) {
+        const Queue* q = t1_.Count() > 0 ? &t1_ : &t2_;
+        if (q->Count() == 0) return true;
+        return sketch_.Frequency(hash) >
+               sketch_.Frequency(table_.HashAt(q->head));
+    } else {
+        (void)hash;
         return true;
     }
+}
 
-    return false;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename KArg, typename VArg>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Insert(Queue* q,
+    size_t hash, KArg&& k, VArg&& v, size_t charge) {
+    assert(charge <= UINT32_MAX);
+    Slot h = table_.Insert(hash, std::forward<KArg>(k),
+                             std::forward<VArg>(v), q->id,
+                             static_cast<uint32_t>(charge));
+    Link(q, h);
+    const Entry& e = table_.At(h);
+    UpdateAddToCacheBytes(KeyTraits::CountBytes(e.key) +
+            ValueTraits::CountBytes(e.value));
+    Count(&ARCStats::inserts);
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::T::Remove(TMapIter&& map_iter,
-    ARC* cache) {
-    if (cache != nullptr) {
-        cache->UpdateRemoveFromCacheBytes(
-                KeyTraits::CountBytes(map_iter->first) +
-                ValueTraits::CountBytes(map_iter->second.list_iter->value));
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename VArg>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Assign(Slot h, VArg&& v) {
+    // Replace the value of a resident entry, its charge may change.
+    Entry& e = table_.At(h);
+    Queue* q = QueueOf(e.q);
+    size_t oldSize = ValueTraits::CountBytes(e.value);
+    e.value = std::forward<VArg>(v);
+    size_t newSize = ValueTraits::CountBytes(e.value);
+    if (oldSize != newSize) {
+        UpdateRemoveFromCacheBytes(oldSize);
+        UpdateAddToCacheBytes(newSize);
     }
-    list_.erase(map_iter->second.list_iter);
-    map_.erase(map_iter);
+    q->charge -= e.charge;
+    e.charge = static_cast<uint32_t>(ChargeOf(e.key, e.value));
+    q->charge += e.charge;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-bool ARC<K, V, KeyTraits, ValueTraits>::T::RemoveLRU(
-    const EvictionCB& evict_cb, ARC* cache) {
-    if (list_.empty()) return false;
-    if (evict_cb) {
-        auto &list_val = list_.front();
-        evict_cb(list_val.map_iter->first, std::move(list_val.value));
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Touch(Slot h) {
+    // Move a resident entry to t2_ as MRU item.
+    if (h == t2_.tail) return;
+    Unlink(h);
+    Link(&t2_, h);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename VArg>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Revive(Slot h, VArg&& v,
+    size_t charge) {
+    // Ghost hit, bring the key back to t2_ with the new value.
+    Entry& e = table_.At(h);
+    Unlink(h);
+    e.value = std::forward<VArg>(v);
+    e.charge = static_cast<uint32_t>(charge);
+    Link(&t2_, h);
+    UpdateAddToCacheBytes(ValueTraits::CountBytes(e.value));
+    Count(&ARCStats::inserts);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Erase(Slot h) {
+    const Entry& e = table_.At(h);
+    size_t bytes = KeyTraits::CountBytes(e.key);
+    if (IsResident(e.q)) bytes += ValueTraits::CountBytes(e.value);
+    UpdateRemoveFromCacheBytes(bytes);
+    Unlink(h);
+    Discard(h);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Discard(Slot h) {
+    CancelTimer(h);
+    if constexpr (Policy::Storage::kStableAddress) {
+        Entry& e = table_.At(h);
+        if (e.Pinned()) {
+            table_.Detach(h);
+            e.refs |= kDetached;
+            return;
+        }
     }
-    if (cache != nullptr) {
-        cache->UpdateRemoveFromCacheBytes(
-                KeyTraits::CountBytes(list_.front().map_iter->first) +
-                ValueTraits::CountBytes(list_.front().value));
+    table_.Erase(h);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Slot
+ARC<K, V, KeyTraits, ValueTraits, Policy>::Detach(Slot h) {
+    const Entry& e = table_.At(h);
+    Slot n = table_.Insert(table_.HashAt(h), e.key, V(), e.q, e.charge);
+    Queue* q = QueueOf(e.q);
+    Slot prev = table_.Prev(h);
+    Slot next = table_.Next(h);
+    table_.Prev(n) = prev;
+    table_.Next(n) = next;
+    if (prev != Table::Nil())
+        table_.Next(prev) = n;
+    else
+        q->head = n;
+    if (next != Table::Nil())
+        table_.Prev(next) = n;
+    else
+        q->tail = n;
+    if constexpr (kExpiry) {
+        // the timer follows the key
+        std::swap(table_.At(n).timer, table_.At(h).timer);
+        if (table_.At(n).timer != Wheel::Nil())
+            wheel_.SetItem(table_.At(n).timer, n);
+    }
+    Discard(h);
+    return n;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Evicted(Entry& e,
+    Evict& evict) {
+    if constexpr (!std::is_same<std::decay_t<Evict>,
+                                detail::NoEviction>::value) {
+        if (detail::IsNullCallback(evict)) return;
+        // a pinned value stays with its handles, the callback gets a copy
+        if (e.Pinned())
+            evict(e.key, V(e.value));
+        else
+            evict(e.key, std::move(e.value));
     }
-    map_.erase(list_.front().map_iter);
-    list_.pop_front();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::RemoveLRU(Queue* t,
+    Evict& evict) {
+    // Drop t's LRU item from the cache without remembering it in a ghost.
+    if (t->head == Table::Nil()) return false;
+    Slot h = t->head;
+    Entry& e = table_.At(h);
+    Count(t == &t1_ ? &ARCStats::t1_evictions : &ARCStats::t2_evictions);
+    UpdateRemoveFromCacheBytes(KeyTraits::CountBytes(e.key) +
+            ValueTraits::CountBytes(e.value));
+    Evicted(e, evict);
+    Unlink(h);
+    Discard(h);
     return true;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::T::Touch(const TMapIter& map_iter,
-    const V* v, ARC* cache) {
-    auto newest_iter = --list_.end();
-    if (v && cache) {
-        size_t oldSize =
-            ValueTraits::CountBytes(map_iter->second.list_iter->value);
-        size_t newSize = ValueTraits::CountBytes(*v);
-        if (oldSize != newSize) {
-            cache->UpdateRemoveFromCacheBytes(oldSize);
-            cache->UpdateAddToCacheBytes(newSize);
-        }
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::RemoveGhostLRU(Queue* b) {
+    if (b->Count() != 0)
+        Count(b == &b1_ ? &ARCStats::b1_drops : &ARCStats::b2_drops);
+    if constexpr (kFingerprintGhosts) {
+        typename GhostTable::Handle g = ghosts_.Head(b == &b2_);
+        if (g != GhostTable::Nil()) EraseGhost(g);
+    } else {
+        if (b->head == Table::Nil()) return;
+        Erase(b->head);
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::PushGhost(Queue* b,
+    size_t hash, uint32_t charge) {
+    ghosts_.Push(b == &b2_, hash, charge);
+    b->count++;
+    b->charge += charge;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::EraseGhost(
+    typename GhostTable::Handle g) {
+    Queue* b = ghosts_.List(g) ? &b2_ : &b1_;
+    b->count--;
+    b->charge -= ghosts_.Charge(g);
+    ghosts_.Erase(g);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename VArg, typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Update(Slot h, VArg&& v,
+    Evict& evict) {
+    // Put on a resident key, its charge may change with the value.
+    Count(&ARCStats::updates);
+    CancelTimer(h);
+    if (ChargeOf(table_.At(h).key, v) > c_) {
+        Erase(h);
+        return;
+    }
+    if (table_.At(h).Pinned()) {
+        // the new value goes to a fresh entry
+        const V& old = table_.At(h).value;
+        UpdateRemoveFromCacheBytes(ValueTraits::CountBytes(old));
+        h = Detach(h);
+        UpdateAddToCacheBytes(ValueTraits::CountBytes(table_.At(h).value));
     }
-    if (newest_iter == map_iter->second.list_iter) {
-        if (v != nullptr) newest_iter->value = *v;
+    Assign(h, std::forward<VArg>(v));
+    Touch(h);
+    // h is t2_'s MRU item, it is the last one Replace() would pick
+    Replace(false, 0, evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+uint64_t ARC<K, V, KeyTraits, ValueTraits, Policy>::NowTick() {
+    return std::chrono::duration_cast<typename Expiry::Tick>(
+        Expiry::Clock::now().time_since_epoch()).count();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Expired(Slot h) const {
+    if constexpr (kExpiry) {
+        uint32_t t = table_.At(h).timer;
+        return t != Wheel::Nil() && wheel_.Deadline(t) <= NowTick();
+    } else {
+        return false;
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::SetTTL(const Q& key,
+    size_t hash, int64_t ttl) {
+    Slot h = FindResident(key, hash);
+    if (h == Table::Nil()) return;
+    // Put has advanced the wheel to now and canceled the timer of the old
+    // value
+    if (ttl <= 0) {
+        Count(&ARCStats::expirations);
+        Erase(h);
         return;
     }
+    table_.At(h).timer = wheel_.Add(h, wheel_.Now() + ttl);
+}
 
-    list_.splice(list_.end(), list_, map_iter->second.list_iter);
-    if (v != nullptr) {
-        list_.back().value = *v;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::CancelTimer(Slot h) {
+    if constexpr (kExpiry) {
+        Entry& e = table_.At(h);
+        if (e.timer != Wheel::Nil()) {
+            wheel_.Cancel(e.timer);
+            e.timer = Wheel::Nil();
+        }
     }
-    map_iter->second.list_iter = --list_.end();
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-bool ARC<K, V, KeyTraits, ValueTraits>::IsCacheFull() const {
-    return t1_.Count() + t2_.Count() == c_;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::IsCacheFull(
+    size_t charge) const {
+    return t1_.charge + t2_.charge + charge > c_;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::IncreaseP(size_t delta) {
-    if (!IsCacheFull())
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::IncreaseP(size_t delta,
+    size_t charge) {
+    if (!IsCacheFull(charge))
         return;
     if (delta > c_ - p_)
         p_ = c_;
     else
         p_ += delta;
+    if constexpr (Policy::kStats) stats_.max_p = std::max(stats_.max_p, p_);
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::DecreaseP(size_t delta) {
-    if (!IsCacheFull())
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::DecreaseP(size_t delta,
+    size_t charge) {
+    if (!IsCacheFull(charge))
         return;
     if (delta > p_)
         p_ = 0;
     else
         p_ -= delta;
+    if constexpr (Policy::kStats) stats_.min_p = std::min(stats_.min_p, p_);
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-bool ARC<K, V, KeyTraits, ValueTraits>::Get(const K& key, V* value) {
-    TMapIter it;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    V* value) {
+    const auto& k = LookupKey(key);
+    return Get(k, table_.HashOf(k), value);
+}
 
-    if (t1_.Find(key, &it)) {
-        if (value) *value = it->second.list_iter->value;
-        t2_.Move(key, &t1_, std::move(it), nullptr, this);
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    size_t hash, V* value) {
+    Expire();
+    Slot h = FindAccessed(key, hash);
+
+    if (h != Table::Nil()) {
+        if (value) *value = table_.At(h).value;
+        CountHit(h);
+        Touch(h);
         OnCacheHit();
         return true;
     }
-    if (t2_.Find(key, &it)) {
-        if (value) *value = it->second.list_iter->value;
-        t2_.Touch(it, nullptr, nullptr);
+    OnCacheMiss();
+    return false;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::PrefetchBatch(const K* keys,
+    size_t n, size_t* hashes) const {
+    for (size_t i = 0; i < n; ++i) {
+        hashes[i] = table_.HashOf(keys[i]);
+        table_.PrefetchBucket(hashes[i]);
+    }
+    for (size_t i = 0; i < n; ++i)
+        table_.PrefetchMatch(hashes[i]);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::MultiGet(const K* keys,
+    size_t n, V* values, bool* found) {
+    size_t hashes[kPrefetchBatch];
+    Slot slots[kPrefetchBatch];
+    size_t hits = 0;
+
+    Expire();
+
+    for (size_t base = 0; base < n; base += kPrefetchBatch) {
+        size_t m = std::min(kPrefetchBatch, n - base);
+        const K* batch = keys + base;
+        PrefetchBatch(batch, m, hashes);
+        // Touch() rewrites the queue neighbours of every hit
+        for (size_t i = 0; i < m; ++i) {
+            Slot h = FindAccessed(batch[i], hashes[i]);
+            slots[i] = h;
+            if (h == Table::Nil()) continue;
+            if (table_.Prev(h) != Table::Nil())
+                table_.PrefetchHandle(table_.Prev(h));
+            if (table_.Next(h) != Table::Nil())
+                table_.PrefetchHandle(table_.Next(h));
+        }
+        for (size_t i = 0; i < m; ++i) {
+            Slot h = slots[i];
+            bool hit = h != Table::Nil();
+            if (hit) {
+                if (values) values[base + i] = table_.At(h).value;
+                CountHit(h);
+                Touch(h);
+                OnCacheHit();
+                hits++;
+            } else {
+                OnCacheMiss();
+            }
+            if (found) found[base + i] = hit;
+        }
+    }
+    return hits;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::MultiPut(const K* keys,
+    const V* values, size_t n) {
+    detail::NoEviction none;
+    size_t hashes[kPrefetchBatch];
+
+    for (size_t base = 0; base < n; base += kPrefetchBatch) {
+        size_t m = std::min(kPrefetchBatch, n - base);
+        PrefetchBatch(keys + base, m, hashes);
+        for (size_t i = 0; i < m; ++i)
+            PutImpl(hashes[i], keys[base + i], values[base + i], none);
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+const V* ARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key) {
+    Expire();
+    const auto& k = LookupKey(key);
+    Slot h = FindAccessed(k, table_.HashOf(k));
+
+    if (h != Table::Nil()) {
+        CountHit(h);
+        Touch(h);
+        OnCacheHit();
+        return &table_.At(h).value;
+    }
+    OnCacheMiss();
+    return nullptr;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    F&& visitor) {
+    const V* value = Get(key);
+    if (value == nullptr) return false;
+    visitor(*value);
+    return true;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    size_t hash, F&& visitor) {
+    Expire();
+    Slot h = FindAccessed(key, hash);
+
+    if (h != Table::Nil()) {
+        CountHit(h);
+        Touch(h);
         OnCacheHit();
+        visitor(table_.At(h).value);
         return true;
     }
     OnCacheMiss();
     return false;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::Put(const K& key, const V& value) {
-    static EvictionCB cb(nullptr);
-    Put(key, value, cb);
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Peek(const Q& key,
+    V* value) const {
+    const auto& k = LookupKey(key);
+    return Peek(k, table_.HashOf(k), value);
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::Put(const K& key, const V& value,
-    const EvictionCB& evict_cb) {
-    TMapIter it;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Peek(const Q& key,
+    size_t hash, V* value) const {
+    Slot h = FindResident(key, hash);
 
-    if (t1_.Find(key, &it)) {
-        t2_.Move(key, &t1_, std::move(it), &value, this);
-        OnCacheHit();
-        return;
+    if (h != Table::Nil() && !Expired(h)) {
+        if (value) *value = table_.At(h).value;
+        return true;
     }
-    if (t2_.Find(key, &it)) {
-        t2_.Touch(it, &value, this);
+    return false;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Peek(const Q& key,
+    F&& visitor) const {
+    const auto& k = LookupKey(key);
+    return Peek(k, table_.HashOf(k), visitor);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Peek(const Q& key,
+    size_t hash, F&& visitor) const {
+    Slot h = FindResident(key, hash);
+
+    if (h != Table::Nil() && !Expired(h)) {
+        visitor(table_.At(h).value);
+        return true;
+    }
+    return false;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Handle*
+ARC<K, V, KeyTraits, ValueTraits, Policy>::Lookup(const Q& key) {
+    const auto& k = LookupKey(key);
+    return Lookup(k, table_.HashOf(k));
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Handle*
+ARC<K, V, KeyTraits, ValueTraits, Policy>::Lookup(const Q& key,
+    size_t hash) {
+    static_assert(Policy::Storage::kStableAddress,
+                  "Lookup() needs a storage whose entries never move");
+    Expire();
+    Slot h = FindAccessed(key, hash);
+
+    if (h != Table::Nil()) {
+        CountHit(h);
+        Touch(h);
         OnCacheHit();
-        return;
+        table_.At(h).refs++;
+        handles_++;
+        return reinterpret_cast<Handle*>(h);
     }
+    OnCacheMiss();
+    return nullptr;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+const K& ARC<K, V, KeyTraits, ValueTraits, Policy>::Key(
+    Handle* handle) const {
+    return table_.At(reinterpret_cast<Slot>(handle)).key;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+const V& ARC<K, V, KeyTraits, ValueTraits, Policy>::Value(
+    Handle* handle) const {
+    return table_.At(reinterpret_cast<Slot>(handle)).value;
+}
 
-    BMapIter it2;
-    if (b1_.Find(key, &it2)) {
-        size_t delta = std::min((size_t)1, b2_.Count() / b1_.Count());
-        IncreaseP(delta);
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Release(Handle* handle) {
+    Slot h = reinterpret_cast<Slot>(handle);
+    Entry& e = table_.At(h);
+    assert((e.refs & ~kDetached) != 0);
+    handles_--;
+    if (--e.refs == kDetached) table_.Free(h);
+}
 
-        Replace(key, evict_cb);
-        b1_.Remove(std::move(it2), this);
-        t2_.Insert(key, value, this);
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Loader>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::GetOrLoad(const K& key,
+    V* value, Loader&& loader) {
+    const V* cached = Get(key);
+    if (cached != nullptr) {
+        if (value) *value = *cached;
+        return true;
+    }
+    V loaded;
+    if (!detail::TimedLoad(loader, key, &loaded, &load_stats_))
+        return false;
+    if (value) *value = loaded;
+    Put(key, std::move(loaded));
+    return true;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Promote(const Q& key) {
+    Expire();
+    const auto& k = LookupKey(key);
+    Slot h = FindAccessed(k, table_.HashOf(k));
+
+    if (h != Table::Nil()) {
+        CountHit(h);
+        Touch(h);
+        return true;
+    }
+    return false;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    const V& value) {
+    detail::NoEviction none;
+    Put(key, value, none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    V&& value) {
+    detail::NoEviction none;
+    Put(key, std::move(value), none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(K&& key, V&& value) {
+    detail::NoEviction none;
+    PutImpl(table_.HashOf(key), std::move(key), std::move(value), none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    const V& value, F&& on_evict) {
+    const auto& k = LookupKey(key);
+    PutImpl(table_.HashOf(k), k, value, on_evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    V&& value, F&& on_evict) {
+    const auto& k = LookupKey(key);
+    PutImpl(table_.HashOf(k), k, std::move(value), on_evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename F, typename>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(K&& key, V&& value,
+    F&& on_evict) {
+    PutImpl(table_.HashOf(key), std::move(key), std::move(value), on_evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    size_t hash, const V& value) {
+    detail::NoEviction none;
+    PutImpl(hash, LookupKey(key), value, none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    size_t hash, V&& value) {
+    detail::NoEviction none;
+    PutImpl(hash, LookupKey(key), std::move(value), none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(K&& key, size_t hash,
+    V&& value) {
+    detail::NoEviction none;
+    PutImpl(hash, std::move(key), std::move(value), none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    size_t hash, const V& value, F&& on_evict) {
+    PutImpl(hash, LookupKey(key), value, on_evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    size_t hash, V&& value, F&& on_evict) {
+    PutImpl(hash, LookupKey(key), std::move(value), on_evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename... Args>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Emplace(const Q& key,
+    Args&&... args) {
+    detail::NoEviction none;
+    const auto& k = LookupKey(key);
+    PutImpl(table_.HashOf(k), k, V(std::forward<Args>(args)...), none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename Rep, typename Period>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    const V& value, std::chrono::duration<Rep, Period> ttl) {
+    Put(key, V(value), ttl);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename Rep, typename Period>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    V&& value, std::chrono::duration<Rep, Period> ttl) {
+    const auto& k = LookupKey(key);
+    Put(k, table_.HashOf(k), std::move(value), ttl);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename Rep, typename Period>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    size_t hash, V&& value, std::chrono::duration<Rep, Period> ttl) {
+    static_assert(kExpiry, "Put with a ttl needs a WheelExpiry policy");
+    detail::NoEviction none;
+    const auto& k = LookupKey(key);
+    PutImpl(hash, k, std::move(value), none);
+    SetTTL(k, hash, std::chrono::duration_cast<typename Expiry::Tick>(
+                        ttl).count());
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename KArg, typename VArg, typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::PutImpl(size_t hash,
+    KArg&& key, VArg&& value, Evict& evict) {
+    Expire();
+    if (c_ > target_c_) Shrink(kShrinkStep, evict);
+    if constexpr (kAdmission) sketch_.Increment(hash);
+    Slot h = table_.Find(key, hash);
+
+    if (h != Table::Nil()) {
+        switch (table_.At(h).q) {
+        case ARCQId::T1:
+        case ARCQId::T2:
+            Update(h, std::forward<VArg>(value), evict);
+            OnCacheHit();
+            return;
+        case ARCQId::B1:
+        case ARCQId::B2:
+            {
+                size_t w = ChargeOf(table_.At(h).key, value);
+                if (w > c_) break;
+                OnGhostHit(table_.At(h).q == ARCQId::B2, w, evict);
+                Revive(h, std::forward<VArg>(value), w);
+            }
+            return;
+        }
+        // the new value can never fit, forget the ghost
+        Erase(h);
         return;
     }
 
-    if (b2_.Find(key, &it2)) {
-        size_t delta = std::max((size_t)1, b1_.Count() / b2_.Count());
-        DecreaseP(delta);
+    if constexpr (std::is_same<std::decay_t<KArg>, K>::value) {
+        PutMiss(hash, std::forward<KArg>(key), std::forward<VArg>(value),
+                evict);
+    } else {
+        // only now a heterogeneous key needs to become a K
+        PutMiss(hash, K(key), std::forward<VArg>(value), evict);
+    }
+}
 
-        Replace(key, evict_cb);
-        b2_.Remove(std::move(it2), this);
-        t2_.Insert(key, value, this);
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename KArg, typename VArg, typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::PutMiss(size_t hash,
+    KArg&& key, VArg&& value, Evict& evict) {
+    size_t w = ChargeOf(key, value);
+    if constexpr (kFingerprintGhosts) {
+        typename GhostTable::Handle g = ghosts_.Find(hash);
+        if (g != GhostTable::Nil()) {
+            if (w <= c_) {
+                OnGhostHit(ghosts_.List(g) == 1, w, evict);
+                EraseGhost(g);
+                Insert(&t2_, hash, std::forward<KArg>(key),
+                       std::forward<VArg>(value), w);
+            } else {
+                // the new value can never fit, forget the ghost
+                EraseGhost(g);
+            }
+            return;
+        }
+    }
+    if (w > c_) return;
+    if (IsCacheFull(w) && !Admit(hash)) {
+        Count(&ARCStats::rejections);
         return;
     }
 
-    if (IsCacheFull() && t1_.Count() + b1_.Count() == c_) {
-        if (t1_.Count() < c_) {
-            b1_.RemoveLRU(this);
-            Replace(key, evict_cb);
-        } else {
-            t1_.RemoveLRU(evict_cb, this);
+    // With EntryCountCharge (w == 1) every loop below runs at most once and
+    // this is the textbook case IV of ARC.
+    if (IsCacheFull(w) && t1_.charge + b1_.charge + w > c_) {
+        if (b1_.Count() > 0) {
+            while (t1_.charge + b1_.charge + w > c_ && b1_.Count() > 0)
+                RemoveGhostLRU(&b1_);
+            Replace(false, w, evict);
         }
-    } else if (t1_.Count() + b1_.Count() < c_) {
-        auto total = t1_.Count() + b1_.Count() + t2_.Count() + b2_.Count();
-        if (total >= c_) {
-            if (total == 2 * c_) {
+        while (t1_.charge + b1_.charge + w > c_ && t1_.Count() > 0)
+            RemoveLRU(&t1_, evict);
+        Replace(false, w, evict);
+    } else if (t1_.charge + b1_.charge + w <= c_) {
+        auto total = t1_.charge + b1_.charge + t2_.charge + b2_.charge;
+        if (total + w > c_) {
+            while (total + w > 2 * c_ && b1_.Count() + b2_.Count() > 0) {
                 if (b2_.Count() > 0) {
-                    b2_.RemoveLRU(this);
+                    RemoveGhostLRU(&b2_);
                 } else {
-                    b1_.RemoveLRU(this);
+                    RemoveGhostLRU(&b1_);
                 }
+                total = t1_.charge + b1_.charge + t2_.charge + b2_.charge;
             }
-            Replace(key, evict_cb);
+            Replace(false, w, evict);
         }
     }
-    t1_.Insert(key, value, this);
+    Insert(&t1_, hash, std::forward<KArg>(key), std::forward<VArg>(value),
+           w);
+    // with ByteCharge, or after SetCapacity(), the sketch follows the size
+    if constexpr (kAdmission)
+        sketch_.EnsureCapacity(t1_.Count() + t2_.Count());
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::Replace(const K& k,
-        const EvictionCB& evict_cb) {
-    if (!IsCacheFull()) {
-        return;
-    }
-    if (t1_.Count() != 0 &&
-        ((t1_.Count() > p_) || (b2_.Find(k, nullptr) && t1_.Count() == p_))) {
-        Move_T_B(&t1_, &b1_, evict_cb);
-    } else if (t2_.Count() > 0) {
-        Move_T_B(&t2_, &b2_, evict_cb);
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::OnGhostHit(bool b2_hit,
+    size_t charge, Evict& evict) {
+    Count(b2_hit ? &ARCStats::b2_ghost_hits : &ARCStats::b1_ghost_hits);
+    if (b2_hit) {
+        size_t delta = charge * std::max((size_t)1, b1_.charge / b2_.charge);
+        DecreaseP(delta, charge);
     } else {
-        Move_T_B(&t1_, &b1_, evict_cb);
+        size_t delta = charge * std::min((size_t)1, b2_.charge / b1_.charge);
+        IncreaseP(delta, charge);
     }
+    Replace(b2_hit, charge, evict);
 }
 
-// This operation detach the key from cache
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::Remove(const K& key) {
-    T* ts[] {&t1_, &t2_};
-    for (auto t : ts) {
-        TMapIter it;
-        if (t->Find(key, &it)) {
-            t->Remove(std::move(it), this);
-            return;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Replace(bool b2_hit,
+        size_t charge, Evict& evict) {
+    // make room for charge more units
+    while (IsCacheFull(charge) && t1_.Count() + t2_.Count() > 0) {
+        if (t1_.Count() != 0 &&
+            ((t1_.charge > p_) || (b2_hit && t1_.charge >= p_))) {
+            Move_T_B(&t1_, &b1_, evict);
+        } else if (t2_.Count() > 0) {
+            Move_T_B(&t2_, &b2_, evict);
+        } else {
+            Move_T_B(&t1_, &b1_, evict);
         }
     }
-    B* bs[] {&b1_, &b2_};
-    for (auto b : bs) {
-        BMapIter it;
-        if (b->Find(key, &it)) {
-            b->Remove(std::move(it), this);
-            return;
-        }
+}
+
+// This operation detach the key from cache
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Remove(const Q& key) {
+    const auto& k = LookupKey(key);
+    Remove(k, table_.HashOf(k));
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Remove(const Q& key,
+    size_t hash) {
+    Slot h = table_.Find(LookupKey(key), hash);
+    if (h != Table::Nil()) {
+        if (IsResident(table_.At(h).q)) Count(&ARCStats::removes);
+        Erase(h);
+    } else if constexpr (kFingerprintGhosts) {
+        typename GhostTable::Handle g = ghosts_.Find(hash);
+        if (g != GhostTable::Nil()) EraseGhost(g);
     }
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-bool ARC<K, V, KeyTraits, ValueTraits>::Move_T_B(T* t, B* b,
-    const EvictionCB &evict_cb) {
-    // move t's LRU item to b as MRU item
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Expire() {
+    if constexpr (kExpiry) {
+        wheel_.Advance(NowTick(), [this](Slot h) {
+            // no ghost, an expired key coming back is not a sign that T1
+            // or T2 is too small
+            table_.At(h).timer = Wheel::Nil();
+            Count(&ARCStats::expirations);
+            Erase(h);
+        });
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Move_T_B(Queue* t, Queue* b,
+    Evict& evict) {
+    // move t's LRU item to b as MRU item, only the key (or its
+    // fingerprint) is kept
     if (t->Count() == 0) return false;
 
-    auto map_iter = t->GetLRU();
-    UpdateRemoveFromCacheBytes(
-        ValueTraits::CountBytes(map_iter->second.list_iter->value));
-    if (evict_cb) {
-        evict_cb(map_iter->first, std::move(map_iter->second.list_iter->value));
+    Slot h = t->head;
+    Entry& e = table_.At(h);
+    Count(t == &t1_ ? &ARCStats::t1_evictions : &ARCStats::t2_evictions);
+    UpdateRemoveFromCacheBytes(ValueTraits::CountBytes(e.value));
+    Evicted(e, evict);
+    if constexpr (kFingerprintGhosts) {
+        UpdateRemoveFromCacheBytes(KeyTraits::CountBytes(e.key));
+        PushGhost(b, table_.HashAt(h), e.charge);
+        Unlink(h);
+        Discard(h);
+    } else {
+        if (e.Pinned()) {
+            // the ghost gets a fresh entry
+            h = Detach(h);
+        } else {
+            e.value = V();
+        }
+        CancelTimer(h);
+        Unlink(h);
+        Link(b, h);
     }
-    b->Insert(map_iter->first);
-    t->Remove(std::move(map_iter), nullptr);
     return true;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::Clear() {
-    b1_.clear();
-    t1_.clear();
-    b2_.clear();
-    t2_.clear();
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Clear() {
+    if (handles_ != 0) {
+        for (auto q : {&t1_, &t2_}) {
+            for (Slot h = q->head; h != Table::Nil();) {
+                Slot next = table_.Next(h);
+                if (table_.At(h).Pinned()) Discard(h);
+                h = next;
+            }
+        }
+    }
+    table_.Clear();
+    if constexpr (kFingerprintGhosts) ghosts_.Clear();
+    if constexpr (kExpiry) wheel_.Clear();
+    sketch_.Clear();
+    for (auto q : {&b1_, &t1_, &b2_, &t2_}) {
+        q->head = q->tail = Table::Nil();
+        q->count = 0;
+        q->charge = 0;
+    }
 
     p_ = 0;
+    c_ = target_c_;
     cached_bytes_ = 0;
     cache_hit_ = 0;
     cache_miss_ = 0;
+    load_stats_ = LoadStats();
+    stats_ = ARCStats();
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-size_t ARC<K, V, KeyTraits, ValueTraits>::Size() const {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::Size() const {
     return t1_.Count() + t2_.Count();
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-size_t ARC<K, V, KeyTraits, ValueTraits>::Capacity() const {
-    return c_;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::Capacity() const {
+    return target_c_;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-ARCSizeInfo ARC<K, V, KeyTraits, ValueTraits>::ARCSize() const {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::SetCapacity(
+    size_t new_capacity) {
+    new_capacity = std::min(new_capacity, kMaxCapacity);
+    target_c_ = new_capacity;
+    if (new_capacity < c_) return;
+    p_ = c_ == 0 ? 0 : static_cast<size_t>(
+        static_cast<double>(p_) * new_capacity / c_);
+    c_ = new_capacity;
+    if (Policy::Storage::kPreallocate && Policy::Charge::kUnit)
+        table_.Reserve(kFingerprintGhosts ? c_ + 1 : 2 * c_ + 1);
+    if constexpr (kFingerprintGhosts) {
+        if (Policy::Charge::kUnit) ghosts_.Reserve(c_ + 1);
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Trim(size_t budget) {
+    detail::NoEviction none;
+    return Trim(budget, none);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename F, typename>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::Trim(size_t budget,
+    F&& on_evict) {
+    if (c_ > target_c_) Shrink(budget, on_evict);
+    return c_ == target_c_;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Shrink(size_t budget,
+    Evict& evict) {
+    // budget entries are worth budget units, or budget entries of average
+    // charge
+    size_t unit = 1;
+    if (!Policy::Charge::kUnit && Size() != 0)
+        unit = std::max<size_t>(1, TotalCharge() / Size());
+    size_t excess = c_ - target_c_;
+    size_t step = budget >= excess / unit ? excess : budget * unit;
+    size_t c = c_ - step;
+    p_ = static_cast<size_t>(static_cast<double>(p_) * c / c_);
+    c_ = c;
+    FitCapacity(evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Evict>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::FitCapacity(Evict& evict) {
+    // same as a Put would do: evict T1/T2 into B1/B2, then bound the ghosts
+    // by c_ for T1 + B1 and 2 * c_ in total
+    Replace(false, 0, evict);
+    while (t1_.charge + b1_.charge > c_ && b1_.Count() > 0)
+        RemoveGhostLRU(&b1_);
+    while (t1_.charge + t2_.charge + b1_.charge + b2_.charge > 2 * c_ &&
+           b1_.Count() + b2_.Count() > 0)
+        RemoveGhostLRU(b2_.Count() > 0 ? &b2_ : &b1_);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::TotalCharge() const {
+    return t1_.charge + t2_.charge;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::P() const {
+    return p_;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+ARCSizeInfo ARC<K, V, KeyTraits, ValueTraits, Policy>::ARCSize() const {
     return {b1_.Count(), t1_.Count(), b2_.Count(), t2_.Count()};
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-size_t ARC<K, V, KeyTraits, ValueTraits>::CachedByteCount() const {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ARC<K, V, KeyTraits, ValueTraits, Policy>::CachedByteCount() const {
     return cached_bytes_;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-uint64_t ARC<K, V, KeyTraits, ValueTraits>::HitCount() const {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+uint64_t ARC<K, V, KeyTraits, ValueTraits, Policy>::HitCount() const {
     return cache_hit_;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-uint64_t ARC<K, V, KeyTraits, ValueTraits>::MissCount() const {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+uint64_t ARC<K, V, KeyTraits, ValueTraits, Policy>::MissCount() const {
     return cache_miss_;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::UpdateRemoveFromCacheBytes(
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+LoadStats ARC<K, V, KeyTraits, ValueTraits, Policy>::GetLoadStats() const {
+    return load_stats_;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+ARCStats ARC<K, V, KeyTraits, ValueTraits, Policy>::GetStats() const {
+    ARCStats stats = stats_;
+    stats.hits = cache_hit_;
+    stats.misses = cache_miss_;
+    stats.p = p_;
+    if constexpr (!Policy::kStats) stats.min_p = stats.max_p = p_;
+    return stats;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+uint32_t ARC<K, V, KeyTraits, ValueTraits, Policy>::SnapshotFlags() {
+    return (kFingerprintGhosts ? detail::kSnapshotFingerprints : 0) |
+           (kExpiry ? detail::kSnapshotDeadlines : 0) |
+           (Policy::Charge::kUnit ? 0 : detail::kSnapshotByteCharge);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+int64_t ARC<K, V, KeyTraits, ValueTraits, Policy>::WallClockNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::SaveSnapshot(
+    const std::string& path) const {
+    typedef SnapshotTraits<K> KeySnapshot;
+    typedef SnapshotTraits<V> ValueSnapshot;
+    detail::SnapshotWriter out;
+    if (!out.Open(path)) return false;
+
+    detail::SnapshotHeader header = {};
+    memcpy(header.magic, detail::kSnapshotMagic, sizeof(header.magic));
+    header.version = detail::kSnapshotVersion;
+    header.flags = SnapshotFlags();
+    header.capacity = c_;
+    header.p = p_;
+    header.count[0] = t1_.Count();
+    header.count[1] = t2_.Count();
+    header.count[2] = b1_.Count();
+    header.count[3] = b2_.Count();
+    std::string* buf = out.Buffer();
+    buf->append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t now = 0;
+    int64_t wall_now = 0;
+    if constexpr (kExpiry) {
+        // timers due by now are only pending Expire(), save them as such
+        now = std::max(wheel_.Now(), NowTick());
+        wall_now = WallClockNanos();
+    }
+
+    for (const Queue* q : {&t1_, &t2_}) {
+        for (Slot h = q->head; h != Table::Nil(); h = table_.Next(h)) {
+            const Entry& e = table_.At(h);
+            KeySnapshot::Save(e.key, buf);
+            ValueSnapshot::Save(e.value, buf);
+            if constexpr (kExpiry) {
+                // the deadline in wall clock time, the clock of the policy
+                // may not survive a restart
+                int64_t deadline = 0;
+                if (e.timer != Wheel::Nil()) {
+                    int64_t ttl = std::max<int64_t>(0, static_cast<int64_t>(
+                        wheel_.Deadline(e.timer) - now));
+                    deadline = wall_now + std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(
+                            typename Expiry::Tick(ttl)).count();
+                }
+                buf->append(reinterpret_cast<const char*>(&deadline),
+                            sizeof(deadline));
+            }
+            if (!out.Flush()) return false;
+        }
+    }
+    if constexpr (kFingerprintGhosts) {
+        for (int list = 0; list < 2; list++) {
+            for (typename GhostTable::Handle g = ghosts_.Head(list);
+                 g != GhostTable::Nil(); g = ghosts_.Next(g)) {
+                uint32_t charge = ghosts_.Charge(g);
+                uint64_t fp = ghosts_.Fingerprint(g);
+                buf->append(reinterpret_cast<const char*>(&charge),
+                            sizeof(charge));
+                buf->append(reinterpret_cast<const char*>(&fp), sizeof(fp));
+                if (!out.Flush()) return false;
+            }
+        }
+    } else {
+        for (const Queue* q : {&b1_, &b2_}) {
+            for (Slot h = q->head; h != Table::Nil(); h = table_.Next(h)) {
+                const Entry& e = table_.At(h);
+                buf->append(reinterpret_cast<const char*>(&e.charge),
+                            sizeof(e.charge));
+                KeySnapshot::Save(e.key, buf);
+                if (!out.Flush()) return false;
+            }
+        }
+    }
+    return out.Close();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::LoadSnapshot(
+    const std::string& path) {
+    Clear();
+    detail::MappedFile file;
+    if (!file.Open(path)) return false;
+    detail::SnapshotHeader header;
+    if (file.Size() < sizeof(header)) return false;
+    memcpy(&header, file.Data(), sizeof(header));
+    if (memcmp(header.magic, detail::kSnapshotMagic,
+               sizeof(header.magic)) != 0 ||
+        header.version != detail::kSnapshotVersion ||
+        header.flags != SnapshotFlags())
+        return false;
+    if (!LoadEntries(header, file.Data() + sizeof(header),
+                     file.Data() + file.Size())) {
+        Clear();
+        return false;
+    }
+
+    // p is kept as the same share of the capacity
+    if (header.capacity != 0 && header.capacity != c_) {
+        p_ = static_cast<size_t>(static_cast<double>(header.p) /
+                                 header.capacity * c_);
+    } else {
+        p_ = header.p;
+    }
+    p_ = std::min(p_, c_);
+    if (header.capacity > c_) {
+        detail::NoEviction none;
+        FitCapacity(none);
+    }
+    // restoring is not cache activity
+    stats_ = ARCStats();
+    stats_.min_p = stats_.max_p = p_;
+    return true;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::LoadEntries(
+    const detail::SnapshotHeader& header, const char* p, const char* end) {
+    typedef SnapshotTraits<K> KeySnapshot;
+    typedef SnapshotTraits<V> ValueSnapshot;
+    // every entry takes at least one byte, this bounds Reserve() on a
+    // corrupt header
+    size_t left = static_cast<size_t>(end - p);
+    uint64_t resident = header.count[0] + header.count[1];
+    uint64_t ghosts = header.count[2] + header.count[3];
+    if (header.count[0] > left || header.count[1] > left ||
+        header.count[2] > left || header.count[3] > left ||
+        resident + ghosts > left)
+        return false;
+    if ((kFingerprintGhosts ? resident : resident + ghosts) >
+        Policy::Storage::kMaxEntries)
+        return false;
+    table_.Reserve(kFingerprintGhosts ? resident : resident + ghosts);
+    if constexpr (kFingerprintGhosts) ghosts_.Reserve(ghosts);
+
+    uint64_t now = 0;
+    int64_t wall_now = 0;
+    if constexpr (kExpiry) {
+        Expire();
+        now = wheel_.Now();
+        wall_now = WallClockNanos();
+    }
+    for (int i = 0; i < 2; i++) {
+        Queue* q = i == 0 ? &t1_ : &t2_;
+        for (uint64_t n = header.count[i]; n != 0; n--) {
+            K key;
+            V value;
+            if (!KeySnapshot::Load(&p, end, &key) ||
+                !ValueSnapshot::Load(&p, end, &value))
+                return false;
+            int64_t ttl = -1;
+            if constexpr (kExpiry) {
+                int64_t deadline;
+                if (static_cast<size_t>(end - p) < sizeof(deadline))
+                    return false;
+                memcpy(&deadline, p, sizeof(deadline));
+                p += sizeof(deadline);
+                if (deadline != 0) {
+                    ttl = std::chrono::duration_cast<typename Expiry::Tick>(
+                        std::chrono::nanoseconds(deadline - wall_now))
+                        .count();
+                    // expired while the cache was down
+                    if (ttl <= 0) continue;
+                }
+            }
+            size_t hash = table_.HashOf(key);
+            if (table_.Find(key, hash) != Table::Nil()) return false;
+            size_t w = ChargeOf(key, value);
+            Insert(q, hash, std::move(key), std::move(value), w);
+            if constexpr (kExpiry) {
+                if (ttl > 0) {
+                    Slot h = q->tail;
+                    table_.At(h).timer = wheel_.Add(h, now + ttl);
+                }
+            }
+        }
+    }
+    for (int i = 2; i < 4; i++) {
+        Queue* b = i == 2 ? &b1_ : &b2_;
+        for (uint64_t n = header.count[i]; n != 0; n--) {
+            uint32_t charge;
+            if (static_cast<size_t>(end - p) < sizeof(charge)) return false;
+            memcpy(&charge, p, sizeof(charge));
+            p += sizeof(charge);
+            // a zero charge would divide by zero on a ghost hit
+            if (charge == 0 || (Policy::Charge::kUnit && charge != 1))
+                return false;
+            // a ghost of a larger cache may not fit this one, like a Put
+            // of an entry above Capacity() it is dropped
+            bool fits = charge <= c_;
+            if constexpr (kFingerprintGhosts) {
+                uint64_t fp;
+                if (static_cast<size_t>(end - p) < sizeof(fp)) return false;
+                memcpy(&fp, p, sizeof(fp));
+                p += sizeof(fp);
+                if (ghosts_.Find(fp) != GhostTable::Nil()) return false;
+                if (fits) PushGhost(b, fp, charge);
+            } else {
+                K key;
+                if (!KeySnapshot::Load(&p, end, &key)) return false;
+                if (!fits) continue;
+                size_t hash = table_.HashOf(key);
+                if (table_.Find(key, hash) != Table::Nil()) return false;
+                UpdateAddToCacheBytes(KeyTraits::CountBytes(key));
+                Link(b, table_.Insert(hash, std::move(key), V(), b->id,
+                                      charge));
+            }
+        }
+    }
+    return p == end;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::UpdateRemoveFromCacheBytes(
     size_t bytes) {
     cached_bytes_ -= bytes;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::UpdateAddToCacheBytes(
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::UpdateAddToCacheBytes(
     size_t bytes) {
     cached_bytes_ += bytes;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::OnCacheHit() {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::OnCacheHit() {
     cache_hit_++;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-void ARC<K, V, KeyTraits, ValueTraits>::OnCacheMiss() {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::OnCacheMiss() {
     cache_miss_++;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-std::vector<K> ARC<K, V, KeyTraits, ValueTraits>::GetKeysOfQ(ARCQId q) const {
-    std::vector<K> v;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::Count(
+    uint64_t ARCStats::*counter) {
+    if constexpr (Policy::kStats) ++(stats_.*counter);
+}
 
-    switch (q) {
-    case ARCQId::B1:
-        {
-            for (auto &item : b1_.list_)
-                v.push_back(item.map_iter->first);
-        }
-        break;
-    case ARCQId::B2:
-        {
-            for (auto &item : b2_.list_)
-                v.push_back(item.map_iter->first);
-        }
-        break;
-    case ARCQId::T1:
-        {
-            for (auto &item : t1_.list_)
-                v.push_back(item.map_iter->first);
-        }
-        break;
-    case ARCQId::T2:
-        {
-            for (auto &item : t2_.list_)
-                v.push_back(item.map_iter->first);
-        }
-        break;
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::CountHit(Slot h) {
+    if constexpr (Policy::kStats) {
+        if (table_.At(h).q == ARCQId::T1)
+            stats_.t1_hits++;
+        else
+            stats_.t2_hits++;
     }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+std::vector<K> ARC<K, V, KeyTraits, ValueTraits, Policy>::GetKeysOfQ(
+    ARCQId q) const {
+    std::vector<K> v;
+    const Queue* queue = QueueOf(q);
+
+    v.reserve(queue->Count());
+    for (Slot h = queue->head; h != Table::Nil(); h = table_.Next(h))
+        v.push_back(table_.At(h).key);
     return v;
 }
 
-template <typename K, typename V, typename KeyTraits, typename ValueTraits>
-std::vector<V> ARC<K, V, KeyTraits, ValueTraits>::GetValuesOfQ(ARCQId q) const {
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+std::vector<V> ARC<K, V, KeyTraits, ValueTraits, Policy>::GetValuesOfQ(
+    ARCQId q) const {
     std::vector<V> v;
 
-    switch (q) {
-    case ARCQId::B1:
-        break;
-    case ARCQId::B2:
-        break;
-    case ARCQId::T1:
-        {
-            for (auto &item : t1_.list_)
-                v.push_back(item.value);
+    if (!IsResident(q))
+        return v;
+    const Queue* queue = QueueOf(q);
+    v.reserve(queue->Count());
+    for (Slot h = queue->head; h != Table::Nil(); h = table_.Next(h))
+        v.push_back(table_.At(h).value);
+    return v;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename F>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::Slot
+ARC<K, V, KeyTraits, ValueTraits, Policy>::Walk(Slot h, size_t* budget,
+                                                F& f) const {
+    for (; h != Table::Nil() && *budget != 0; h = table_.Next(h)) {
+        --*budget;
+        if (Expired(h)) continue;
+        const Entry& e = table_.At(h);
+        if constexpr (std::is_same<std::invoke_result_t<F&, const K&,
+                                                        const V&>,
+                                   bool>::value) {
+            if (!f(e.key, e.value)) return Table::Nil();
+        } else {
+            f(e.key, e.value);
         }
-        break;
-    case ARCQId::T2:
-        {
-            for (auto &item : t2_.list_)
-                v.push_back(item.value);
+    }
+    return h;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename F>
+void ARC<K, V, KeyTraits, ValueTraits, Policy>::ForEachInQ(ARCQId q,
+                                                           F&& f) const {
+    size_t budget = SIZE_MAX;
+    Walk(QueueOf(q)->head, &budget, f);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename F>
+bool ARC<K, V, KeyTraits, ValueTraits, Policy>::ForEachInQFrom(
+    ARCQId q, QueueCursor* cursor, size_t* budget, F&& f) const {
+    const Queue* queue = QueueOf(q);
+    Slot h = queue->head;
+    if (cursor->resume) {
+        h = table_.Find(cursor->key, table_.HashOf(cursor->key));
+        if (h == Table::Nil() || table_.At(h).q != q ||
+            table_.At(h).stamp != cursor->stamp) {
+            // the stamps increase from the LRU to the MRU end, back up
+            // from the MRU end to the first entry not before the cursor
+            h = Table::Nil();
+            for (Slot at = queue->tail;
+                 at != Table::Nil() &&
+                 !StampBefore(table_.At(at).stamp, cursor->stamp);
+                 at = table_.Prev(at))
+                h = at;
         }
-        break;
     }
-    return v;
+    h = Walk(h, budget, f);
+    cursor->resume = h != Table::Nil();
+    if (!cursor->resume) return false;
+    cursor->key = table_.At(h).key;
+    cursor->stamp = table_.At(h).stamp;
+    return true;
+}
+
+// Forward iterator over a queue, see ARC::EntriesOfQ().
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+class ARC<K, V, KeyTraits, ValueTraits, Policy>::QueueIterator {
+ public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef QueueItem value_type;
+    typedef QueueItem reference;
+    typedef ptrdiff_t difference_type;
+    typedef void pointer;
+
+    QueueIterator() : cache_(nullptr), h_(Table::Nil()) {}
+
+    QueueItem operator*() const {
+        const Entry& e = cache_->table_.At(h_);
+        return QueueItem{e.key, e.value};
+    }
+    QueueIterator& operator++() {
+        h_ = cache_->table_.Next(h_);
+        SkipExpired();
+        return *this;
+    }
+    QueueIterator operator++(int) {
+        QueueIterator it = *this;
+        ++*this;
+        return it;
+    }
+    bool operator==(const QueueIterator& o) const { return h_ == o.h_; }
+    bool operator!=(const QueueIterator& o) const { return h_ != o.h_; }
+
+ private:
+    friend class ARC;
+
+    QueueIterator(const ARC* cache, Slot h) : cache_(cache), h_(h) {
+        SkipExpired();
+    }
+    void SkipExpired() {
+        while (h_ != Table::Nil() && cache_->Expired(h_))
+            h_ = cache_->table_.Next(h_);
+    }
+
+    const ARC* cache_;
+    Slot h_;
+};
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+class ARC<K, V, KeyTraits, ValueTraits, Policy>::QueueRange {
+ public:
+    QueueIterator begin() const { return begin_; }
+    QueueIterator end() const { return QueueIterator(); }
+
+ private:
+    friend class ARC;
+
+    explicit QueueRange(QueueIterator begin) : begin_(begin) {}
+
+    QueueIterator begin_;
+};
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+typename ARC<K, V, KeyTraits, ValueTraits, Policy>::QueueRange
+ARC<K, V, KeyTraits, ValueTraits, Policy>::EntriesOfQ(ARCQId q) const {
+    return QueueRange(QueueIterator(this, QueueOf(q)->head));
 }
 
 }  // namespace fengge
@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_ARC_ADMISSION_H_
+#define SRC_INCLUDE_FENGGE_ARC_ADMISSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace fengge {
+namespace detail {
+
+// TinyLFU frequency estimate (Einziger, Friedman and Manes): a count-min
+// sketch of 4-bit counters behind a doorkeeper Bloom filter. The first
+// access of a key only sets its doorkeeper bits, later ones increment its
+// counters, so one-hit wonders never reach the sketch. After 10 accesses
+// per key of capacity every counter is halved and the doorkeeper is
+// cleared, old popularity fades away. Sized for n keys it takes 9 bytes
+// per key.
+//
+// A 64-bit word holds 16 counters in 4 groups, one per row of the sketch;
+// a key reads one counter of each row, in up to 4 words picked by
+// rehashing its hash.
+class FrequencySketch {
+ public:
+    FrequencySketch() : mask_(0), door_mask_(0), sample_(0), accesses_(0) {}
+
+    // Size the sketch for n keys if it is smaller. Resizing forgets all
+    // counts, it happens O(log n) times as a cache fills up.
+    void EnsureCapacity(size_t n) {
+        n = std::max<size_t>(n, 16);
+        if (table_.size() >= n) return;
+        // a word per key, 4 counters per key and row
+        size_t words = 16;
+        while (words < n) words *= 2;
+        table_.assign(words, 0);
+        mask_ = words - 1;
+        // 8 doorkeeper bits per key
+        door_.assign(words / 8, 0);
+        door_mask_ = words * 8 - 1;
+        sample_ = 10 * words;
+        accesses_ = 0;
+    }
+    void Increment(uint64_t hash) {
+        if (table_.empty()) EnsureCapacity(0);
+        if (!Admitted(hash)) {
+            SetDoor(hash);
+        } else {
+            for (int row = 0; row < 4; ++row) {
+                uint64_t& word = table_[Index(hash, row)];
+                int shift = Shift(hash, row);
+                if (((word >> shift) & 0xf) != 0xf)
+                    word += uint64_t(1) << shift;
+            }
+        }
+        if (++accesses_ >= sample_) Age();
+    }
+    // estimated number of recent accesses, saturates at 16
+    int Frequency(uint64_t hash) const {
+        if (table_.empty()) return 0;
+        int f = 15;
+        for (int row = 0; row < 4; ++row) {
+            uint64_t word = table_[Index(hash, row)];
+            f = std::min(f, static_cast<int>((word >> Shift(hash, row)) &
+                                             0xf));
+        }
+        return f + (Admitted(hash) ? 1 : 0);
+    }
+    void Clear() {
+        std::fill(table_.begin(), table_.end(), 0);
+        std::fill(door_.begin(), door_.end(), 0);
+        accesses_ = 0;
+    }
+
+ private:
+    // the high bits of a product depend on all bits of the hash
+    static uint64_t Rehash(uint64_t h, int row) {
+        static const uint64_t kSeeds[4] = {
+            0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+            0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+        return (h ^ (h >> 29)) * kSeeds[row];
+    }
+    size_t Index(uint64_t hash, int row) const {
+        return (Rehash(hash, row) >> 32) & mask_;
+    }
+    // counter of row in its group, 4 bits each
+    static int Shift(uint64_t hash, int row) {
+        return (row * 4 + static_cast<int>((Rehash(hash, row) >> 30) & 3)) *
+               4;
+    }
+    // two doorkeeper bits per key
+    bool Admitted(uint64_t hash) const {
+        uint64_t a = hash & door_mask_;
+        uint64_t b = (hash >> 32) & door_mask_;
+        return ((door_[a / 64] >> (a % 64)) & 1) &&
+               ((door_[b / 64] >> (b % 64)) & 1);
+    }
+    void SetDoor(uint64_t hash) {
+        uint64_t a = hash & door_mask_;
+        uint64_t b = (hash >> 32) & door_mask_;
+        door_[a / 64] |= uint64_t(1) << (a % 64);
+        door_[b / 64] |= uint64_t(1) << (b % 64);
+    }
+    void Age() {
+        for (uint64_t& word : table_)
+            word = (word >> 1) & 0x7777777777777777ULL;
+        std::fill(door_.begin(), door_.end(), 0);
+        accesses_ = 0;
+    }
+
+    std::vector<uint64_t> table_;
+    std::vector<uint64_t> door_;
+    size_t mask_;
+    uint64_t door_mask_;
+    size_t sample_;
+    size_t accesses_;
+};
+
+// stands in for the sketch without admission control
+struct NoFrequencySketch {
+    void EnsureCapacity(size_t) {}
+    void Clear() {}
+};
+
+}  // namespace detail
+
+// Admission of new keys into a full ARC, selected through the Admission
+// member of the policy. Keys found in B1/B2 are always admitted, ghost
+// hits drive the adaptation of p.
+
+// Every new key is admitted.
+struct NoAdmission {
+    static constexpr bool kEnabled = false;
+};
+
+// A new key is only admitted into a full cache if the TinyLFU sketch
+// estimates it more frequently accessed than the entry it would evict,
+// the LRU entry of T1 (of T2 if T1 is empty). Lookups and Puts feed the
+// sketch. A rejected Put changes nothing but ARCStats::rejections, so a
+// large one-time scan neither evicts anything nor allocates.
+struct TinyLFUAdmission {
+    static constexpr bool kEnabled = true;
+};
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_ARC_ADMISSION_H_
@@ -0,0 +1,266 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_ARC_EXPIRY_H_
+#define SRC_INCLUDE_FENGGE_ARC_EXPIRY_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+#include <vector>
+
+namespace fengge {
+namespace detail {
+
+// Hierarchical timer wheel (Varghese & Lauck) over integer ticks. Level L
+// has 64 buckets of 64^L ticks each; a timer sits in the lowest level whose
+// current rotation contains its deadline and moves one level down every
+// time its bucket comes up, so it is touched at most once per level before
+// it fires. Deadlines beyond the six levels (2^36 ticks) wait in an
+// overflow bucket. Advance() skips the ticks at which no bucket is due,
+// an idle wheel catches up in constant time.
+//
+// Timers live in a slot array linked into their bucket by 32-bit index,
+// Cancel() is O(1).
+template <typename Item>
+class TimerWheel {
+ public:
+    typedef uint32_t Handle;
+
+    TimerWheel() : now_(0), free_(Nil()), size_(0) {
+        heads_.fill(Nil());
+        counts_.fill(0);
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    void operator=(const TimerWheel&) = delete;
+
+    static Handle Nil() { return UINT32_MAX; }
+
+    // tick the wheel has advanced to
+    uint64_t Now() const { return now_; }
+    size_t Size() const { return size_; }
+    uint64_t Deadline(Handle t) const { return timers_[t].deadline; }
+    void SetItem(Handle t, Item item) { timers_[t].item = item; }
+
+    // Fire item at deadline, at the next tick if deadline <= Now().
+    Handle Add(Item item, uint64_t deadline);
+    void Cancel(Handle t);
+    void Clear();
+    // Move to tick now and call expire(item) for every timer whose deadline
+    // is <= now. The timer is gone when expire runs, expire may add and
+    // cancel other timers.
+    template <typename F>
+    void Advance(uint64_t now, F&& expire);
+
+ private:
+    static constexpr int kBits = 6;
+    static constexpr uint32_t kSlots = 1u << kBits;
+    static constexpr int kLevels = 6;
+    static constexpr uint32_t kOverflow = kLevels * kSlots;
+
+    struct Timer {
+        Item item;
+        uint64_t deadline;
+        Handle prev;
+        Handle next;  // next free timer once fired or canceled
+        uint32_t bucket;
+    };
+
+    static int LevelOf(uint32_t bucket) { return bucket / kSlots; }
+    uint32_t BucketOf(uint64_t deadline) const;
+    void Link(Handle t);
+    void Unlink(Handle t);
+    void Free(Handle t);
+    // relink the timers of bucket relative to now_
+    void Cascade(uint32_t bucket);
+
+    uint64_t now_;
+    std::vector<Timer> timers_;
+    Handle free_;
+    size_t size_;
+    std::array<Handle, kOverflow + 1> heads_;
+    std::array<size_t, kLevels + 1> counts_;  // timers per level
+};
+
+template <typename Item>
+uint32_t TimerWheel<Item>::BucketOf(uint64_t deadline) const {
+    for (int level = 0; level < kLevels; ++level) {
+        int shift = kBits * (level + 1);
+        if ((deadline >> shift) == (now_ >> shift)) {
+            return level * kSlots +
+                   ((deadline >> (kBits * level)) & (kSlots - 1));
+        }
+    }
+    return kOverflow;
+}
+
+template <typename Item>
+void TimerWheel<Item>::Link(Handle t) {
+    Timer& timer = timers_[t];
+    timer.bucket = BucketOf(timer.deadline);
+    timer.prev = Nil();
+    timer.next = heads_[timer.bucket];
+    if (timer.next != Nil()) timers_[timer.next].prev = t;
+    heads_[timer.bucket] = t;
+    counts_[LevelOf(timer.bucket)]++;
+}
+
+template <typename Item>
+void TimerWheel<Item>::Unlink(Handle t) {
+    Timer& timer = timers_[t];
+    if (timer.prev != Nil())
+        timers_[timer.prev].next = timer.next;
+    else
+        heads_[timer.bucket] = timer.next;
+    if (timer.next != Nil()) timers_[timer.next].prev = timer.prev;
+    counts_[LevelOf(timer.bucket)]--;
+}
+
+template <typename Item>
+void TimerWheel<Item>::Free(Handle t) {
+    timers_[t].next = free_;
+    free_ = t;
+    size_--;
+}
+
+template <typename Item>
+typename TimerWheel<Item>::Handle TimerWheel<Item>::Add(Item item,
+    uint64_t deadline) {
+    Handle t;
+    if (free_ != Nil()) {
+        t = free_;
+        free_ = timers_[t].next;
+    } else {
+        assert(timers_.size() < Nil());
+        t = static_cast<Handle>(timers_.size());
+        timers_.emplace_back();
+    }
+    timers_[t].item = item;
+    timers_[t].deadline = deadline > now_ ? deadline : now_ + 1;
+    Link(t);
+    size_++;
+    return t;
+}
+
+template <typename Item>
+void TimerWheel<Item>::Cancel(Handle t) {
+    Unlink(t);
+    Free(t);
+}
+
+template <typename Item>
+void TimerWheel<Item>::Clear() {
+    timers_.clear();
+    free_ = Nil();
+    size_ = 0;
+    heads_.fill(Nil());
+    counts_.fill(0);
+}
+
+template <typename Item>
+void TimerWheel<Item>::Cascade(uint32_t bucket) {
+    Handle t = heads_[bucket];
+    heads_[bucket] = Nil();
+    while (t != Nil()) {
+        Handle next = timers_[t].next;
+        counts_[LevelOf(bucket)]--;
+        Link(t);
+        t = next;
+    }
+}
+
+template <typename Item>
+template <typename F>
+void TimerWheel<Item>::Advance(uint64_t now, F&& expire) {
+    while (now_ < now) {
+        if (size_ == 0) {
+            now_ = now;
+            return;
+        }
+        // Below the lowest non-empty level nothing is due before that
+        // level's next bucket boundary, jump there.
+        int level = 0;
+        while (level < kLevels && counts_[level] == 0) level++;
+        uint64_t next = now_ + 1;
+        if (level > 0) {
+            uint64_t span = uint64_t(1) << (kBits * level);
+            next = (now_ | (span - 1)) + 1;
+            if (next > now) {
+                now_ = now;
+                return;
+            }
+        }
+        now_ = next;
+
+        // The buckets starting at now_ move down, the overflow bucket once
+        // per turn of the top level.
+        if ((now_ & ((uint64_t(1) << (kBits * kLevels)) - 1)) == 0)
+            Cascade(kOverflow);
+        for (int l = kLevels - 1; l > 0; --l) {
+            if ((now_ & ((uint64_t(1) << (kBits * l)) - 1)) != 0) continue;
+            uint32_t b = l * kSlots + ((now_ >> (kBits * l)) & (kSlots - 1));
+            if (heads_[b] != Nil()) Cascade(b);
+        }
+        uint32_t b = now_ & (kSlots - 1);
+        while (heads_[b] != Nil()) {
+            Handle t = heads_[b];
+            Item item = timers_[t].item;
+            Unlink(t);
+            Free(t);
+            expire(item);
+        }
+    }
+}
+
+// Placeholder wheel of caches without expiry.
+struct NoTimerWheel {
+    typedef uint32_t Handle;
+};
+
+// Timer of an entry, empty without expiry.
+template <bool kEnabled>
+struct EntryTimer {};
+template <>
+struct EntryTimer<true> {
+    uint32_t timer = UINT32_MAX;
+};
+
+}  // namespace detail
+
+// Expiry of ARC entries, selected through the Expiry member of the policy.
+
+// Entries never expire, Put() with a ttl does not compile.
+struct NoExpiry {
+    static constexpr bool kEnabled = false;
+};
+
+// Entries Put with a ttl expire on a timer wheel driven by Clock, with a
+// resolution of Tick. An entry is removed up to one Tick before its ttl
+// runs out, never after.
+template <typename ClockT = std::chrono::steady_clock,
+          typename TickT = std::chrono::milliseconds>
+struct WheelExpiry {
+    static constexpr bool kEnabled = true;
+    using Clock = ClockT;
+    using Tick = TickT;
+};
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_ARC_EXPIRY_H_
@@ -0,0 +1,244 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_ARC_GHOSTS_H_
+#define SRC_INCLUDE_FENGGE_ARC_GHOSTS_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace fengge {
+namespace detail {
+
+// The ghost lists B1 and B2 of ARC reduced to a 64-bit fingerprint and a
+// charge per ghost. Ghosts live in a slot array linked into two LRU lists
+// by 32-bit index, a linear probing index maps a fingerprint to its slot.
+// A ghost takes sizeof(Ghost) = 24 bytes plus at most 8 bytes of index,
+// independent of the key type.
+//
+// The fingerprint is the table hash of the key, two keys with the same
+// fingerprint are the same ghost. With a well mixed 64-bit hash a key
+// which is not a ghost is taken for one with probability n / 2^64 for n
+// ghosts, about 5e-14 for a million ghosts.
+//
+// Alloc is rebound to the slots and the index, like the allocator of the
+// entry table (see arc_storage.h).
+template <typename Alloc>
+class GhostTable {
+ public:
+    typedef uint32_t Handle;
+
+    explicit GhostTable(const Alloc& alloc = Alloc())
+     : ghosts_(GhostAlloc(alloc)), index_(HandleAlloc(alloc)), free_(Nil()),
+       size_(0), mask_(0) {
+        head_[0] = head_[1] = tail_[0] = tail_[1] = Nil();
+    }
+
+    GhostTable(const GhostTable&) = delete;
+    void operator=(const GhostTable&) = delete;
+
+    static Handle Nil() { return UINT32_MAX; }
+
+    Handle Find(uint64_t fp) const;
+    // LRU ghost of list 0 or 1, Nil() if the list is empty
+    Handle Head(int list) const { return head_[list]; }
+    // next ghost towards the MRU end of its list
+    Handle Next(Handle g) const { return ghosts_[g].next; }
+    uint64_t Fingerprint(Handle g) const { return ghosts_[g].fp; }
+    int List(Handle g) const { return ghosts_[g].list; }
+    uint32_t Charge(Handle g) const { return ghosts_[g].charge; }
+    size_t Size() const { return size_; }
+
+    // Append a ghost to list as MRU item. The caller guarantees that fp is
+    // not in the table yet.
+    void Push(int list, uint64_t fp, uint32_t charge);
+    void Erase(Handle g);
+    void Clear();
+    // Room for n ghosts without allocating.
+    void Reserve(size_t n);
+    // bytes held by the slot array and the index
+    size_t MemoryUsage() const {
+        return ghosts_.capacity() * sizeof(Ghost) +
+               index_.size() * sizeof(Handle);
+    }
+
+ private:
+    struct Ghost {
+        uint64_t fp;
+        Handle prev;
+        Handle next;  // next free slot once erased
+        uint32_t charge;
+        uint32_t list;
+    };
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Ghost>
+        GhostAlloc;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<
+        Handle> HandleAlloc;
+
+    size_t HomeOf(uint64_t fp) const { return fp & mask_; }
+    void Rehash(size_t nindex);
+
+    std::vector<Ghost, GhostAlloc> ghosts_;
+    std::vector<Handle, HandleAlloc> index_;  // Nil() or a slot of ghosts_
+    Handle head_[2];
+    Handle tail_[2];
+    Handle free_;
+    size_t size_;
+    size_t mask_;
+};
+
+template <typename Alloc>
+inline typename GhostTable<Alloc>::Handle GhostTable<Alloc>::Find(
+    uint64_t fp) const {
+    if (size_ == 0) return Nil();
+    for (size_t i = HomeOf(fp); index_[i] != Nil(); i = (i + 1) & mask_) {
+        if (ghosts_[index_[i]].fp == fp) return index_[i];
+    }
+    return Nil();
+}
+
+template <typename Alloc>
+inline void GhostTable<Alloc>::Push(int list, uint64_t fp, uint32_t charge) {
+    assert(Find(fp) == Nil());
+    // keep the index at most half full
+    if ((size_ + 1) * 2 > index_.size())
+        Rehash(std::max<size_t>(16, index_.size() * 2));
+
+    Handle g;
+    if (free_ != Nil()) {
+        g = free_;
+        free_ = ghosts_[g].next;
+    } else {
+        assert(ghosts_.size() < Nil());
+        g = static_cast<Handle>(ghosts_.size());
+        ghosts_.emplace_back();
+    }
+    Ghost& ghost = ghosts_[g];
+    ghost.fp = fp;
+    ghost.charge = charge;
+    ghost.list = static_cast<uint32_t>(list);
+    ghost.prev = tail_[list];
+    ghost.next = Nil();
+    if (tail_[list] != Nil())
+        ghosts_[tail_[list]].next = g;
+    else
+        head_[list] = g;
+    tail_[list] = g;
+
+    size_t i = HomeOf(fp);
+    while (index_[i] != Nil()) i = (i + 1) & mask_;
+    index_[i] = g;
+    ++size_;
+}
+
+template <typename Alloc>
+inline void GhostTable<Alloc>::Erase(Handle g) {
+    Ghost& ghost = ghosts_[g];
+    size_t i = HomeOf(ghost.fp);
+    while (index_[i] != g) i = (i + 1) & mask_;
+    // Backward shift deletion: pull later members of the probe run into
+    // the hole unless their home lies cyclically in (hole, position].
+    for (size_t j = (i + 1) & mask_; index_[j] != Nil(); j = (j + 1) & mask_) {
+        size_t home = HomeOf(ghosts_[index_[j]].fp);
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) continue;
+        index_[i] = index_[j];
+        i = j;
+    }
+    index_[i] = Nil();
+
+    if (ghost.prev != Nil())
+        ghosts_[ghost.prev].next = ghost.next;
+    else
+        head_[ghost.list] = ghost.next;
+    if (ghost.next != Nil())
+        ghosts_[ghost.next].prev = ghost.prev;
+    else
+        tail_[ghost.list] = ghost.prev;
+    ghost.next = free_;
+    free_ = g;
+    --size_;
+}
+
+template <typename Alloc>
+inline void GhostTable<Alloc>::Clear() {
+    ghosts_.clear();
+    std::fill(index_.begin(), index_.end(), Nil());
+    head_[0] = head_[1] = tail_[0] = tail_[1] = Nil();
+    free_ = Nil();
+    size_ = 0;
+}
+
+template <typename Alloc>
+inline void GhostTable<Alloc>::Reserve(size_t n) {
+    ghosts_.reserve(n);
+    size_t nindex = std::max<size_t>(16, index_.size());
+    while (nindex < 2 * n) nindex *= 2;
+    if (nindex != index_.size()) Rehash(nindex);
+}
+
+template <typename Alloc>
+inline void GhostTable<Alloc>::Rehash(size_t nindex) {
+    index_.assign(nindex, Nil());
+    mask_ = nindex - 1;
+    for (int list = 0; list < 2; ++list) {
+        for (Handle g = head_[list]; g != Nil(); g = ghosts_[g].next) {
+            size_t i = HomeOf(ghosts_[g].fp);
+            while (index_[i] != Nil()) i = (i + 1) & mask_;
+            index_[i] = g;
+        }
+    }
+}
+
+// Stand-in for GhostTable when the ghosts are table entries.
+template <typename Alloc>
+struct NoGhostTable {
+    typedef uint32_t Handle;
+
+    explicit NoGhostTable(const Alloc& = Alloc()) {}
+};
+
+}  // namespace detail
+
+// Representations of ARC's ghost lists B1/B2, selected through the Ghosts
+// member of the policy (see DefaultARCPolicy in arc.h). Table is given the
+// allocator of the entry table.
+
+// A ghost is a table entry which keeps the full key, its value is reset.
+struct KeyGhosts {
+    template <typename Alloc>
+    using Table = detail::NoGhostTable<Alloc>;
+    static constexpr bool kFingerprint = false;
+};
+
+// A ghost is a 64-bit fingerprint of its key in a detail::GhostTable, about
+// 32 bytes whatever the key. A false positive, with the probability given
+// there, makes a new key adapt p and enter T2 as if it had been evicted
+// recently. The keys of B1/B2 can not be listed.
+struct FingerprintGhosts {
+    template <typename Alloc>
+    using Table = detail::GhostTable<Alloc>;
+    static constexpr bool kFingerprint = true;
+};
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_ARC_GHOSTS_H_
@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_ARC_SNAPSHOT_H_
+#define SRC_INCLUDE_FENGGE_ARC_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FENGGE_SNAPSHOT_MMAP 1
+#endif
+
+namespace fengge {
+namespace detail {
+
+// File layout of ARC::SaveSnapshot(): a SnapshotHeader, then the entries of
+// T1, T2, B1 and B2 in this order, each queue from its LRU to its MRU end.
+// A resident entry is its key and value as written by SnapshotTraits,
+// with WheelExpiry followed by its 64-bit deadline in nanoseconds of
+// std::chrono::system_clock, 0 if it has no ttl. A ghost is its 32-bit
+// charge followed by its key, or by its 64-bit fingerprint with
+// FingerprintGhosts. Integers are in native byte order.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t capacity;
+    uint64_t p;
+    uint64_t count[4];  // T1, T2, B1, B2
+};
+
+constexpr char kSnapshotMagic[8] = {'A', 'R', 'C', 'S', 'N', 'A', 'P', 0};
+constexpr uint32_t kSnapshotVersion = 1;
+// ghosts are fingerprints
+constexpr uint32_t kSnapshotFingerprints = 1;
+// resident entries carry their deadline
+constexpr uint32_t kSnapshotDeadlines = 2;
+// charges are bytes (ByteCharge) rather than entries
+constexpr uint32_t kSnapshotByteCharge = 4;
+
+// Buffered writer of a snapshot. It writes to path.tmp and renames it to
+// path on a successful Close(), an existing snapshot is only replaced by a
+// complete one.
+class SnapshotWriter {
+ public:
+    // bytes buffered before they are written out
+    static constexpr size_t kBufferSize = 1 << 20;
+
+    SnapshotWriter() : file_(nullptr) {}
+    ~SnapshotWriter() {
+        if (file_ != nullptr) {
+            fclose(file_);
+            remove(tmp_.c_str());
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    void operator=(const SnapshotWriter&) = delete;
+
+    bool Open(const std::string& path) {
+        path_ = path;
+        tmp_ = path + ".tmp";
+        file_ = fopen(tmp_.c_str(), "wb");
+        buffer_.reserve(kBufferSize);
+        return file_ != nullptr;
+    }
+    // Append to Buffer() and call Flush() every now and then.
+    std::string* Buffer() { return &buffer_; }
+    bool Flush() {
+        if (buffer_.size() < kBufferSize) return true;
+        return Write();
+    }
+    bool Close() {
+        bool ok = Write() && fflush(file_) == 0 && ferror(file_) == 0;
+        ok = fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        if (ok) ok = rename(tmp_.c_str(), path_.c_str()) == 0;
+        if (!ok) remove(tmp_.c_str());
+        return ok;
+    }
+
+ private:
+    bool Write() {
+        bool ok = fwrite(buffer_.data(), 1, buffer_.size(), file_) ==
+                  buffer_.size();
+        buffer_.clear();
+        return ok;
+    }
+
+    FILE* file_;
+    std::string path_;
+    std::string tmp_;
+    std::string buffer_;
+};
+
+// Read-only view of a whole file, memory-mapped where mmap is available and
+// read into memory elsewhere.
+class MappedFile {
+ public:
+    MappedFile() : data_(nullptr), size_(0) {}
+    ~MappedFile() {
+#ifdef FENGGE_SNAPSHOT_MMAP
+        if (data_ != nullptr && size_ != 0)
+            munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    void operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path) {
+#ifdef FENGGE_SNAPSHOT_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        if (size == 0) {
+            close(fd);
+            return true;
+        }
+        void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) return false;
+        madvise(base, size, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(base);
+        size_ = size;
+        return true;
+#else
+        FILE* f = fopen(path.c_str(), "rb");
+        if (f == nullptr) return false;
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) != 0)
+            copy_.insert(copy_.end(), chunk, chunk + n);
+        bool ok = ferror(f) == 0;
+        fclose(f);
+        data_ = copy_.data();
+        size_ = copy_.size();
+        return ok;
+#endif
+    }
+    const char* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+ private:
+    const char* data_;
+    size_t size_;
+#ifndef FENGGE_SNAPSHOT_MMAP
+    std::vector<char> copy_;
+#endif
+};
+
+}  // namespace detail
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_ARC_SNAPSHOT_H_
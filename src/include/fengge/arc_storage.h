@@ -0,0 +1,829 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_ARC_STORAGE_H_
+#define SRC_INCLUDE_FENGGE_ARC_STORAGE_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace fengge {
+namespace detail {
+
+inline void Prefetch(const void* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+// std::hash<int> is the identity function on common STL implementations,
+// spread the bits before using the low bits as bucket index.
+inline size_t MixHash(size_t h) {
+    uint64_t x = h;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+}
+
+// Chained hash table of intrusive nodes. Every key owns exactly one node
+// which also carries the prev/next links of the queue it currently sits in,
+// so the caller can move an entry between queues without touching the
+// index. A node never moves in memory until it is erased.
+//
+// Entry must have a public member `key`. Nodes and buckets come from Alloc
+// rebound to them.
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+class NodeTable {
+ public:
+    struct Node {
+        Node* chain;
+        Node* prev;
+        Node* next;
+        size_t hash;
+        Entry entry;
+
+        template <typename... Args>
+        explicit Node(size_t h, Args&&... args)
+            : chain(nullptr), prev(nullptr), next(nullptr), hash(h),
+              entry(std::forward<Args>(args)...) {}
+    };
+    typedef Node* Handle;
+
+    explicit NodeTable(const Alloc& alloc = Alloc())
+        : buckets_(BucketAlloc(alloc)), mask_(0), size_(0), alloc_(alloc) {}
+    ~NodeTable() { Clear(); }
+
+    NodeTable(const NodeTable&) = delete;
+    void operator=(const NodeTable&) = delete;
+
+    static Handle Nil() { return nullptr; }
+
+    Entry& At(Handle h) { return h->entry; }
+    const Entry& At(Handle h) const { return h->entry; }
+    Handle& Prev(Handle h) { return h->prev; }
+    Handle Prev(Handle h) const { return h->prev; }
+    Handle& Next(Handle h) { return h->next; }
+    Handle Next(Handle h) const { return h->next; }
+    // hash the entry was inserted with
+    size_t HashAt(Handle h) const { return h->hash; }
+    size_t Size() const { return size_; }
+
+    template <typename Key>
+    size_t HashOf(const Key& k) const { return MixHash(hash_(k)); }
+
+    template <typename Key>
+    Handle Find(const Key& k, size_t hash) const;
+
+    // Batched lookups overlap their cache misses by prefetching in stages:
+    // PrefetchBucket() for every hash first, then PrefetchMatch(), which
+    // reads the bucket and prefetches the first node of its chain.
+    void PrefetchBucket(size_t hash) const {
+        if (!buckets_.empty()) Prefetch(&buckets_[hash & mask_]);
+    }
+    void PrefetchMatch(size_t hash) const {
+        if (!buckets_.empty() && buckets_[hash & mask_] != nullptr)
+            Prefetch(buckets_[hash & mask_]);
+    }
+    static void PrefetchHandle(Handle h) { Prefetch(h); }
+
+    // The caller guarantees that the key is not in the table yet.
+    template <typename... Args>
+    Handle Insert(size_t hash, Args&&... args);
+
+    void Erase(Handle h);
+    // Remove h from the index without destroying it, h stays valid until
+    // it is passed to Free().
+    void Detach(Handle h);
+    void Free(Handle h);
+    void Clear();
+    void Reserve(size_t n);
+
+ private:
+    typedef std::allocator_traits<Alloc> AllocTraits;
+    typedef typename AllocTraits::template rebind_alloc<Node> NodeAlloc;
+    typedef typename AllocTraits::template rebind_traits<Node> NodeTraits;
+    typedef typename AllocTraits::template rebind_alloc<Node*> BucketAlloc;
+
+    void Rehash(size_t nbuckets);
+
+    std::vector<Node*, BucketAlloc> buckets_;
+    size_t mask_;
+    size_t size_;
+    NodeAlloc alloc_;
+    Hash hash_;
+    KeyEqual eq_;
+};
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+template <typename Key>
+typename NodeTable<Entry, Hash, KeyEqual, Alloc>::Handle
+NodeTable<Entry, Hash, KeyEqual, Alloc>::Find(const Key& k, size_t hash) const {
+    if (size_ == 0) return nullptr;
+    for (Node* n = buckets_[hash & mask_]; n != nullptr; n = n->chain) {
+        if (n->hash == hash && eq_(n->entry.key, k)) return n;
+    }
+    return nullptr;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+template <typename... Args>
+typename NodeTable<Entry, Hash, KeyEqual, Alloc>::Handle
+NodeTable<Entry, Hash, KeyEqual, Alloc>::Insert(size_t hash, Args&&... args) {
+    if (size_ >= buckets_.size())
+        Rehash(std::max<size_t>(16, buckets_.size() * 2));
+    Node* n = NodeTraits::allocate(alloc_, 1);
+    try {
+        NodeTraits::construct(alloc_, n, hash, std::forward<Args>(args)...);
+    } catch (...) {
+        NodeTraits::deallocate(alloc_, n, 1);
+        throw;
+    }
+    Node*& head = buckets_[hash & mask_];
+    n->chain = head;
+    head = n;
+    ++size_;
+    return n;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void NodeTable<Entry, Hash, KeyEqual, Alloc>::Erase(Handle h) {
+    Detach(h);
+    Free(h);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void NodeTable<Entry, Hash, KeyEqual, Alloc>::Free(Handle h) {
+    NodeTraits::destroy(alloc_, h);
+    NodeTraits::deallocate(alloc_, h, 1);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void NodeTable<Entry, Hash, KeyEqual, Alloc>::Detach(Handle h) {
+    Node** pp = &buckets_[h->hash & mask_];
+    while (*pp != h) {
+        assert(*pp != nullptr);
+        pp = &(*pp)->chain;
+    }
+    *pp = h->chain;
+    h->chain = nullptr;
+    --size_;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void NodeTable<Entry, Hash, KeyEqual, Alloc>::Clear() {
+    for (auto& head : buckets_) {
+        Node* n = head;
+        while (n != nullptr) {
+            Node* chain = n->chain;
+            Free(n);
+            n = chain;
+        }
+        head = nullptr;
+    }
+    size_ = 0;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void NodeTable<Entry, Hash, KeyEqual, Alloc>::Reserve(size_t n) {
+    size_t nbuckets = std::max<size_t>(16, buckets_.size());
+    while (nbuckets < n) nbuckets *= 2;
+    if (nbuckets != buckets_.size()) Rehash(nbuckets);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void NodeTable<Entry, Hash, KeyEqual, Alloc>::Rehash(size_t nbuckets) {
+    std::vector<Node*, BucketAlloc> buckets(nbuckets, nullptr,
+                                            buckets_.get_allocator());
+    size_t mask = nbuckets - 1;
+    for (Node* head : buckets_) {
+        while (head != nullptr) {
+            Node* chain = head->chain;
+            head->chain = buckets[head->hash & mask];
+            buckets[head->hash & mask] = head;
+            head = chain;
+        }
+    }
+    buckets_.swap(buckets);
+    mask_ = mask;
+}
+
+// Control bytes of FlatTable, one per index position. A full position holds
+// the low 7 bits of the key hash, so most non-matching keys are rejected
+// without touching the slot they point to.
+constexpr int8_t kCtrlEmpty = -128;
+constexpr int8_t kCtrlDeleted = -2;
+constexpr size_t kGroupWidth = 16;
+
+inline int LowestBit(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+// A group of kGroupWidth control bytes matched at once, bit i of a result
+// mask corresponds to ctrl[i].
+struct CtrlGroup {
+#if defined(__SSE2__)
+    explicit CtrlGroup(const int8_t* ctrl)
+        : ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+
+    uint32_t Match(int8_t h2) const {
+        return static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl_)));
+    }
+    uint32_t MatchEmpty() const { return Match(kCtrlEmpty); }
+    uint32_t MatchEmptyOrDeleted() const {
+        // empty and deleted are the only control bytes with the sign bit set
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl_));
+    }
+
+ private:
+    __m128i ctrl_;
+#else
+    explicit CtrlGroup(const int8_t* ctrl) : ctrl_(ctrl) {}
+
+    uint32_t Match(int8_t h2) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i)
+            if (ctrl_[i] == h2) mask |= 1u << i;
+        return mask;
+    }
+    uint32_t MatchEmpty() const { return Match(kCtrlEmpty); }
+    uint32_t MatchEmptyOrDeleted() const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i)
+            if (ctrl_[i] < 0) mask |= 1u << i;
+        return mask;
+    }
+
+ private:
+    const int8_t* ctrl_;
+#endif
+};
+
+// Open addressing hash table over a contiguous slot array. Entries live in
+// slots addressed by 32-bit index, the index is a SwissTable style array of
+// control bytes probed one group at a time. Erased slots are recycled through
+// a free list and tombstones are purged in place, so once the table has been
+// reserved for the maximum number of entries, Insert and Erase never
+// allocate. The slot array and the index come from Alloc rebound to them.
+//
+// Slot indexes stay valid when the slot array grows, entry addresses do not.
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+class FlatTable {
+ public:
+    typedef uint32_t Handle;
+
+    explicit FlatTable(const Alloc& alloc = Alloc())
+        : slots_(SlotAlloc(alloc)), used_(0), free_(Nil()), size_(0),
+          ctrl_(CtrlAlloc(alloc)), index_(IndexAlloc(alloc)), capacity_(0),
+          growth_left_(0) {}
+    ~FlatTable() { DestroyEntries(); }
+
+    FlatTable(const FlatTable&) = delete;
+    void operator=(const FlatTable&) = delete;
+
+    static Handle Nil() { return UINT32_MAX; }
+
+    Entry& At(Handle h) { return slots_[h].entry(); }
+    const Entry& At(Handle h) const { return slots_[h].entry(); }
+    Handle& Prev(Handle h) { return slots_[h].prev; }
+    Handle Prev(Handle h) const { return slots_[h].prev; }
+    Handle& Next(Handle h) { return slots_[h].next; }
+    Handle Next(Handle h) const { return slots_[h].next; }
+    size_t HashAt(Handle h) const { return slots_[h].hash; }
+    size_t Size() const { return size_; }
+
+    template <typename Key>
+    size_t HashOf(const Key& k) const { return MixHash(hash_(k)); }
+
+    template <typename Key>
+    Handle Find(const Key& k, size_t hash) const;
+
+    // See NodeTable. PrefetchBucket() prefetches the first probed group of
+    // control bytes and its index positions, PrefetchMatch() the slot of
+    // the first matching control byte.
+    void PrefetchBucket(size_t hash) const;
+    void PrefetchMatch(size_t hash) const;
+    void PrefetchHandle(Handle h) const { Prefetch(&slots_[h]); }
+
+    // The caller guarantees that the key is not in the table yet.
+    template <typename... Args>
+    Handle Insert(size_t hash, Args&&... args);
+
+    void Erase(Handle h);
+    void Clear();
+    void Reserve(size_t n);
+
+ private:
+    static constexpr uint32_t kFreeSlot = UINT32_MAX;
+
+    struct Slot {
+        Handle prev;
+        Handle next;
+        uint32_t pos;  // position in ctrl_, kFreeSlot if unused
+        size_t hash;
+        alignas(Entry) unsigned char storage[sizeof(Entry)];
+
+        Entry& entry() {
+            return *std::launder(reinterpret_cast<Entry*>(storage));
+        }
+        const Entry& entry() const {
+            return *std::launder(reinterpret_cast<const Entry*>(storage));
+        }
+    };
+
+    typedef std::allocator_traits<Alloc> AllocTraits;
+    typedef typename AllocTraits::template rebind_alloc<Slot> SlotAlloc;
+    typedef typename AllocTraits::template rebind_alloc<int8_t> CtrlAlloc;
+    typedef typename AllocTraits::template rebind_alloc<Handle> IndexAlloc;
+
+    static int8_t H2(size_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+    static size_t MaxLoad(size_t capacity) { return capacity / 8 * 7; }
+    size_t GroupMask() const { return capacity_ / kGroupWidth - 1; }
+
+    Handle AllocSlot();
+    void GrowSlots(size_t n);
+    size_t FindInsertPos(size_t hash) const;
+    void Rehash(size_t capacity);
+    void DestroyEntries();
+
+    std::vector<Slot, SlotAlloc> slots_;
+    size_t used_;       // slots below this index have been handed out once
+    Handle free_;
+    size_t size_;
+    std::vector<int8_t, CtrlAlloc> ctrl_;
+    std::vector<Handle, IndexAlloc> index_;
+    size_t capacity_;
+    size_t growth_left_;
+    Hash hash_;
+    KeyEqual eq_;
+};
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+template <typename Key>
+typename FlatTable<Entry, Hash, KeyEqual, Alloc>::Handle
+FlatTable<Entry, Hash, KeyEqual, Alloc>::Find(const Key& k, size_t hash) const {
+    if (size_ == 0) return Nil();
+    const size_t gmask = GroupMask();
+    size_t g = (hash >> 7) & gmask;
+    for (size_t i = 1; i <= gmask + 1; ++i) {
+        CtrlGroup group(&ctrl_[g * kGroupWidth]);
+        for (uint32_t m = group.Match(H2(hash)); m != 0; m &= m - 1) {
+            Handle h = index_[g * kGroupWidth + LowestBit(m)];
+            if (slots_[h].hash == hash && eq_(slots_[h].entry().key, k))
+                return h;
+        }
+        if (group.MatchEmpty() != 0) break;
+        g = (g + i) & gmask;
+    }
+    return Nil();
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::PrefetchBucket(
+    size_t hash) const {
+    if (capacity_ == 0) return;
+    size_t pos = ((hash >> 7) & GroupMask()) * kGroupWidth;
+    Prefetch(&ctrl_[pos]);
+    Prefetch(&index_[pos]);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::PrefetchMatch(size_t hash) const {
+    if (capacity_ == 0) return;
+    size_t pos = ((hash >> 7) & GroupMask()) * kGroupWidth;
+    uint32_t m = CtrlGroup(&ctrl_[pos]).Match(H2(hash));
+    if (m != 0) Prefetch(&slots_[index_[pos + LowestBit(m)]]);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+template <typename... Args>
+typename FlatTable<Entry, Hash, KeyEqual, Alloc>::Handle
+FlatTable<Entry, Hash, KeyEqual, Alloc>::Insert(size_t hash, Args&&... args) {
+    if (growth_left_ == 0) {
+        // Purge tombstones in place while the live entries fit in half of
+        // the index, grow otherwise.
+        if (capacity_ != 0 && size_ + 1 <= MaxLoad(capacity_) / 2)
+            Rehash(capacity_);
+        else
+            Rehash(std::max(kGroupWidth, capacity_ * 2));
+    }
+    Handle h = AllocSlot();
+    Slot& slot = slots_[h];
+    new (slot.storage) Entry(std::forward<Args>(args)...);
+    slot.hash = hash;
+    slot.prev = slot.next = Nil();
+
+    size_t pos = FindInsertPos(hash);
+    if (ctrl_[pos] == kCtrlEmpty) growth_left_--;
+    ctrl_[pos] = H2(hash);
+    index_[pos] = h;
+    slot.pos = static_cast<uint32_t>(pos);
+    ++size_;
+    return h;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::Erase(Handle h) {
+    Slot& slot = slots_[h];
+    size_t pos = slot.pos;
+    // A lookup only stops at a group with an empty byte, if this group
+    // already has one no probe sequence runs past it and the position can
+    // be marked empty instead of leaving a tombstone.
+    CtrlGroup group(&ctrl_[pos / kGroupWidth * kGroupWidth]);
+    if (group.MatchEmpty() != 0) {
+        ctrl_[pos] = kCtrlEmpty;
+        growth_left_++;
+    } else {
+        ctrl_[pos] = kCtrlDeleted;
+    }
+    slot.entry().~Entry();
+    slot.pos = kFreeSlot;
+    slot.next = free_;
+    free_ = h;
+    --size_;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::Clear() {
+    DestroyEntries();
+    used_ = 0;
+    free_ = Nil();
+    size_ = 0;
+    if (capacity_ != 0) {
+        std::fill(ctrl_.begin(), ctrl_.end(), kCtrlEmpty);
+        growth_left_ = MaxLoad(capacity_);
+    }
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::Reserve(size_t n) {
+    if (n > slots_.size()) GrowSlots(n);
+    // keep at least half of the index for tombstones
+    size_t capacity = std::max(kGroupWidth, capacity_);
+    while (MaxLoad(capacity) / 2 < n) capacity *= 2;
+    if (capacity != capacity_) Rehash(capacity);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+typename FlatTable<Entry, Hash, KeyEqual, Alloc>::Handle
+FlatTable<Entry, Hash, KeyEqual, Alloc>::AllocSlot() {
+    if (free_ != Nil()) {
+        Handle h = free_;
+        free_ = slots_[h].next;
+        return h;
+    }
+    if (used_ == slots_.size())
+        GrowSlots(std::max<size_t>(16, slots_.size() * 2));
+    return static_cast<Handle>(used_++);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::GrowSlots(size_t n) {
+    assert(n < Nil());
+    std::vector<Slot, SlotAlloc> slots(n, slots_.get_allocator());
+    for (size_t i = 0; i < used_; ++i) {
+        Slot& from = slots_[i];
+        Slot& to = slots[i];
+        to.prev = from.prev;
+        to.next = from.next;
+        to.pos = from.pos;
+        to.hash = from.hash;
+        if (from.pos != kFreeSlot) {
+            new (to.storage) Entry(std::move(from.entry()));
+            from.entry().~Entry();
+        }
+    }
+    slots_.swap(slots);
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+size_t FlatTable<Entry, Hash, KeyEqual, Alloc>::FindInsertPos(
+    size_t hash) const {
+    const size_t gmask = GroupMask();
+    size_t g = (hash >> 7) & gmask;
+    for (size_t i = 1;; ++i) {
+        uint32_t m = CtrlGroup(&ctrl_[g * kGroupWidth]).MatchEmptyOrDeleted();
+        if (m != 0) return g * kGroupWidth + LowestBit(m);
+        g = (g + i) & gmask;
+    }
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::Rehash(size_t capacity) {
+    if (capacity != capacity_) {
+        ctrl_.resize(capacity);
+        index_.resize(capacity);
+        capacity_ = capacity;
+    }
+    std::fill(ctrl_.begin(), ctrl_.end(), kCtrlEmpty);
+    growth_left_ = MaxLoad(capacity_) - size_;
+    for (size_t i = 0; i < used_; ++i) {
+        Slot& slot = slots_[i];
+        if (slot.pos == kFreeSlot) continue;
+        size_t pos = FindInsertPos(slot.hash);
+        ctrl_[pos] = H2(slot.hash);
+        index_[pos] = static_cast<Handle>(i);
+        slot.pos = static_cast<uint32_t>(pos);
+    }
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc>
+void FlatTable<Entry, Hash, KeyEqual, Alloc>::DestroyEntries() {
+    for (size_t i = 0; i < used_; ++i) {
+        if (slots_[i].pos != kFreeSlot) {
+            slots_[i].entry().~Entry();
+            slots_[i].pos = kFreeSlot;
+        }
+    }
+}
+
+// Fixed table of kSlots entries held in the object itself, it never
+// allocates and Alloc is ignored. Slots are addressed by index and recycled
+// through a free list. Up to kScanSlots slots the index is a packed array of
+// control bytes, one per slot, scanned a group at a time by Find(); larger
+// tables chain the slots from a power of two array of bucket heads.
+//
+// Insert expects fewer than kSlots entries, the caller bounds the size.
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+class StaticTable {
+ public:
+    typedef uint32_t Handle;
+    static constexpr size_t kScanSlots = 128;
+
+    explicit StaticTable(const Alloc& = Alloc()) : used_(0), size_(0) {
+        Reset();
+    }
+    ~StaticTable() { DestroyEntries(); }
+
+    StaticTable(const StaticTable&) = delete;
+    void operator=(const StaticTable&) = delete;
+
+    static Handle Nil() { return UINT32_MAX; }
+
+    Entry& At(Handle h) { return slots_[h].entry(); }
+    const Entry& At(Handle h) const { return slots_[h].entry(); }
+    Handle& Prev(Handle h) { return slots_[h].prev; }
+    Handle Prev(Handle h) const { return slots_[h].prev; }
+    Handle& Next(Handle h) { return slots_[h].next; }
+    Handle Next(Handle h) const { return slots_[h].next; }
+    size_t HashAt(Handle h) const { return slots_[h].hash; }
+    size_t Size() const { return size_; }
+
+    template <typename Key>
+    size_t HashOf(const Key& k) const { return MixHash(hash_(k)); }
+
+    template <typename Key>
+    Handle Find(const Key& k, size_t hash) const;
+
+    // See NodeTable. A scanned table prefetches nothing, its control bytes
+    // take a few cache lines read in order.
+    void PrefetchBucket(size_t hash) const {
+        if constexpr (!kScan) Prefetch(&heads_[hash & kMask]);
+    }
+    void PrefetchMatch(size_t hash) const {
+        if constexpr (!kScan) {
+            Handle h = heads_[hash & kMask];
+            if (h != Nil()) Prefetch(&slots_[h]);
+        }
+    }
+    void PrefetchHandle(Handle h) const { Prefetch(&slots_[h]); }
+
+    // The caller guarantees that the key is not in the table yet.
+    template <typename... Args>
+    Handle Insert(size_t hash, Args&&... args);
+
+    void Erase(Handle h);
+    void Clear();
+    void Reserve(size_t n) { assert(n <= kSlots); (void)n; }
+
+ private:
+    static_assert(kSlots < UINT32_MAX, "slot index must fit a Handle");
+    static constexpr bool kScan = kSlots <= kScanSlots;
+    // control bytes past kSlots stay empty, Find() reads whole groups
+    static constexpr size_t kCtrlBytes =
+        (kSlots + kGroupWidth - 1) / kGroupWidth * kGroupWidth;
+    static constexpr size_t Buckets() {
+        size_t n = 1;
+        while (n < kSlots) n *= 2;
+        return n;
+    }
+    static constexpr size_t kMask = Buckets() - 1;
+
+    struct Slot {
+        Handle prev;
+        Handle next;
+        Handle chain;  // next slot of the bucket, unused when scanned
+        size_t hash;
+        alignas(Entry) unsigned char storage[sizeof(Entry)];
+
+        Entry& entry() {
+            return *std::launder(reinterpret_cast<Entry*>(storage));
+        }
+        const Entry& entry() const {
+            return *std::launder(reinterpret_cast<const Entry*>(storage));
+        }
+    };
+
+    static int8_t H2(size_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+    void Reset();
+    void DestroyEntries();
+
+    Slot slots_[kSlots];
+    // H2() of the entry in each slot, kCtrlEmpty if the slot is free
+    alignas(kGroupWidth) int8_t ctrl_[kCtrlBytes];
+    Handle heads_[kScan ? 1 : Buckets()];
+    size_t used_;       // slots below this index have been handed out once
+    Handle free_;
+    size_t size_;
+    Hash hash_;
+    KeyEqual eq_;
+};
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+template <typename Key>
+typename StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Handle
+StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Find(const Key& k,
+                                                        size_t hash) const {
+    if constexpr (kScan) {
+        const size_t groups = (used_ + kGroupWidth - 1) / kGroupWidth;
+        for (size_t g = 0; g < groups; ++g) {
+            CtrlGroup group(&ctrl_[g * kGroupWidth]);
+            for (uint32_t m = group.Match(H2(hash)); m != 0; m &= m - 1) {
+                Handle h = static_cast<Handle>(g * kGroupWidth + LowestBit(m));
+                if (slots_[h].hash == hash && eq_(slots_[h].entry().key, k))
+                    return h;
+            }
+        }
+    } else {
+        for (Handle h = heads_[hash & kMask]; h != Nil();
+             h = slots_[h].chain) {
+            if (slots_[h].hash == hash && eq_(slots_[h].entry().key, k))
+                return h;
+        }
+    }
+    return Nil();
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+template <typename... Args>
+typename StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Handle
+StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Insert(size_t hash,
+                                                          Args&&... args) {
+    Handle h;
+    if (free_ != Nil()) {
+        h = free_;
+        free_ = slots_[h].next;
+    } else {
+        assert(used_ < kSlots);
+        h = static_cast<Handle>(used_++);
+    }
+    Slot& slot = slots_[h];
+    try {
+        new (slot.storage) Entry(std::forward<Args>(args)...);
+    } catch (...) {
+        slot.next = free_;
+        free_ = h;
+        throw;
+    }
+    slot.hash = hash;
+    slot.prev = slot.next = Nil();
+    ctrl_[h] = H2(hash);
+    if constexpr (!kScan) {
+        slot.chain = heads_[hash & kMask];
+        heads_[hash & kMask] = h;
+    }
+    ++size_;
+    return h;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+void StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Erase(Handle h) {
+    Slot& slot = slots_[h];
+    if constexpr (!kScan) {
+        Handle* pp = &heads_[slot.hash & kMask];
+        while (*pp != h) {
+            assert(*pp != Nil());
+            pp = &slots_[*pp].chain;
+        }
+        *pp = slot.chain;
+    }
+    slot.entry().~Entry();
+    ctrl_[h] = kCtrlEmpty;
+    slot.next = free_;
+    free_ = h;
+    --size_;
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+void StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Clear() {
+    DestroyEntries();
+    Reset();
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+void StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::Reset() {
+    used_ = 0;
+    free_ = Nil();
+    size_ = 0;
+    std::fill(ctrl_, ctrl_ + kCtrlBytes, kCtrlEmpty);
+    if constexpr (!kScan) std::fill(heads_, heads_ + Buckets(), Nil());
+}
+
+template <typename Entry, typename Hash, typename KeyEqual, typename Alloc,
+          size_t kSlots>
+void StaticTable<Entry, Hash, KeyEqual, Alloc, kSlots>::DestroyEntries() {
+    for (size_t i = 0; i < used_; ++i) {
+        if (ctrl_[i] != kCtrlEmpty) slots_[i].entry().~Entry();
+    }
+}
+
+}  // namespace detail
+
+// Storage backends of ARC, selected through the Storage member of the
+// policy (see DefaultARCPolicy in arc.h).
+
+// One heap node per key, chained hash index. Entry addresses are stable.
+struct NodeStorage {
+    template <typename Entry, typename Hash, typename KeyEqual,
+              typename Alloc>
+    using Table = detail::NodeTable<Entry, Hash, KeyEqual, Alloc>;
+    static constexpr bool kPreallocate = false;
+    // entries never move, they can be pinned by ARC::Lookup()
+    static constexpr bool kStableAddress = true;
+    // most entries the table can hold, bounds LoadSnapshot()
+    static constexpr size_t kMaxEntries = SIZE_MAX;
+};
+
+// Contiguous slot array and open addressing index sized for 2 * capacity
+// entries at construction, Put/Get do not allocate once constructed.
+struct FlatStorage {
+    template <typename Entry, typename Hash, typename KeyEqual,
+              typename Alloc>
+    using Table = detail::FlatTable<Entry, Hash, KeyEqual, Alloc>;
+    static constexpr bool kPreallocate = true;
+    static constexpr bool kStableAddress = false;
+    static constexpr size_t kMaxEntries = UINT32_MAX - 1;
+};
+
+// Room for the 2 * N + 1 entries of a cache of at most N entries inside
+// the cache object, see StaticARC in static_arc.h. Nothing is allocated,
+// whatever the allocator of the policy. A pinned entry would hold its slot
+// past the bound, so entries can not be pinned by ARC::Lookup().
+template <size_t N>
+struct StaticStorage {
+    template <typename Entry, typename Hash, typename KeyEqual,
+              typename Alloc>
+    using Table = detail::StaticTable<Entry, Hash, KeyEqual, Alloc,
+                                      2 * N + 1>;
+    static constexpr bool kPreallocate = false;
+    static constexpr bool kStableAddress = false;
+    static constexpr size_t kMaxEntries = 2 * N + 1;
+};
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_ARC_STORAGE_H_
@@ -0,0 +1,191 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_CACHE_BUDGET_H_
+#define SRC_INCLUDE_FENGGE_CACHE_BUDGET_H_
+
+#include <fengge/arc.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace fengge {
+
+// One memory limit shared by several caches. Every Rebalance() moves
+// capacity from the caches whose B1/B2 ghosts were hit least per byte since
+// the last call to those hit most: a ghost hit is a miss that a larger
+// cache would have served, so ghost hits per byte estimate what a byte is
+// worth to each cache. Donors give up 1 / 2^step_shift of their capacity per
+// call and shrink incrementally (see ARC::SetCapacity()), receivers at most
+// double. The caches must count their statistics (Policy::kStats), without
+// them the limit is split in proportion to the current capacities.
+//
+// A registered cache is any ARC or ShardedARC, or another type with
+// GetStats(), Capacity() and SetCapacity(). Rebalance() calls them under
+// the budget's lock, an ARC must not be used concurrently with it.
+class CacheBudget {
+ public:
+    // limit is in bytes, see Register() for the unit of each cache
+    explicit CacheBudget(size_t limit, unsigned step_shift = 4)
+        : limit_(limit), step_shift_(step_shift) {}
+
+    CacheBudget(const CacheBudget&) = delete;
+    void operator=(const CacheBudget&) = delete;
+
+    // Share the limit with cache, which must outlive its registration.
+    // unit_bytes is the size of one unit of its capacity: 1 for a
+    // ByteCharge cache, an average entry size for one counting entries.
+    // Rebalance() never sets its capacity below min_capacity units.
+    template <typename Cache>
+    void Register(Cache* cache, size_t unit_bytes = 1,
+                  size_t min_capacity = 0) {
+        Member m;
+        m.cache = cache;
+        m.ghost_hits = [cache]() {
+            ARCStats s = cache->GetStats();
+            return s.b1_ghost_hits + s.b2_ghost_hits;
+        };
+        m.capacity = [cache]() -> size_t { return cache->Capacity(); };
+        m.set_capacity = [cache](size_t c) { cache->SetCapacity(c); };
+        m.unit = std::max<size_t>(1, unit_bytes);
+        m.min_capacity = min_capacity;
+        m.last_ghost_hits = m.ghost_hits();
+        std::lock_guard<std::mutex> guard(mu_);
+        members_.push_back(std::move(m));
+    }
+    void Unregister(const void* cache) {
+        std::lock_guard<std::mutex> guard(mu_);
+        members_.erase(std::remove_if(members_.begin(), members_.end(),
+                                      [cache](const Member& m) {
+                                          return m.cache == cache;
+                                      }),
+                       members_.end());
+    }
+    // Takes effect on the next Rebalance().
+    void SetLimit(size_t limit) {
+        std::lock_guard<std::mutex> guard(mu_);
+        limit_ = limit;
+    }
+    size_t Limit() const {
+        std::lock_guard<std::mutex> guard(mu_);
+        return limit_;
+    }
+    // Sum of the registered capacities in bytes.
+    size_t Used() const {
+        std::lock_guard<std::mutex> guard(mu_);
+        size_t used = 0;
+        for (const Member& m : members_) used += m.capacity() * m.unit;
+        return used;
+    }
+    // Set the capacities of the caches from their ghost hits since the
+    // last call, call it periodically.
+    void Rebalance();
+
+ private:
+    struct Member {
+        const void* cache;
+        std::function<uint64_t()> ghost_hits;
+        std::function<size_t()> capacity;
+        std::function<void(size_t)> set_capacity;
+        size_t unit;
+        size_t min_capacity;
+        uint64_t last_ghost_hits;
+    };
+
+    mutable std::mutex mu_;
+    size_t limit_;
+    const unsigned step_shift_;
+    std::vector<Member> members_;
+};
+
+inline void CacheBudget::Rebalance() {
+    std::lock_guard<std::mutex> guard(mu_);
+    size_t n = members_.size();
+    if (n == 0) return;
+
+    std::vector<double> bytes(n), gain(n), want(n);
+    double total = 0, hits = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Member& m = members_[i];
+        uint64_t g = m.ghost_hits();
+        // the stats start over on Clear()
+        gain[i] = static_cast<double>(
+            g >= m.last_ghost_hits ? g - m.last_ghost_hits : g);
+        m.last_ghost_hits = g;
+        bytes[i] = static_cast<double>(m.capacity()) * m.unit;
+        total += bytes[i];
+        hits += gain[i];
+    }
+    double limit = static_cast<double>(limit_);
+    // above the limit (a new cache or a lower limit) everybody gives back
+    // in proportion
+    double scale = total > limit ? limit / total : 1.0;
+    double pool = limit;
+    for (size_t i = 0; i < n; ++i) {
+        want[i] = bytes[i] * scale;
+        pool -= want[i];
+    }
+
+    if (hits > 0) {
+        double mean = hits / std::max(total, 1.0);
+        auto utility = [&](size_t i) {
+            return gain[i] / std::max(bytes[i], 1.0);
+        };
+        double receivers = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (utility(i) > mean) {
+                receivers += gain[i];
+                continue;
+            }
+            double floor = static_cast<double>(members_[i].min_capacity) *
+                           members_[i].unit;
+            double give = std::min(want[i] / double(size_t(1) << step_shift_),
+                                   std::max(want[i] - floor, 0.0));
+            want[i] -= give;
+            pool += give;
+        }
+        double shared = pool;
+        for (size_t i = 0; i < n && receivers > 0; ++i) {
+            if (utility(i) <= mean) continue;
+            // B1/B2 remember at most one capacity worth of keys, growing
+            // further is a guess
+            double add = std::min(shared * gain[i] / receivers, bytes[i]);
+            want[i] += add;
+            pool -= add;
+        }
+    }
+    // whatever is left follows the current shares
+    if (pool > 0) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) sum += want[i];
+        for (size_t i = 0; i < n; ++i)
+            want[i] += sum > 0 ? pool * want[i] / sum : pool / n;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        Member& m = members_[i];
+        size_t c = static_cast<size_t>(want[i] / m.unit);
+        m.set_capacity(std::max(c, m.min_capacity));
+    }
+}
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_CACHE_BUDGET_H_
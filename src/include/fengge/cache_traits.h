@@ -17,7 +17,11 @@
 #ifndef FENGGE_SRC_INCLUDE_FENGGE_CACHE_TRAITS_H_
 #define FENGGE_SRC_INCLUDE_FENGGE_CACHE_TRAITS_H_
 
+#include <stdint.h>
+#include <string.h>
+
 #include <string>
+#include <type_traits>
 
 namespace fengge {
 
@@ -35,6 +39,46 @@ struct CacheTraits<std::string> {
     }
 };
 
+// Serialization of keys and values by ARC::SaveSnapshot() and
+// ARC::LoadSnapshot(). Save appends the bytes of v to out, Load parses them
+// from [*p, end), advances *p past them and returns false on truncated or
+// malformed input. The generic version copies the bytes of trivially
+// copyable types, specialize it for other types.
+template<class T>
+struct SnapshotTraits {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize fengge::SnapshotTraits for this type");
+
+    static void Save(const T &v, std::string *out) {
+        out->append(reinterpret_cast<const char *>(&v), sizeof(T));
+    }
+    static bool Load(const char **p, const char *end, T *v) {
+        if (static_cast<size_t>(end - *p) < sizeof(T)) return false;
+        memcpy(static_cast<void *>(v), *p, sizeof(T));
+        *p += sizeof(T);
+        return true;
+    }
+};
+
+// 32-bit length followed by the bytes
+template<>
+struct SnapshotTraits<std::string> {
+    static void Save(const std::string &v, std::string *out) {
+        uint32_t n = static_cast<uint32_t>(v.size());
+        out->append(reinterpret_cast<const char *>(&n), sizeof(n));
+        out->append(v.data(), n);
+    }
+    static bool Load(const char **p, const char *end, std::string *v) {
+        uint32_t n;
+        if (static_cast<size_t>(end - *p) < sizeof(n)) return false;
+        memcpy(&n, *p, sizeof(n));
+        if (static_cast<size_t>(end - *p) - sizeof(n) < n) return false;
+        v->assign(*p + sizeof(n), n);
+        *p += sizeof(n) + n;
+        return true;
+    }
+};
+
 }  // namespace arc_cache
 
 #endif  // FENGGE_SRC_INCLUDE_FENGGE_CACHE_TRAITS_H_
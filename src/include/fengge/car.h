@@ -0,0 +1,359 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_CAR_H_
+#define SRC_INCLUDE_FENGGE_CAR_H_
+
+#include <fengge/arc.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fengge {
+
+// CAR, Clock with Adaptive Replacement (Bansal and Modha, FAST '04): the
+// adaptation of ARC, with T1 and T2 kept as clocks instead of LRU lists. A
+// hit only sets the reference bit of the entry, the lists are reordered
+// when Put needs room: the hand of T1 moves referenced entries to T2, the
+// hand of T2 gives them a second chance, and the first unreferenced entry
+// is evicted to B1/B2. B1/B2 and p work as in ARC.
+//
+// Get still counts hits and misses; SharedGet() changes nothing but the
+// reference bit, with a relaxed store, so that readers may share a
+// std::shared_mutex and only Put, Remove and Clear need it exclusively.
+//
+// Same policies as ARC for the storage, hash and allocator; entries are
+// counted (EntryCountCharge), ghosts are keys, there is no expiry nor
+// admission filter.
+template <typename K, typename V, typename KeyTraits = CacheTraits<K>,
+          typename ValueTraits = CacheTraits<V>,
+          typename Policy = DefaultARCPolicy>
+class CAR {
+ public:
+    explicit CAR(size_t max_count)
+        : c_(max_count), p_(0), b1_(ARCQId::B1), t1_(ARCQId::T1),
+          b2_(ARCQId::B2), t2_(ARCQId::T2), cache_hit_(0), cache_miss_(0) {
+        if (Policy::Storage::kPreallocate) table_.Reserve(2 * c_ + 1);
+    }
+
+    CAR(const CAR&) = delete;
+    void operator=(const CAR&) = delete;
+
+    template <typename Q>
+    size_t HashOf(const Q& key) const {
+        return table_.HashOf(LookupKey(key));
+    }
+    template <typename Q>
+    void Put(const Q& key, const V& value) {
+        PutImpl(HashOf(key), key, value);
+    }
+    template <typename Q>
+    void Put(const Q& key, V&& value) {
+        PutImpl(HashOf(key), key, std::move(value));
+    }
+    template <typename Q>
+    bool Get(const Q& key, V* value) {
+        if (SharedGet(key, value)) {
+            cache_hit_++;
+            return true;
+        }
+        cache_miss_++;
+        return false;
+    }
+    // Get without counting, safe to call concurrently with other const
+    // members.
+    template <typename Q>
+    bool SharedGet(const Q& key, V* value) const;
+    template <typename Q>
+    void Remove(const Q& key);
+    void Clear();
+    size_t Size() const { return t1_.count + t2_.count; }
+    size_t Capacity() const { return c_; }
+    // Target size of T1, the adaptive parameter p.
+    size_t P() const { return p_; }
+    ARCSizeInfo ARCSize() const {
+        return ARCSizeInfo(b1_.count, t1_.count, b2_.count, t2_.count);
+    }
+    uint64_t HitCount() const { return cache_hit_; }
+    uint64_t MissCount() const { return cache_miss_; }
+
+    // for test purpose, T1/T2 from their hand on, B1/B2 from their LRU end
+    std::vector<K> GetKeysOfQ(ARCQId q) const;
+
+ private:
+    static_assert(Policy::Charge::kUnit, "CAR counts entries");
+    static_assert(!Policy::Ghosts::kFingerprint, "CAR keeps ghost keys");
+    static_assert(!Policy::Expiry::kEnabled, "CAR has no ttl");
+    static_assert(!Policy::Admission::kEnabled, "CAR admits every key");
+
+    // The entries of B1/B2 keep their key only, their value is reset.
+    struct Entry {
+        K key;
+        V value;
+        ARCQId q;
+        mutable std::atomic<bool> referenced;
+
+        template <typename KArg, typename VArg>
+        Entry(KArg&& k, VArg&& v, ARCQId id)
+            : key(std::forward<KArg>(k)), value(std::forward<VArg>(v)),
+              q(id), referenced(false) {}
+        // FlatStorage moves entries when it grows
+        Entry(Entry&& o)
+            : key(std::move(o.key)), value(std::move(o.value)), q(o.q),
+              referenced(o.referenced.load(std::memory_order_relaxed)) {}
+    };
+    typedef typename Policy::template Hash<K> Hash;
+    typedef typename Policy::template KeyEqual<K> KeyEqual;
+    typedef typename Policy::template Allocator<Entry> EntryAlloc;
+    typedef typename Policy::Storage::template Table<Entry, Hash, KeyEqual,
+                                                     EntryAlloc> Table;
+    static constexpr bool kTransparent =
+        detail::IsTransparent<Hash>::value &&
+        detail::IsTransparent<KeyEqual>::value;
+    typedef typename Table::Handle Slot;
+
+    // Circular list. For a clock, hand is the next entry to look at and new
+    // entries go right behind it; for B1/B2 hand is the LRU end.
+    struct Queue {
+        Slot hand;
+        size_t count;
+        const ARCQId id;
+
+        explicit Queue(ARCQId q) : hand(Table::Nil()), count(0), id(q) {}
+    };
+
+    template <typename Q>
+    static decltype(auto) LookupKey(const Q& key) {
+        if constexpr (kTransparent || std::is_same<Q, K>::value)
+            return (key);
+        else
+            return K(key);
+    }
+    Queue* QueueOf(ARCQId q);
+    // insert h right behind the hand of q
+    void Link(Queue* q, Slot h);
+    void Unlink(Slot h);
+    template <typename Q, typename VArg>
+    void PutImpl(size_t hash, const Q& key, VArg&& value);
+    // evict one entry of T1/T2 into B1/B2
+    void Replace();
+    void EraseLRU(Queue* b);
+
+    size_t c_;
+    size_t p_;
+    Table table_;
+    Queue b1_;
+    Queue t1_;
+    Queue b2_;
+    Queue t2_;
+    uint64_t cache_hit_;
+    uint64_t cache_miss_;
+};
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+typename CAR<K, V, KeyTraits, ValueTraits, Policy>::Queue*
+CAR<K, V, KeyTraits, ValueTraits, Policy>::QueueOf(ARCQId q) {
+    switch (q) {
+    case ARCQId::B1: return &b1_;
+    case ARCQId::T1: return &t1_;
+    case ARCQId::B2: return &b2_;
+    case ARCQId::T2: return &t2_;
+    }
+    return nullptr;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::Link(Queue* q, Slot h) {
+    if (q->hand == Table::Nil()) {
+        table_.Prev(h) = table_.Next(h) = h;
+        q->hand = h;
+    } else {
+        Slot last = table_.Prev(q->hand);
+        table_.Prev(h) = last;
+        table_.Next(h) = q->hand;
+        table_.Next(last) = h;
+        table_.Prev(q->hand) = h;
+    }
+    q->count++;
+    table_.At(h).q = q->id;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::Unlink(Slot h) {
+    Queue* q = QueueOf(table_.At(h).q);
+    if (--q->count == 0) {
+        q->hand = Table::Nil();
+        return;
+    }
+    Slot prev = table_.Prev(h);
+    Slot next = table_.Next(h);
+    table_.Next(prev) = next;
+    table_.Prev(next) = prev;
+    if (q->hand == h) q->hand = next;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool CAR<K, V, KeyTraits, ValueTraits, Policy>::SharedGet(const Q& key,
+    V* value) const {
+    const auto& k = LookupKey(key);
+    Slot h = table_.Find(k, table_.HashOf(k));
+    if (h == Table::Nil()) return false;
+    const Entry& e = table_.At(h);
+    if (e.q != ARCQId::T1 && e.q != ARCQId::T2) return false;
+    // skip the store, and the cache line transfer, if the bit is set
+    if (!e.referenced.load(std::memory_order_relaxed))
+        e.referenced.store(true, std::memory_order_relaxed);
+    if (value != nullptr) *value = e.value;
+    return true;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename VArg>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::PutImpl(size_t hash,
+    const Q& key, VArg&& value) {
+    const auto& k = LookupKey(key);
+    Slot h = table_.Find(k, hash);
+    if (h != Table::Nil()) {
+        Entry& e = table_.At(h);
+        if (e.q == ARCQId::T1 || e.q == ARCQId::T2) {
+            e.value = std::forward<VArg>(value);
+            e.referenced.store(true, std::memory_order_relaxed);
+            cache_hit_++;
+            return;
+        }
+    }
+    if (c_ == 0) return;
+
+    bool ghost = h != Table::Nil();
+    if (t1_.count + t2_.count == c_) Replace();
+    if (!ghost) {
+        // bound the ghosts: c for T1 + B1, 2c in total. The paper does it
+        // on a full cache only, which is the same until Remove() makes room
+        // in T1/T2.
+        if (t1_.count + b1_.count >= c_)
+            EraseLRU(&b1_);
+        else if (t1_.count + t2_.count + b1_.count + b2_.count >= 2 * c_)
+            EraseLRU(&b2_);
+        Link(&t1_, table_.Insert(hash, K(key), std::forward<VArg>(value),
+                                 ARCQId::T1));
+        return;
+    }
+
+    Entry& e = table_.At(h);
+    if (e.q == ARCQId::B1) {
+        p_ = std::min(p_ + std::max<size_t>(1, b2_.count / b1_.count), c_);
+    } else {
+        size_t delta = std::max<size_t>(1, b1_.count / b2_.count);
+        p_ = p_ > delta ? p_ - delta : 0;
+    }
+    Unlink(h);
+    e.value = std::forward<VArg>(value);
+    e.referenced.store(false, std::memory_order_relaxed);
+    Link(&t2_, h);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::Replace() {
+    for (;;) {
+        if (t1_.count >= std::max<size_t>(1, p_)) {
+            Slot h = t1_.hand;
+            Entry& e = table_.At(h);
+            Unlink(h);
+            if (!e.referenced.load(std::memory_order_relaxed)) {
+                e.value = V();
+                Link(&b1_, h);
+                return;
+            }
+            e.referenced.store(false, std::memory_order_relaxed);
+            Link(&t2_, h);
+        } else {
+            Slot h = t2_.hand;
+            Entry& e = table_.At(h);
+            if (!e.referenced.load(std::memory_order_relaxed)) {
+                Unlink(h);
+                e.value = V();
+                Link(&b2_, h);
+                return;
+            }
+            // second chance
+            e.referenced.store(false, std::memory_order_relaxed);
+            t2_.hand = table_.Next(h);
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::EraseLRU(Queue* b) {
+    if (b->count == 0) return;
+    Slot h = b->hand;
+    Unlink(h);
+    table_.Erase(h);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::Remove(const Q& key) {
+    const auto& k = LookupKey(key);
+    Slot h = table_.Find(k, table_.HashOf(k));
+    if (h == Table::Nil()) return;
+    Unlink(h);
+    table_.Erase(h);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void CAR<K, V, KeyTraits, ValueTraits, Policy>::Clear() {
+    table_.Clear();
+    for (auto q : {&b1_, &t1_, &b2_, &t2_}) {
+        q->hand = Table::Nil();
+        q->count = 0;
+    }
+    p_ = 0;
+    cache_hit_ = 0;
+    cache_miss_ = 0;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+std::vector<K> CAR<K, V, KeyTraits, ValueTraits, Policy>::GetKeysOfQ(
+    ARCQId q) const {
+    const Queue* queue = const_cast<CAR*>(this)->QueueOf(q);
+    std::vector<K> keys;
+    Slot h = queue->hand;
+    for (size_t i = 0; i < queue->count; ++i) {
+        keys.push_back(table_.At(h).key);
+        h = table_.Next(h);
+    }
+    return keys;
+}
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_CAR_H_
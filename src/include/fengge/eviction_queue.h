@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_EVICTION_QUEUE_H_
+#define SRC_INCLUDE_FENGGE_EVICTION_QUEUE_H_
+
+#include <stddef.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fengge {
+
+// Deferred eviction callback. Passed as on_evict to ARC::Put() or
+// ShardedARC::Put(), it only moves the evicted pair into a buffer under a
+// short lock; the expensive part (write-back, metrics) runs later in
+// Drain(), called by the thread that did the Put at a convenient time or by
+// a background thread blocked in WaitAndDrain(). Pairs are drained in
+// eviction order. The queue is not bounded, a drainer must keep up.
+template <typename K, typename V>
+class EvictionQueue {
+ public:
+    typedef std::pair<K, V> Item;
+
+    // WaitAndDrain() wakes up once batch pairs are queued.
+    explicit EvictionQueue(size_t batch = 64) : batch_(batch) {}
+
+    EvictionQueue(const EvictionQueue&) = delete;
+    void operator=(const EvictionQueue&) = delete;
+
+    void operator()(const K& key, V&& value) {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> guard(mu_);
+            items_.emplace_back(key, std::move(value));
+            wake = items_.size() == batch_;
+        }
+        if (wake) cv_.notify_one();
+    }
+
+    // Call f(Item&) on every queued pair, outside the lock. Returns the
+    // number of pairs.
+    template <typename F>
+    size_t Drain(F&& f) {
+        std::vector<Item> batch;
+        {
+            std::lock_guard<std::mutex> guard(mu_);
+            // hand the capacity of the last batch back to the producers
+            batch.swap(spare_);
+            batch.swap(items_);
+        }
+        return Consume(&batch, f);
+    }
+    // Wait until batch pairs are queued or timeout has passed, then
+    // Drain(f).
+    template <typename F, typename Rep, typename Period>
+    size_t WaitAndDrain(F&& f, std::chrono::duration<Rep, Period> timeout) {
+        std::vector<Item> batch;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait_for(lock, timeout,
+                         [this] { return items_.size() >= batch_; });
+            batch.swap(spare_);
+            batch.swap(items_);
+        }
+        return Consume(&batch, f);
+    }
+    size_t Size() const {
+        std::lock_guard<std::mutex> guard(mu_);
+        return items_.size();
+    }
+
+ private:
+    template <typename F>
+    size_t Consume(std::vector<Item>* batch, F& f) {
+        for (Item& item : *batch) f(item);
+        size_t n = batch->size();
+        batch->clear();
+        std::lock_guard<std::mutex> guard(mu_);
+        if (batch->capacity() > spare_.capacity()) spare_.swap(*batch);
+        return n;
+    }
+
+    const size_t batch_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<Item> items_;
+    std::vector<Item> spare_;  // empty, keeps the capacity of a drained batch
+};
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_EVICTION_QUEUE_H_
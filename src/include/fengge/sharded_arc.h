@@ -0,0 +1,757 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_SHARDED_ARC_H_
+#define SRC_INCLUDE_FENGGE_SHARDED_ARC_H_
+
+#include <fengge/arc.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fengge {
+
+struct ShardedARCOptions {
+    // rounded up to a power of two
+    size_t num_shards = 16;
+    // Serve Get() under a shared lock. Hits are recorded in lossy striped
+    // buffers and their queue updates (T1 -> T2 promotion, T2 MRU touch)
+    // are replayed in batches under the exclusive lock, when a buffer fills
+    // up or before the next write to the shard.
+    bool buffered_reads = false;
+};
+
+// Thread-safe ARC. Keys are partitioned by hash across independent ARC
+// instances, each with its own lock and its own adaptive target p, so
+// operations on different shards never contend.
+template <typename K, typename V, typename KeyTraits = CacheTraits<K>,
+          typename ValueTraits = CacheTraits<V>,
+          typename Policy = DefaultARCPolicy>
+class ShardedARC {
+ public:
+    using Cache = ARC<K, V, KeyTraits, ValueTraits, Policy>;
+    using EvictionCB = typename Cache::EvictionCB;
+    using Handle = typename Cache::Handle;
+
+    // max_count is split evenly across the shards. num_shards is rounded up
+    // to a power of two and reduced if there would be empty shards.
+    explicit ShardedARC(size_t max_count, size_t num_shards = 16);
+    ShardedARC(size_t max_count, const ShardedARCOptions& options);
+
+    // Keys are looked up as in ARC, a `const Q& key` may be any type the
+    // policy's transparent Hash and KeyEqual accept. The key is hashed once,
+    // the hash picks the shard and is handed down to its ARC.
+    template <typename Q>
+    size_t HashOf(const Q& key) const;
+
+    template <typename Q>
+    void Put(const Q& key, const V& value);
+    // See ARC::Put() with on_evict, it runs under the shard lock. An
+    // EvictionQueue keeps slow callbacks out of it.
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const K&, V&&>::value>>
+    void Put(const Q& key, const V& value, F&& on_evict);
+    template <typename Q>
+    void Put(const Q& key, V&& value);
+    void Put(K&& key, V&& value);
+    template <typename Q>
+    void Put(const Q& key, size_t hash, const V& value);
+    // See ARC::Put() with a ttl, needs a WheelExpiry policy.
+    template <typename Q, typename Rep, typename Period>
+    void Put(const Q& key, const V& value,
+             std::chrono::duration<Rep, Period> ttl);
+    template <typename Q, typename Rep, typename Period>
+    void Put(const Q& key, V&& value, std::chrono::duration<Rep, Period> ttl);
+    template <typename Q, typename... Args>
+    void Emplace(const Q& key, Args&&... args);
+    template <typename Q>
+    bool Get(const Q& key, V* value);
+    template <typename Q>
+    bool Get(const Q& key, size_t hash, V* value);
+    // On a hit, call visitor(const V&) with the cached value. The visitor
+    // runs under the shard lock and must not call back into the cache.
+    template <typename Q, typename F,
+              typename = std::enable_if_t<
+                  std::is_invocable<F&, const V&>::value>>
+    bool Get(const Q& key, F&& visitor);
+    // See ARC::GetOrLoad(). Concurrent misses on one key are coalesced: the
+    // first caller runs the loader, the others wait for its result. Callers
+    // that arrive after the value has been Put hit the cache.
+    template <typename Loader>
+    bool GetOrLoad(const K& key, V* value, Loader&& loader);
+    LoadStats GetLoadStats() const;
+    // See ARC::Lookup(). Release() takes the lock of the handle's shard.
+    Handle* Lookup(const K& key);
+    const V& Value(Handle* handle) const;
+    void Release(Handle* handle);
+    template <typename Q>
+    void Remove(const Q& key);
+    // ARC::Expire() on every shard, one shard lock at a time.
+    void Expire();
+    void Clear();
+    size_t Size() const;
+    size_t Capacity() const;
+    // Split new_capacity across the shards like the constructor does and
+    // ARC::SetCapacity() every shard, one shard lock at a time.
+    void SetCapacity(size_t new_capacity);
+    // ARC::Trim() every shard with budget entries each, true once all
+    // shards are within their capacity.
+    bool Trim(size_t budget);
+    ARCSizeInfo ARCSize() const;
+    size_t CachedByteCount() const;
+    uint64_t HitCount() const;
+    uint64_t MissCount() const;
+    // Sum of the shards' ARC::GetStats(). Every shard counts under its own
+    // lock, the counters of different shards never share a cache line.
+    // With buffered_reads, hits and misses include the striped read
+    // counters, t1_hits/t2_hits only the hits replayed so far.
+    ARCStats GetStats() const;
+    size_t ShardCount() const;
+
+    // Position of a Scan(), a default constructed cursor is at the start.
+    struct ScanCursor {
+        size_t shard = 0;
+        ARCQId q = ARCQId::T1;
+        typename Cache::QueueCursor at;  // in q of shard
+    };
+    // Visit up to limit resident entries as f(const K&, const V&), shard
+    // after shard, T1 then T2 of each from the LRU end, and advance the
+    // cursor. Every call holds one shard lock at a time, in shared mode,
+    // so a full scan never blocks the cache for long. Returns false once
+    // the scan is complete. An entry resident from the start to the end of
+    // the scan is visited at least once, again if it is promoted to T2 or
+    // hit in T2 after its visit, see ARC::ForEachInQFrom(). f runs under
+    // the shard lock and must not call back into the cache.
+    template <typename F>
+    bool Scan(ScanCursor* cursor, size_t limit, F&& f) const;
+    // Replay all buffered hits now, only meaningful with buffered_reads.
+    void DrainReadBuffers();
+
+ private:
+    static const size_t kReadBufferStripes = 4;
+    static const size_t kReadBufferSize = 64;
+
+    // Hits recorded by readers of one stripe. A reader that finds the
+    // stripe busy or full drops its record, losing an occasional promotion
+    // is cheaper than waiting for it.
+    struct alignas(64) ReadBuffer {
+        std::atomic<bool> busy{false};
+        std::vector<K> keys;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    // A load in progress, shared by the caller running the loader and the
+    // callers waiting for it.
+    struct Flight {
+        std::mutex mu;
+        std::condition_variable cv;
+        bool done = false;
+        bool ok = false;
+        V value;
+    };
+
+    // keep the locks of adjacent shards off the same cache line
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mu;
+        Cache cache;
+        std::unique_ptr<ReadBuffer[]> buffers;
+        // a reader is draining the buffers, never held by other readers
+        std::atomic<bool> draining{false};
+        // guarded by mu
+        std::unordered_map<K, std::shared_ptr<Flight>> flights;
+        LoadStats load_stats;
+
+        explicit Shard(size_t max_count) : cache(max_count) {}
+    };
+
+    ShardedARC(const ShardedARC&) = delete;
+    void operator=(const ShardedARC&) = delete;
+
+    void Init(size_t max_count, const ShardedARCOptions& options);
+    Shard& ShardOf(size_t hash) const;
+    // Key() and Value() of a handle do not depend on the shard it came from.
+    const Cache& AnyCache() const { return shards_[0]->cache; }
+    template <typename R, typename F>
+    R Sum(F&& f) const;
+    template <typename Q, typename F>
+    bool BufferedGet(Shard* shard, const Q& key, size_t hash, F&& visitor);
+    // Return true if the stripe is full and should be drained.
+    template <typename Q>
+    static bool Record(ReadBuffer* buffer, const Q& key);
+    // Must be called with shard->mu held exclusively.
+    static void Drain(Shard* shard);
+    static size_t StripeOfThisThread();
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    int shard_shift_;
+    bool buffered_reads_;
+};
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::ShardedARC(
+    size_t max_count, size_t num_shards) {
+    ShardedARCOptions options;
+    options.num_shards = num_shards;
+    Init(max_count, options);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::ShardedARC(
+    size_t max_count, const ShardedARCOptions& options) {
+    Init(max_count, options);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Init(
+    size_t max_count, const ShardedARCOptions& options) {
+    size_t n = 1;
+    int bits = 0;
+    while (n < options.num_shards &&
+           n * 2 <= std::max<size_t>(max_count, 1)) {
+        n *= 2;
+        bits++;
+    }
+    // the low bits of the mixed hash index the shard's own table
+    shard_shift_ = 64 - bits;
+    buffered_reads_ = options.buffered_reads;
+    shards_.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        size_t c = max_count / n + (i < max_count % n ? 1 : 0);
+        shards_.emplace_back(new Shard(c));
+        if (buffered_reads_) {
+            shards_.back()->buffers.reset(new ReadBuffer[kReadBufferStripes]);
+            for (size_t j = 0; j < kReadBufferStripes; ++j)
+                shards_.back()->buffers[j].keys.reserve(kReadBufferSize);
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+size_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::HashOf(
+    const Q& key) const {
+    return AnyCache().HashOf(key);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+typename ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Shard&
+ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::ShardOf(
+    size_t hash) const {
+    if (shards_.size() == 1) return *shards_[0];
+    return *shards_[static_cast<uint64_t>(hash) >> shard_shift_];
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename R, typename F>
+R ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Sum(F&& f) const {
+    R r{};
+    for (auto& shard : shards_) {
+        std::shared_lock<std::shared_mutex> guard(shard->mu);
+        r += f(shard->cache);
+    }
+    return r;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::StripeOfThisThread() {
+    static std::atomic<size_t> next_stripe{0};
+    thread_local size_t stripe =
+        next_stripe.fetch_add(1, std::memory_order_relaxed);
+    return stripe % kReadBufferStripes;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Record(
+    ReadBuffer* buffer, const Q& key) {
+    if (buffer->busy.exchange(true, std::memory_order_acquire))
+        return false;
+    bool full = buffer->keys.size() >= kReadBufferSize;
+    if (!full) {
+        buffer->keys.emplace_back(key);
+        full = buffer->keys.size() >= kReadBufferSize;
+    }
+    buffer->busy.store(false, std::memory_order_release);
+    return full;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Drain(Shard* shard) {
+    if (!shard->buffers) return;
+    for (size_t i = 0; i < kReadBufferStripes; ++i) {
+        ReadBuffer& buffer = shard->buffers[i];
+        // readers hold the flag only for a push_back
+        while (buffer.busy.exchange(true, std::memory_order_acquire))
+            std::this_thread::yield();
+        for (auto& key : buffer.keys)
+            shard->cache.Promote(key);
+        buffer.keys.clear();
+        buffer.busy.store(false, std::memory_order_release);
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::BufferedGet(
+    Shard* shard, const Q& key, size_t hash, F&& visitor) {
+    bool found;
+    {
+        std::shared_lock<std::shared_mutex> guard(shard->mu);
+        found = shard->cache.Peek(key, hash, visitor);
+    }
+    ReadBuffer* buffer = &shard->buffers[StripeOfThisThread()];
+    if (!found) {
+        buffer->misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    buffer->hits.fetch_add(1, std::memory_order_relaxed);
+    // One reader drains a full stripe and waits for the exclusive lock,
+    // the others go on and drop their records until it is done.
+    if (Record(buffer, key) &&
+        !shard->draining.exchange(true, std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::shared_mutex> guard(shard->mu);
+            Drain(shard);
+        }
+        shard->draining.store(false, std::memory_order_release);
+    }
+    return true;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    const V& value) {
+    Put(key, HashOf(key), value);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    const V& value, F&& on_evict) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    Drain(&shard);
+    shard.cache.Put(key, hash, value, on_evict);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    V&& value) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    Drain(&shard);
+    shard.cache.Put(key, hash, std::move(value));
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(K&& key,
+    V&& value) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    Drain(&shard);
+    shard.cache.Put(std::move(key), hash, std::move(value));
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    size_t hash, const V& value) {
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    Drain(&shard);
+    shard.cache.Put(key, hash, value);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename Rep, typename Period>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    const V& value, std::chrono::duration<Rep, Period> ttl) {
+    Put(key, V(value), ttl);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename Rep, typename Period>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Put(const Q& key,
+    V&& value, std::chrono::duration<Rep, Period> ttl) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    Drain(&shard);
+    shard.cache.Put(key, hash, std::move(value), ttl);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename... Args>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Emplace(const Q& key,
+    Args&&... args) {
+    // build the value before taking the lock
+    V value(std::forward<Args>(args)...);
+    Put(key, std::move(value));
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    V* value) {
+    return Get(key, HashOf(key), value);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    size_t hash, V* value) {
+    Shard& shard = ShardOf(hash);
+    if (buffered_reads_) {
+        return BufferedGet(&shard, key, hash, [value](const V& v) {
+            if (value) *value = v;
+        });
+    }
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    return shard.cache.Get(key, hash, value);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q, typename F, typename>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const Q& key,
+    F&& visitor) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    if (buffered_reads_) return BufferedGet(&shard, key, hash, visitor);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    return shard.cache.Get(key, hash, visitor);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Loader>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::GetOrLoad(
+    const K& key, V* value, Loader&& loader) {
+    size_t hash = HashOf(key);
+    if (Get(key, hash, value)) return true;
+
+    Shard& shard = ShardOf(hash);
+    std::shared_ptr<Flight> flight;
+    bool leader = false;
+    {
+        std::lock_guard<std::shared_mutex> guard(shard.mu);
+        // the value may have been Put since our miss
+        if (shard.cache.Peek(key, hash, value)) return true;
+        auto it = shard.flights.find(key);
+        if (it != shard.flights.end()) {
+            flight = it->second;
+            shard.load_stats.coalesced++;
+        } else {
+            flight = std::make_shared<Flight>();
+            shard.flights.emplace(key, flight);
+            leader = true;
+        }
+    }
+
+    if (!leader) {
+        std::unique_lock<std::mutex> lock(flight->mu);
+        flight->cv.wait(lock, [&] { return flight->done; });
+        if (flight->ok && value) *value = flight->value;
+        return flight->ok;
+    }
+
+    LoadStats stats;
+    bool ok = false;
+    auto finish = [&] {
+        {
+            // Put and retire the flight at once, a later miss either hits
+            // the cache or starts a new load
+            std::lock_guard<std::shared_mutex> guard(shard.mu);
+            Drain(&shard);
+            if (ok) shard.cache.Put(key, hash, flight->value);
+            shard.flights.erase(key);
+            shard.load_stats += stats;
+        }
+        std::lock_guard<std::mutex> lock(flight->mu);
+        flight->ok = ok;
+        flight->done = true;
+        flight->cv.notify_all();
+    };
+    try {
+        ok = detail::TimedLoad(loader, key, &flight->value, &stats);
+    } catch (...) {
+        // the waiters see a failed load
+        finish();
+        throw;
+    }
+    finish();
+    if (ok && value) *value = flight->value;
+    return ok;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+LoadStats ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::GetLoadStats()
+    const {
+    LoadStats stats;
+    for (auto& shard : shards_) {
+        std::shared_lock<std::shared_mutex> guard(shard->mu);
+        stats += shard->load_stats;
+    }
+    return stats;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+typename ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Handle*
+ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Lookup(const K& key) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    return shard.cache.Lookup(key, hash);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+const V& ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Value(
+    Handle* handle) const {
+    return AnyCache().Value(handle);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Release(
+    Handle* handle) {
+    // the key of a pinned entry never changes
+    Shard& shard = ShardOf(HashOf(AnyCache().Key(handle)));
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    shard.cache.Release(handle);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename Q>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Remove(const Q& key) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardOf(hash);
+    std::lock_guard<std::shared_mutex> guard(shard.mu);
+    Drain(&shard);
+    shard.cache.Remove(key, hash);
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Expire() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::shared_mutex> guard(shard->mu);
+        Drain(shard.get());
+        shard->cache.Expire();
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::shared_mutex> guard(shard->mu);
+        Drain(shard.get());
+        shard->cache.Clear();
+        shard->load_stats = LoadStats();
+        if (shard->buffers) {
+            for (size_t i = 0; i < kReadBufferStripes; ++i) {
+                shard->buffers[i].hits = 0;
+                shard->buffers[i].misses = 0;
+            }
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Size() const {
+    return Sum<size_t>([](const Cache& c) { return c.Size(); });
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Capacity() const {
+    return Sum<size_t>([](const Cache& c) { return c.Capacity(); });
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::SetCapacity(
+    size_t new_capacity) {
+    size_t n = shards_.size();
+    for (size_t i = 0; i < n; ++i) {
+        std::lock_guard<std::shared_mutex> guard(shards_[i]->mu);
+        Drain(shards_[i].get());
+        shards_[i]->cache.SetCapacity(new_capacity / n +
+                                      (i < new_capacity % n ? 1 : 0));
+    }
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Trim(size_t budget) {
+    bool done = true;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::shared_mutex> guard(shard->mu);
+        Drain(shard.get());
+        done = shard->cache.Trim(budget) && done;
+    }
+    return done;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+ARCSizeInfo ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::ARCSize() const {
+    ARCSizeInfo info;
+    for (auto& shard : shards_) {
+        std::shared_lock<std::shared_mutex> guard(shard->mu);
+        ARCSizeInfo s = shard->cache.ARCSize();
+        info.b1 += s.b1;
+        info.t1 += s.t1;
+        info.b2 += s.b2;
+        info.t2 += s.t2;
+    }
+    return info;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::CachedByteCount()
+    const {
+    return Sum<size_t>([](const Cache& c) { return c.CachedByteCount(); });
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+uint64_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::HitCount() const {
+    uint64_t n = Sum<uint64_t>([](const Cache& c) { return c.HitCount(); });
+    for (auto& shard : shards_) {
+        if (!shard->buffers) continue;
+        for (size_t i = 0; i < kReadBufferStripes; ++i)
+            n += shard->buffers[i].hits.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+uint64_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::MissCount() const {
+    uint64_t n = Sum<uint64_t>([](const Cache& c) { return c.MissCount(); });
+    for (auto& shard : shards_) {
+        if (!shard->buffers) continue;
+        for (size_t i = 0; i < kReadBufferStripes; ++i)
+            n += shard->buffers[i].misses.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+ARCStats ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::GetStats() const {
+    ARCStats stats = Sum<ARCStats>([](const Cache& c) {
+        return c.GetStats();
+    });
+    for (auto& shard : shards_) {
+        if (!shard->buffers) continue;
+        for (size_t i = 0; i < kReadBufferStripes; ++i) {
+            ReadBuffer& buffer = shard->buffers[i];
+            stats.hits += buffer.hits.load(std::memory_order_relaxed);
+            stats.misses += buffer.misses.load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+size_t ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::ShardCount() const {
+    return shards_.size();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+template <typename F>
+bool ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::Scan(
+    ScanCursor* cursor, size_t limit, F&& f) const {
+    size_t budget = limit;
+    while (cursor->shard < shards_.size()) {
+        if (budget == 0) return true;
+        Shard& shard = *shards_[cursor->shard];
+        {
+            std::shared_lock<std::shared_mutex> guard(shard.mu);
+            if (shard.cache.ForEachInQFrom(cursor->q, &cursor->at, &budget,
+                                           f))
+                return true;
+        }
+        if (cursor->q == ARCQId::T1) {
+            cursor->q = ARCQId::T2;
+        } else {
+            cursor->q = ARCQId::T1;
+            cursor->shard++;
+        }
+    }
+    return false;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void ShardedARC<K, V, KeyTraits, ValueTraits, Policy>::DrainReadBuffers() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::shared_mutex> guard(shard->mu);
+        Drain(shard.get());
+    }
+}
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_SHARDED_ARC_H_
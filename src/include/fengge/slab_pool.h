@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_SLAB_POOL_H_
+#define SRC_INCLUDE_FENGGE_SLAB_POOL_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <memory_resource>
+#include <vector>
+
+namespace fengge {
+
+// Memory resource for the entries of one cache. Blocks of up to kMaxBlock
+// bytes are carved from slabs of slab_bytes taken from upstream, a freed
+// block goes to the free list of its size and is handed out again by the
+// next allocation of that size. Under churn every node an eviction frees
+// is reused by the next insert and the upstream allocator is only called
+// when the cache grows. Larger or over-aligned blocks go to upstream
+// directly. Slabs are returned to upstream when the pool is destroyed.
+//
+// Not thread safe, like the ARC using it.
+class SlabPool : public std::pmr::memory_resource {
+ public:
+    static constexpr size_t kGranule = alignof(max_align_t);
+    static constexpr size_t kMaxBlock = 1024;
+
+    explicit SlabPool(size_t slab_bytes = 64 << 10,
+                      std::pmr::memory_resource* upstream =
+                          std::pmr::get_default_resource())
+        : slab_bytes_(std::max(slab_bytes, kMaxBlock)), upstream_(upstream),
+          cur_(nullptr), end_(nullptr), free_() {}
+    ~SlabPool() override {
+        for (void* slab : slabs_)
+            upstream_->deallocate(slab, slab_bytes_, kGranule);
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    void operator=(const SlabPool&) = delete;
+
+    // slabs taken from upstream so far
+    size_t SlabCount() const { return slabs_.size(); }
+
+ private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static size_t ClassOf(size_t bytes) {
+        return (std::max<size_t>(bytes, 1) + kGranule - 1) / kGranule - 1;
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    const size_t slab_bytes_;
+    std::pmr::memory_resource* const upstream_;
+    std::vector<void*> slabs_;
+    char* cur_;  // unused tail of the last slab
+    char* end_;
+    FreeBlock* free_[kMaxBlock / kGranule];
+};
+
+inline void* SlabPool::do_allocate(size_t bytes, size_t alignment) {
+    if (bytes > kMaxBlock || alignment > kGranule)
+        return upstream_->allocate(bytes, alignment);
+    size_t cls = ClassOf(bytes);
+    if (FreeBlock* b = free_[cls]) {
+        free_[cls] = b->next;
+        return b;
+    }
+    size_t size = (cls + 1) * kGranule;
+    if (static_cast<size_t>(end_ - cur_) < size) {
+        // the tail of the old slab is too small for this class, drop it
+        slabs_.reserve(slabs_.size() + 1);
+        cur_ = static_cast<char*>(upstream_->allocate(slab_bytes_, kGranule));
+        end_ = cur_ + slab_bytes_;
+        slabs_.push_back(cur_);
+    }
+    void* p = cur_;
+    cur_ += size;
+    return p;
+}
+
+inline void SlabPool::do_deallocate(void* p, size_t bytes,
+                                    size_t alignment) {
+    if (bytes > kMaxBlock || alignment > kGranule) {
+        upstream_->deallocate(p, bytes, alignment);
+        return;
+    }
+    size_t cls = ClassOf(bytes);
+    FreeBlock* b = static_cast<FreeBlock*>(p);
+    b->next = free_[cls];
+    free_[cls] = b;
+}
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_SLAB_POOL_H_
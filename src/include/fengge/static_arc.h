@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_STATIC_ARC_H_
+#define SRC_INCLUDE_FENGGE_STATIC_ARC_H_
+
+#include <fengge/arc.h>
+
+#include <stddef.h>
+
+#include <type_traits>
+
+namespace fengge {
+
+// Policy storing the entries of a cache of at most N entries in the cache
+// object, see StaticStorage in arc_storage.h.
+template <size_t N, typename Base = DefaultARCPolicy>
+struct StaticARCPolicy : Base {
+    using Storage = StaticStorage<N>;
+};
+
+// ARC of at most N entries which never allocates: B1/T1/B2/T2 and their
+// index live in arrays inside the object, the queues link slots by index.
+// Small caches look keys up by scanning a packed array of hash bytes
+// instead of walking a bucket chain. Put, Get and the replacement are those
+// of ARC, only the table differs. Keys and values may still allocate by
+// themselves, e.g. a std::string beyond its inline buffer.
+//
+// The object holds 2 * N + 1 entries, give a large one static storage
+// rather than a stack frame.
+template <typename K, typename V, size_t N,
+          typename KeyTraits = CacheTraits<K>,
+          typename ValueTraits = CacheTraits<V>,
+          typename Policy = DefaultARCPolicy>
+class StaticARC
+    : public ARC<K, V, KeyTraits, ValueTraits, StaticARCPolicy<N, Policy>> {
+    using Base = ARC<K, V, KeyTraits, ValueTraits, StaticARCPolicy<N, Policy>>;
+
+    static_assert(N > 0, "capacity must be positive");
+    // these would bring back allocations, or count N in another unit
+    static_assert(Policy::Charge::kUnit, "N is a number of entries");
+    static_assert(!Policy::Ghosts::kFingerprint,
+                  "fingerprint ghosts have their own table");
+    static_assert(std::is_same<typename Policy::Expiry, NoExpiry>::value,
+                  "the timer wheel allocates");
+    static_assert(std::is_same<typename Policy::Admission,
+                               NoAdmission>::value,
+                  "the frequency sketch allocates");
+
+ public:
+    static constexpr size_t kMaxCapacity = N;
+
+    // capacity, and that of SetCapacity(), is clamped to N by ARC, the
+    // tables are sized for N whatever it is
+    explicit StaticARC(size_t capacity = N) : Base(capacity) {}
+};
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_STATIC_ARC_H_
@@ -0,0 +1,457 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef SRC_INCLUDE_FENGGE_TIERED_ARC_H_
+#define SRC_INCLUDE_FENGGE_TIERED_ARC_H_
+
+#include <fengge/arc.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define FENGGE_TIER_LOG 1
+#endif
+
+namespace fengge {
+
+struct TierOptions {
+    // The log file, created or truncated by Open() and removed with the
+    // cache. Its content does not survive a restart.
+    std::string path;
+    // bytes of the log file, the oldest records are overwritten first
+    size_t capacity = size_t(1) << 30;
+    // bytes of evicted entries buffered before they are written out
+    size_t batch = size_t(1) << 20;
+    // Bytes buffered beyond a batch while the writer is still busy with
+    // the previous one, at most a quarter of the log. Once they are full,
+    // evicted entries are dropped rather than written. 0 makes Put and Get
+    // wait for the writer instead.
+    size_t backlog = size_t(4) << 20;
+};
+
+struct TierStats {
+    uint64_t spills;        // evicted entries appended to the log
+    uint64_t hits;          // Get misses served from the log
+    uint64_t misses;        // Get misses not in the log either
+    uint64_t reclaimed;     // records overwritten before they were read
+    uint64_t write_errors;  // failed batch writes, their records are lost
+    uint64_t dropped;       // evicted entries not written, see backlog
+
+    TierStats() : spills(0), hits(0), misses(0), reclaimed(0),
+                  write_errors(0), dropped(0) {}
+};
+
+namespace detail {
+
+// Ring of records on a file. Offsets grow forever, a record lives at
+// offset % capacity in the file until the tail passes it; records never
+// wrap around the end of the file. Appended records are buffered and
+// written by a background thread a batch at a time, with pwrite. Reads come
+// from the buffers or from a shared mapping of the file, without a copy.
+// While the writer is busy, records are buffered up to a backlog and
+// dropped beyond it, Append() only waits for the writer without a backlog.
+// All members but the writer thread belong to the thread using the cache.
+class TierLog {
+ public:
+    static constexpr uint64_t kNone = ~uint64_t(0);
+
+    TierLog()
+        : capacity_(0), batch_(0), backlog_(0), segment_(0), head_(0),
+          tail_(0), fill_base_(0), dropped_(0), inflight_base_(0),
+          lost_(0), errors_(0), stop_(false), fd_(-1), map_(nullptr) {}
+    ~TierLog() { Close(); }
+
+    TierLog(const TierLog&) = delete;
+    void operator=(const TierLog&) = delete;
+
+    bool Open(const std::string& path, size_t capacity, size_t batch,
+              size_t backlog) {
+#ifdef FENGGE_TIER_LOG
+        Close();
+        // the tail moves a segment at a time, at least two batches fit in
+        // the log besides the segment being reclaimed
+        batch = std::max<size_t>(1, std::min(batch, capacity / 8));
+        if (capacity < 8) return false;
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) return false;
+        void* map = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(capacity)) == 0)
+            map = mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+        path_ = path;
+        fd_ = fd;
+        map_ = static_cast<const char*>(map);
+        capacity_ = capacity;
+        batch_ = batch;
+        backlog_ = std::min(backlog, capacity / 4);
+        segment_ = std::max<size_t>(batch, capacity / 16);
+        head_ = tail_ = fill_base_ = inflight_base_ = 0;
+        // no writer runs, the members guarded by mu_ are ours
+        lost_ = errors_ = dropped_ = 0;
+        stop_ = false;
+        fill_.reserve(batch);
+        inflight_.reserve(batch);
+        writer_ = std::thread([this] { Run(); });
+        return true;
+#else
+        (void)path;
+        (void)capacity;
+        (void)batch;
+        (void)backlog;
+        return false;
+#endif
+    }
+    bool IsOpen() const { return map_ != nullptr; }
+    // Offset of the oldest record still readable.
+    uint64_t Tail() const { return tail_; }
+    uint64_t Errors() const {
+        std::lock_guard<std::mutex> guard(mu_);
+        return errors_;
+    }
+    // Records dropped because the writer was behind.
+    uint64_t Dropped() const { return dropped_; }
+
+    // Append a record, returns its offset, or kNone if it is too large or
+    // dropped. May move the tail past old records.
+    uint64_t Append(const char* data, size_t n) {
+        if (n > capacity_ - 2 * segment_) return kNone;
+        const bool wait = backlog_ == 0;
+        size_t at = head_ % capacity_;
+        if (at + n > capacity_) {
+            // skip the end of the file, fill_ must not run across it
+            if (!Submit(wait)) return Drop();
+            head_ += capacity_ - at;
+            fill_base_ = head_;
+        }
+        if (!wait && !fill_.empty() &&
+            fill_.size() + n > batch_ + backlog_ && !Submit(false))
+            return Drop();
+        while (head_ + n > tail_ + capacity_) tail_ += segment_;
+        uint64_t offset = head_;
+        fill_.append(data, n);
+        head_ += n;
+        if (fill_.size() >= batch_) Submit(wait);
+        return offset;
+    }
+    // Call f(const char*) on the n bytes of the record at offset and return
+    // its result, or false if the record is gone.
+    template <typename F>
+    bool Read(uint64_t offset, size_t n, F&& f) const {
+        if (offset < tail_ || offset + n > head_) return false;
+        if (offset >= fill_base_) return f(fill_.data() + offset - fill_base_);
+        {
+            std::lock_guard<std::mutex> guard(mu_);
+            if (!inflight_.empty() && offset >= inflight_base_)
+                return f(inflight_.data() + offset - inflight_base_);
+            if (offset < lost_) return false;
+        }
+        // written out, and only the caller moves the tail
+        return f(map_ + offset % capacity_);
+    }
+    // Wait until the buffered records are written.
+    void Flush() {
+        Submit(true);
+        std::unique_lock<std::mutex> lock(mu_);
+        done_.wait(lock, [this] { return inflight_.empty(); });
+    }
+    void Close() {
+#ifdef FENGGE_TIER_LOG
+        if (map_ == nullptr) return;
+        {
+            std::lock_guard<std::mutex> guard(mu_);
+            stop_ = true;
+        }
+        ready_.notify_one();
+        writer_.join();
+        munmap(const_cast<char*>(map_), capacity_);
+        close(fd_);
+        unlink(path_.c_str());
+        map_ = nullptr;
+        fd_ = -1;
+        fill_.clear();
+        inflight_.clear();
+#endif
+    }
+
+ private:
+    // Hand the records of fill_ to the writer once it is done with the
+    // previous batch. Without wait, return false if it is not done yet.
+    bool Submit(bool wait) {
+        if (fill_.empty()) return true;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            if (!wait && !inflight_.empty()) return false;
+            done_.wait(lock, [this] { return inflight_.empty(); });
+            inflight_.swap(fill_);
+            inflight_base_ = fill_base_;
+        }
+        fill_base_ = head_;
+        ready_.notify_one();
+        return true;
+    }
+    uint64_t Drop() {
+        dropped_++;
+        return kNone;
+    }
+    void Run() {
+#ifdef FENGGE_TIER_LOG
+        std::unique_lock<std::mutex> lock(mu_);
+        for (;;) {
+            ready_.wait(lock, [this] { return stop_ || !inflight_.empty(); });
+            if (inflight_.empty()) return;
+            lock.unlock();
+            // Submit() does not touch inflight_ until it is empty again
+            const char* p = inflight_.data();
+            size_t left = inflight_.size();
+            off_t at = static_cast<off_t>(inflight_base_ % capacity_);
+            while (left > 0) {
+                ssize_t n = pwrite(fd_, p, left, at);
+                if (n <= 0) break;
+                p += n;
+                left -= static_cast<size_t>(n);
+                at += n;
+            }
+            lock.lock();
+            if (left > 0) {
+                errors_++;
+                lost_ = inflight_base_ + inflight_.size();
+            }
+            inflight_.clear();
+            done_.notify_all();
+        }
+#endif
+    }
+
+    size_t capacity_;
+    size_t batch_;
+    size_t backlog_;
+    size_t segment_;
+    uint64_t head_;
+    uint64_t tail_;
+    uint64_t fill_base_;       // offset of fill_[0]
+    std::string fill_;         // appended, not submitted yet
+    uint64_t dropped_;
+    mutable std::mutex mu_;    // guards the members below
+    std::condition_variable ready_;
+    std::condition_variable done_;
+    uint64_t inflight_base_;   // offset of inflight_[0]
+    std::string inflight_;     // being written
+    uint64_t lost_;            // the records below failed to be written
+    uint64_t errors_;
+    bool stop_;
+    int fd_;
+    const char* map_;
+    std::string path_;
+    std::thread writer_;
+};
+
+}  // namespace detail
+
+// ARC with a second tier on local disk. The entries ARC evicts from T1/T2
+// are written to a log file in batches by a background thread, an index in
+// memory maps their key hash to the record. A Get that misses the ARC but
+// finds the key in the log reads the value from the mapped file and Puts it
+// back into the ARC, as a B1/B2 ghost hit if the key is still a ghost, so
+// that the disk tier feeds the adaptation like any other miss. Keys and
+// values are written by SnapshotTraits (cache_traits.h).
+//
+// The log is a ring: when it is full, the oldest records are overwritten
+// whether they are still useful or not, a FIFO on disk behind the ARC in
+// memory. A value served from the log leaves it, it is written again when it
+// is evicted again. Keys with equal hashes share one index slot, the last
+// one written wins.
+//
+// Evictions are written by the background thread. If it falls behind by
+// more than TierOptions::backlog, evicted entries are dropped and counted
+// in TierStats::dropped, Put and Get do not wait for the disk; with a
+// backlog of 0 they wait for the writer instead.
+//
+// Not thread safe, like ARC; the tier is POSIX only, elsewhere Open() fails
+// and the cache works without it.
+template <typename K, typename V, typename KeyTraits = CacheTraits<K>,
+          typename ValueTraits = CacheTraits<V>,
+          typename Policy = DefaultARCPolicy>
+class TieredARC {
+ public:
+    typedef ARC<K, V, KeyTraits, ValueTraits, Policy> Cache;
+
+    explicit TieredARC(size_t max_count)
+        : cache_(max_count), spill_{this}, pruned_(0) {}
+
+    TieredARC(const TieredARC&) = delete;
+    void operator=(const TieredARC&) = delete;
+
+    // Create the log file, before the cache is used. Returns false if it
+    // cannot be created; the cache works without a tier then.
+    bool Open(const TierOptions& options) {
+        index_.clear();
+        pruned_ = 0;
+        return log_.Open(options.path, options.capacity, options.batch,
+                         options.backlog);
+    }
+    void Put(const K& key, const V& value) {
+        Forget(key);
+        cache_.Put(key, value, spill_);
+    }
+    void Put(const K& key, V&& value) {
+        Forget(key);
+        cache_.Put(key, std::move(value), spill_);
+    }
+    // Get from the ARC, then from the log. value may be null.
+    bool Get(const K& key, V* value);
+    void Remove(const K& key) {
+        cache_.Remove(key);
+        Forget(key);
+    }
+    // Wait until the evicted entries are written out.
+    void Flush() {
+        if (log_.IsOpen()) log_.Flush();
+    }
+    size_t Size() const { return cache_.Size(); }
+    // Records in the log index, some may have been overwritten meanwhile.
+    size_t TierSize() const { return index_.size(); }
+    size_t Capacity() const { return cache_.Capacity(); }
+    ARCSizeInfo ARCSize() const { return cache_.ARCSize(); }
+    ARCStats GetStats() const { return cache_.GetStats(); }
+    TierStats GetTierStats() const {
+        TierStats s = stats_;
+        s.write_errors = log_.Errors();
+        s.dropped = log_.Dropped();
+        return s;
+    }
+
+ private:
+    // A record is the 32-bit size of the key, the key and the value.
+    struct Extent {
+        uint64_t offset;
+        uint32_t size;
+    };
+    struct Spill {
+        TieredARC* self;
+        void operator()(const K& key, V&& value) { self->Write(key, value); }
+    };
+
+    void Write(const K& key, const V& value);
+    // drop the record of key, it is stale once key is Put
+    void Forget(const K& key) {
+        if (!index_.empty()) index_.erase(cache_.HashOf(key));
+    }
+    // drop the index entries of the records behind the tail
+    void Prune();
+
+    Cache cache_;
+    Spill spill_;
+    detail::TierLog log_;
+    std::unordered_map<size_t, Extent> index_;  // by HashOf(key)
+    uint64_t pruned_;                           // log tail at the last Prune()
+    std::string record_;                        // scratch for Write()
+    std::string key_;                           // scratch for Get()
+    TierStats stats_;
+};
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+bool TieredARC<K, V, KeyTraits, ValueTraits, Policy>::Get(const K& key,
+    V* value) {
+    if (cache_.Get(key, value)) return true;
+    size_t hash = cache_.HashOf(key);
+    auto it = index_.find(hash);
+    if (it == index_.end()) {
+        stats_.misses++;
+        return false;
+    }
+    key_.clear();
+    SnapshotTraits<K>::Save(key, &key_);
+    bool other_key = false;
+    V v;
+    bool found = log_.Read(it->second.offset, it->second.size,
+                           [&](const char* p) {
+        const char* end = p + it->second.size;
+        uint32_t n;
+        memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        if (n != key_.size() || memcmp(p, key_.data(), n) != 0) {
+            other_key = true;
+            return false;
+        }
+        p += n;
+        // straight from the mapping into the value
+        return SnapshotTraits<V>::Load(&p, end, &v) && p == end;
+    });
+    if (!other_key) index_.erase(it);
+    if (!found) {
+        stats_.misses++;
+        return false;
+    }
+    stats_.hits++;
+    if (value != nullptr) *value = v;
+    cache_.Put(key, std::move(v), spill_);
+    return true;
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void TieredARC<K, V, KeyTraits, ValueTraits, Policy>::Write(const K& key,
+    const V& value) {
+    if (!log_.IsOpen()) return;
+    record_.assign(sizeof(uint32_t), '\0');
+    SnapshotTraits<K>::Save(key, &record_);
+    uint32_t n = static_cast<uint32_t>(record_.size() - sizeof(uint32_t));
+    memcpy(&record_[0], &n, sizeof(n));
+    SnapshotTraits<V>::Save(value, &record_);
+    if (record_.size() > UINT32_MAX) return;
+    uint64_t offset = log_.Append(record_.data(), record_.size());
+    if (offset == detail::TierLog::kNone) return;
+    index_[cache_.HashOf(key)] =
+        Extent{offset, static_cast<uint32_t>(record_.size())};
+    stats_.spills++;
+    if (log_.Tail() != pruned_) Prune();
+}
+
+template <typename K, typename V, typename KeyTraits, typename ValueTraits,
+          typename Policy>
+void TieredARC<K, V, KeyTraits, ValueTraits, Policy>::Prune() {
+    // once per segment of the log
+    pruned_ = log_.Tail();
+    for (auto it = index_.begin(); it != index_.end();) {
+        if (it->second.offset < pruned_) {
+            it = index_.erase(it);
+            stats_.reclaimed++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+}  // namespace fengge
+
+#endif  // SRC_INCLUDE_FENGGE_TIERED_ARC_H_
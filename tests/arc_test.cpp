@@ -14,16 +14,37 @@
  *  limitations under the License.
  */
 #include <fengge/arc.h>
+#include <fengge/cache_budget.h>
+#include <fengge/eviction_queue.h>
+#include <fengge/slab_pool.h>
+#include <fengge/static_arc.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <initializer_list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 using fengge::ARC;
 using fengge::ARCQId;
+using fengge::CacheTraits;
 
-template <size_t N>
-static void assert_keys(const ARC<int, int>& cache, ARCQId q,
-    const int (&x)[N]) {
+struct FlatPolicy : fengge::DefaultARCPolicy {
+    using Storage = fengge::FlatStorage;
+};
+
+template <typename Cache, size_t N>
+static void assert_keys(const Cache& cache, ARCQId q, const int (&x)[N]) {
     auto v = cache.GetKeysOfQ(q);
     ASSERT_EQ(v.size(), N);
     for (int i = 0; i < N; ++i) {
@@ -31,9 +52,8 @@ static void assert_keys(const ARC<int, int>& cache, ARCQId q,
     }
 }
 
-template <size_t N>
-static void assert_values(const ARC<int, int>& cache, ARCQId q,
-    const int (&x)[N]) {
+template <typename Cache, size_t N>
+static void assert_values(const Cache& cache, ARCQId q, const int (&x)[N]) {
     auto v = cache.GetValuesOfQ(q);
     ASSERT_EQ(v.size(), N);
     for (int i = 0; i < N; ++i) {
@@ -41,7 +61,8 @@ static void assert_values(const ARC<int, int>& cache, ARCQId q,
     }
 }
 
-static void assert_keys(const ARC<int, int>& cache, ARCQId q, int *x, int N) {
+template <typename Cache>
+static void assert_keys(const Cache& cache, ARCQId q, int *x, int N) {
     auto v = cache.GetKeysOfQ(q);
     ASSERT_EQ(v.size(), N);
     for (int i = 0; i < N; ++i) {
@@ -49,7 +70,8 @@ static void assert_keys(const ARC<int, int>& cache, ARCQId q, int *x, int N) {
     }
 }
 
-static void assert_cache_metrics(const ARC<int, int>& cache) {
+template <typename Cache>
+static void assert_cache_metrics(const Cache& cache) {
     const auto arcSize = cache.ARCSize();
     /* sizeof(key) + sizeof(value), yet sizeof(int) + sizeof(value) */
     const auto sizeofKey = sizeof(int);
@@ -59,9 +81,17 @@ static void assert_cache_metrics(const ARC<int, int>& cache) {
             cache.CachedByteCount());
 }
 
-TEST(ARCTest, cache_create) {
+template <typename Cache>
+class ARCTest : public testing::Test {};
+
+using CacheTypes = testing::Types<ARC<int, int>,
+    ARC<int, int, CacheTraits<int>, CacheTraits<int>, FlatPolicy>,
+    fengge::StaticARC<int, int, 128>>;
+TYPED_TEST_SUITE(ARCTest, CacheTypes);
+
+TYPED_TEST(ARCTest, cache_create) {
     const int maxCount = 5;
-    ARC<int, int> cache(maxCount);
+    TypeParam cache(maxCount);
 
     ASSERT_EQ(cache.Capacity(), maxCount);
     ASSERT_EQ(cache.Size(), 0);
@@ -70,9 +100,9 @@ TEST(ARCTest, cache_create) {
     ASSERT_EQ(cache.CachedByteCount(), 0);
 }
 
-TEST(ARCTest, cache_inspect) {
+TYPED_TEST(ARCTest, cache_inspect) {
     const int maxCount = 3;
-    ARC<int, int> cache(maxCount);
+    TypeParam cache(maxCount);
 
     for (auto a : {1, 2, 3}) {
         cache.Put(a, a);
@@ -131,9 +161,9 @@ TEST(ARCTest, cache_inspect) {
     assert_cache_metrics(cache);
 }
 
-TEST(ARCTest, cache_evict) {
+TYPED_TEST(ARCTest, cache_evict) {
     const int maxCount = 5;
-    ARC<int, int> cache(maxCount);
+    TypeParam cache(maxCount);
 
     for (int i = 0; i < maxCount; ++i) {
         cache.Put(i, i);
@@ -165,9 +195,9 @@ TEST(ARCTest, cache_evict) {
     assert_cache_metrics(cache);
 }
 
-TEST(ARCTest, cache_remove) {
+TYPED_TEST(ARCTest, cache_remove) {
     const int maxCount = 5;
-    ARC<int, int> cache(maxCount);
+    TypeParam cache(maxCount);
 
     for (int i = 0; i < maxCount; ++i) {
         cache.Put(i, i);
@@ -181,9 +211,9 @@ TEST(ARCTest, cache_remove) {
     assert_cache_metrics(cache);
 }
 
-TEST(ARCTest, cache_hitcount) {
+TYPED_TEST(ARCTest, cache_hitcount) {
     const int maxCount = 5;
-    ARC<int, int> cache(maxCount);
+    TypeParam cache(maxCount);
 
     for (int i = 0; i < maxCount; ++i) {
         cache.Put(i, i);
@@ -202,3 +232,1460 @@ TEST(ARCTest, cache_hitcount) {
     ASSERT_EQ(cache.HitCount(), maxCount);
     ASSERT_EQ(cache.MissCount(), maxCount);
 }
+
+TYPED_TEST(ARCTest, cache_clear) {
+    const int maxCount = 3;
+    TypeParam cache(maxCount);
+
+    for (int i = 0; i < maxCount * 2; ++i) {
+        cache.Put(i, i);
+    }
+    ASSERT_TRUE(cache.Get(4, nullptr));
+    cache.Clear();
+
+    assert_keys(cache, ARCQId::B1, nullptr, 0);
+    assert_keys(cache, ARCQId::T1, nullptr, 0);
+    assert_keys(cache, ARCQId::T2, nullptr, 0);
+    assert_keys(cache, ARCQId::B2, nullptr, 0);
+    ASSERT_EQ(cache.CachedByteCount(), 0);
+    ASSERT_EQ(cache.HitCount(), 0);
+
+    for (int i = 0; i < maxCount * 2; ++i) {
+        cache.Put(i, i);
+    }
+    assert_keys(cache, ARCQId::B1, nullptr, 0);
+    assert_keys(cache, ARCQId::T1, {3, 4, 5});
+    assert_cache_metrics(cache);
+}
+
+TYPED_TEST(ARCTest, cache_churn) {
+    const int maxCount = 100;
+    TypeParam cache(maxCount);
+
+    for (int i = 0; i < 20000; ++i) {
+        int k = (i * 7919) % 1000;
+        if (i % 3 == 0) {
+            cache.Get(k, nullptr);
+        } else if (i % 11 == 0) {
+            cache.Remove(k);
+        } else {
+            cache.Put(k, k + 1);
+        }
+    }
+    ASSERT_LE(cache.Size(), maxCount);
+    assert_cache_metrics(cache);
+
+    for (auto q : {ARCQId::T1, ARCQId::T2}) {
+        for (auto k : cache.GetKeysOfQ(q)) {
+            int v;
+            ASSERT_TRUE(cache.Get(k, &v));
+            ASSERT_EQ(k + 1, v);
+        }
+    }
+    for (auto q : {ARCQId::B1, ARCQId::B2}) {
+        for (auto k : cache.GetKeysOfQ(q)) {
+            ASSERT_FALSE(cache.Get(k, nullptr));
+        }
+    }
+}
+
+TYPED_TEST(ARCTest, cache_multi) {
+    // MultiGet/MultiPut behave exactly like loops of Get/Put
+    const int maxCount = 64;
+    TypeParam batched(maxCount);
+    TypeParam single(maxCount);
+
+    int keys[40];
+    int values[40];
+    int got[40];
+    bool found[40];
+    for (int round = 0; round < 200; ++round) {
+        int n = (round * 7) % 40 + 1;
+        for (int i = 0; i < n; ++i) {
+            keys[i] = (round * 31 + i * i * 13) % 200;
+            values[i] = keys[i] + round;
+        }
+        if (round % 3 == 0) {
+            batched.MultiPut(keys, values, n);
+            for (int i = 0; i < n; ++i) single.Put(keys[i], values[i]);
+        } else {
+            size_t hits = batched.MultiGet(keys, n, got, found);
+            size_t expected = 0;
+            for (int i = 0; i < n; ++i) {
+                int v;
+                bool hit = single.Get(keys[i], &v);
+                ASSERT_EQ(found[i], hit);
+                if (hit) {
+                    ASSERT_EQ(got[i], v);
+                }
+                expected += hit;
+            }
+            ASSERT_EQ(hits, expected);
+        }
+    }
+    ASSERT_EQ(batched.HitCount(), single.HitCount());
+    ASSERT_EQ(batched.MissCount(), single.MissCount());
+    for (auto q : {ARCQId::B1, ARCQId::T1, ARCQId::B2, ARCQId::T2}) {
+        ASSERT_EQ(batched.GetKeysOfQ(q), single.GetKeysOfQ(q));
+    }
+    assert_cache_metrics(batched);
+}
+
+TYPED_TEST(ARCTest, cache_walk) {
+    const int maxCount = 50;
+    TypeParam cache(maxCount);
+
+    for (int i = 0; i < 300; ++i) {
+        int k = (i * 37) % 90;
+        if (i % 4 == 0) {
+            cache.Get(k, nullptr);
+        } else {
+            cache.Put(k, k * 2);
+        }
+    }
+    for (auto q : {ARCQId::B1, ARCQId::T1, ARCQId::B2, ARCQId::T2}) {
+        std::vector<int> keys, values;
+        cache.ForEachInQ(q, [&](const int& k, const int& v) {
+            keys.push_back(k);
+            values.push_back(v);
+        });
+        ASSERT_EQ(keys, cache.GetKeysOfQ(q));
+        if (q == ARCQId::T1 || q == ARCQId::T2) {
+            ASSERT_EQ(values, cache.GetValuesOfQ(q));
+        }
+
+        std::vector<int> range;
+        for (auto item : cache.EntriesOfQ(q)) range.push_back(item.key);
+        ASSERT_EQ(range, keys);
+
+        // in steps of 3 entries
+        std::vector<int> steps;
+        typename TypeParam::QueueCursor cursor;
+        bool more = true;
+        while (more) {
+            size_t budget = 3;
+            more = cache.ForEachInQFrom(
+                q, &cursor, &budget,
+                [&](const int& k, const int&) { steps.push_back(k); });
+            if (more) {
+                ASSERT_EQ(budget, 0);
+            }
+        }
+        ASSERT_EQ(steps, keys);
+    }
+
+    // false stops the walk
+    size_t visited = 0;
+    cache.ForEachInQ(ARCQId::T1, [&](const int&, const int&) {
+        return ++visited < 2;
+    });
+    size_t t1 = cache.GetKeysOfQ(ARCQId::T1).size();
+    ASSERT_EQ(visited, std::min<size_t>(2, t1));
+}
+
+TEST(ARCWalkTest, cursor_entry_moves_between_steps) {
+    ARC<int, int> cache(100);
+    for (int i = 0; i < 40; ++i) cache.Put(i, i);
+    for (int i = 0; i < 40; i += 2) cache.Get(i, nullptr);
+    size_t t1 = cache.ARCSize().t1;
+
+    // the entry of the cursor leaves t1 after every step, promoted or
+    // removed; the walk goes on after it, the other entries are visited
+    // once
+    std::vector<int> seen, moved;
+    ARC<int, int>::QueueCursor cursor;
+    for (int step = 0;; ++step) {
+        size_t budget = 3;
+        bool more = cache.ForEachInQFrom(
+            ARCQId::T1, &cursor, &budget,
+            [&](const int& k, const int&) { seen.push_back(k); });
+        if (!more) break;
+        moved.push_back(cursor.key);
+        if (step % 2 == 0) {
+            ASSERT_TRUE(cache.Get(cursor.key, nullptr));
+        } else {
+            cache.Remove(cursor.key);
+        }
+    }
+    ASSERT_EQ(seen, cache.GetKeysOfQ(ARCQId::T1));
+    ASSERT_EQ(seen.size() + moved.size(), t1);
+
+    // a t2 hit links the entry of the cursor to the MRU end, it is
+    // visited there
+    seen.clear();
+    cursor = ARC<int, int>::QueueCursor();
+    for (int step = 0;; ++step) {
+        size_t budget = 3;
+        bool more = cache.ForEachInQFrom(
+            ARCQId::T2, &cursor, &budget,
+            [&](const int& k, const int&) { seen.push_back(k); });
+        if (!more) break;
+        if (step < 3) {
+            ASSERT_TRUE(cache.Get(cursor.key, nullptr));
+        }
+    }
+    ASSERT_EQ(seen, cache.GetKeysOfQ(ARCQId::T2));
+}
+
+struct BytePolicy : fengge::DefaultARCPolicy {
+    using Charge = fengge::ByteCharge;
+};
+using ByteARC = ARC<int, std::string, CacheTraits<int>,
+                    CacheTraits<std::string>, BytePolicy>;
+
+TEST(ARCByteChargeTest, evict_by_bytes) {
+    // every entry is charged sizeof(int) + value.size()
+    const size_t budget = 100;
+    ByteARC cache(budget);
+
+    for (int i = 0; i < 6; ++i) {
+        cache.Put(i, std::string(12, 'a' + i));
+    }
+    ASSERT_EQ(cache.Size(), 6);
+    ASSERT_EQ(cache.TotalCharge(), 96);
+
+    // a large value evicts as many LRU entries as needed
+    cache.Put(10, std::string(60, 'x'));
+    ASSERT_LE(cache.TotalCharge(), budget);
+    ASSERT_EQ(cache.Size(), 3);
+    ASSERT_TRUE(cache.Get(10, nullptr));
+    ASSERT_FALSE(cache.Get(0, nullptr));
+    ASSERT_TRUE(cache.Get(5, nullptr));
+
+    // a value larger than the budget is not cached
+    cache.Put(11, std::string(200, 'y'));
+    ASSERT_FALSE(cache.Get(11, nullptr));
+    ASSERT_LE(cache.TotalCharge(), budget);
+}
+
+TEST(ARCByteChargeTest, update_grows_value) {
+    const size_t budget = 100;
+    ByteARC cache(budget);
+
+    for (int i = 0; i < 4; ++i) {
+        cache.Put(i, std::string(16, 'a'));
+    }
+    ASSERT_EQ(cache.TotalCharge(), 80);
+
+    cache.Put(3, std::string(56, 'b'));
+    ASSERT_LE(cache.TotalCharge(), budget);
+    std::string v;
+    ASSERT_TRUE(cache.Get(3, &v));
+    ASSERT_EQ(v.size(), 56);
+
+    // an update that can never fit drops the entry
+    cache.Put(3, std::string(200, 'c'));
+    ASSERT_FALSE(cache.Get(3, nullptr));
+}
+
+TEST(ARCByteChargeTest, ghost_hit_keeps_budget) {
+    const size_t budget = 1000;
+    ByteARC cache(budget);
+    auto check = [&] {
+        ASSERT_LE(cache.TotalCharge(), budget);
+        size_t bytes = cache.ARCSize().TSize() * sizeof(int) +
+                       cache.ARCSize().BSize() * sizeof(int);
+        for (auto q : {ARCQId::T1, ARCQId::T2}) {
+            for (auto& v : cache.GetValuesOfQ(q)) bytes += v.size();
+        }
+        ASSERT_EQ(cache.CachedByteCount(), bytes);
+    };
+
+    // frequently used keys go to t2 and survive a scan of 40 * 46 bytes
+    for (int i = 0; i < 10; ++i) {
+        cache.Put(i, std::string(60, 'h'));
+        ASSERT_TRUE(cache.Get(i, nullptr));
+    }
+    for (int i = 100; i < 140; ++i) {
+        cache.Put(i, std::string(42, 's'));
+        check();
+    }
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(cache.Get(i, nullptr));
+    }
+
+    // a b1 ghost hit goes to t2 within the budget
+    auto b1 = cache.GetKeysOfQ(ARCQId::B1);
+    ASSERT_FALSE(b1.empty());
+    cache.Put(b1.back(), std::string(42, 's'));
+    check();
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2).back(), b1.back());
+}
+
+// counts the copies made of it, moves are free
+struct Tracked {
+    static int copies;
+    std::string data;
+
+    Tracked() = default;
+    explicit Tracked(size_t n, char c = 'x') : data(n, c) {}
+    Tracked(const Tracked& o) : data(o.data) { ++copies; }
+    Tracked(Tracked&&) = default;
+    Tracked& operator=(const Tracked& o) {
+        data = o.data;
+        ++copies;
+        return *this;
+    }
+    Tracked& operator=(Tracked&&) = default;
+};
+int Tracked::copies = 0;
+
+TEST(ARCMoveTest, put_moves_value) {
+    ARC<std::string, Tracked> cache(2);
+    Tracked::copies = 0;
+
+    // miss, resident update and ghost hit all move the value in
+    cache.Put("a", Tracked(100));
+    cache.Put("b", Tracked(100));
+    cache.Put(std::string("a"), Tracked(200));
+    cache.Emplace("c", 300, 'c');
+    cache.Emplace("d", 300, 'd');
+    auto b1 = cache.GetKeysOfQ(ARCQId::B1);
+    ASSERT_FALSE(b1.empty());
+    cache.Put(b1.back(), Tracked(10));
+    ASSERT_EQ(Tracked::copies, 0);
+
+    // copy Put still copies
+    Tracked t(5);
+    cache.Put("e", t);
+    ASSERT_EQ(Tracked::copies, 1);
+}
+
+TEST(ARCMoveTest, get_without_copy) {
+    ARC<int, Tracked> cache(4);
+    cache.Emplace(1, 1000, 'a');
+    Tracked::copies = 0;
+
+    const Tracked* p = cache.Get(1);
+    ASSERT_NE(p, nullptr);
+    ASSERT_EQ(p->data.size(), 1000);
+    ASSERT_EQ(cache.Get(2), nullptr);
+
+    size_t size = 0;
+    ASSERT_TRUE(cache.Get(1, [&](const Tracked& v) { size = v.data.size(); }));
+    ASSERT_EQ(size, 1000);
+    ASSERT_FALSE(cache.Get(2, [&](const Tracked&) { size = 0; }));
+    ASSERT_TRUE(cache.Peek(1, [&](const Tracked& v) { size = v.data[0]; }));
+    ASSERT_EQ(size, 'a');
+    ASSERT_EQ(Tracked::copies, 0);
+
+    // the pointer and visitor forms count like Get(key, &value)
+    ASSERT_EQ(cache.HitCount(), 2);
+    ASSERT_EQ(cache.MissCount(), 2);
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2).size(), 1);
+}
+
+using StringARC = ARC<int, std::string>;
+
+size_t ResidentBytes(const StringARC& cache) {
+    size_t bytes = (cache.ARCSize().TSize() + cache.ARCSize().BSize()) *
+                   sizeof(int);
+    for (auto q : {ARCQId::T1, ARCQId::T2}) {
+        for (auto& v : cache.GetValuesOfQ(q)) bytes += v.size();
+    }
+    return bytes;
+}
+
+TEST(ARCPinTest, pin_survives_eviction) {
+    StringARC cache(2);
+    cache.Put(1, "one");
+    cache.Put(2, "two");
+
+    StringARC::Handle* h = cache.Lookup(1);
+    ASSERT_NE(h, nullptr);
+    ASSERT_EQ(cache.Key(h), 1);
+    ASSERT_EQ(cache.Value(h), "one");
+    ASSERT_EQ(cache.Lookup(3), nullptr);
+    ASSERT_EQ(cache.HitCount(), 1);
+    ASSERT_EQ(cache.MissCount(), 1);
+
+    // 1 goes to a ghost list like an unpinned key, the callback gets a copy
+    std::vector<std::string> evicted;
+    auto cb = [&](const int&, std::string&& v) { evicted.push_back(v); };
+    ASSERT_TRUE(cache.Get(2, nullptr));
+    cache.Put(3, "three", cb);
+    ASSERT_FALSE(cache.Get(1, nullptr));
+    auto b2 = cache.GetKeysOfQ(ARCQId::B2);
+    ASSERT_EQ(b2.size(), 1);
+    ASSERT_EQ(b2.front(), 1);
+    ASSERT_EQ(cache.Value(h), "one");
+    ASSERT_NE(std::find(evicted.begin(), evicted.end(), "one"),
+              evicted.end());
+    ASSERT_EQ(cache.CachedByteCount(), ResidentBytes(cache));
+
+    // a ghost hit does not touch the pinned value
+    cache.Put(1, "uno");
+    std::string v;
+    ASSERT_TRUE(cache.Get(1, &v));
+    ASSERT_EQ(v, "uno");
+    ASSERT_EQ(cache.Value(h), "one");
+    cache.Release(h);
+    ASSERT_EQ(cache.CachedByteCount(), ResidentBytes(cache));
+}
+
+TEST(ARCPinTest, pin_survives_update_remove_clear) {
+    StringARC cache(4);
+    cache.Put(1, "one");
+
+    StringARC::Handle* h1 = cache.Lookup(1);
+    StringARC::Handle* h2 = cache.Lookup(1);
+    ASSERT_EQ(h1, h2);
+    cache.Put(1, "uno");
+    ASSERT_EQ(cache.Value(h1), "one");
+    ASSERT_EQ(cache.ARCSize().t2, 1);
+    ASSERT_EQ(cache.CachedByteCount(), ResidentBytes(cache));
+
+    StringARC::Handle* h3 = cache.Lookup(1);
+    ASSERT_EQ(cache.Value(h3), "uno");
+    cache.Remove(1);
+    ASSERT_FALSE(cache.Get(1, nullptr));
+    ASSERT_EQ(cache.CachedByteCount(), 0);
+    ASSERT_EQ(cache.Value(h3), "uno");
+
+    cache.Put(2, "two");
+    StringARC::Handle* h4 = cache.Lookup(2);
+    cache.Clear();
+    ASSERT_EQ(cache.Size(), 0);
+    ASSERT_EQ(cache.Value(h4), "two");
+
+    cache.Release(h1);
+    ASSERT_EQ(cache.Value(h2), "one");
+    cache.Release(h2);
+    cache.Release(h3);
+    cache.Release(h4);
+}
+
+TEST(ARCLoadTest, get_or_load) {
+    ARC<int, int> cache(4);
+    int calls = 0;
+    auto loader = [&](const int& k, int* v) {
+        calls++;
+        *v = k * 10;
+        return k >= 0;
+    };
+
+    int v = 0;
+    ASSERT_TRUE(cache.GetOrLoad(1, &v, loader));
+    ASSERT_EQ(v, 10);
+    ASSERT_TRUE(cache.GetOrLoad(1, &v, loader));
+    ASSERT_EQ(calls, 1);
+    ASSERT_EQ(cache.HitCount(), 1);
+    ASSERT_EQ(cache.MissCount(), 1);
+
+    // a failed load is not cached
+    ASSERT_FALSE(cache.GetOrLoad(-1, &v, loader));
+    ASSERT_FALSE(cache.GetOrLoad(-1, &v, loader));
+    ASSERT_EQ(cache.Size(), 1);
+
+    fengge::LoadStats stats = cache.GetLoadStats();
+    ASSERT_EQ(stats.loads, 3);
+    ASSERT_EQ(stats.load_failures, 2);
+    ASSERT_EQ(stats.coalesced, 0);
+    ASSERT_GE(stats.load_nanos, stats.max_load_nanos);
+}
+
+// a string key which counts how many times it is built
+struct CountedKey {
+    static int built;
+    std::string s;
+
+    explicit CountedKey(std::string_view v) : s(v) { ++built; }
+    CountedKey(const CountedKey& o) : s(o.s) { ++built; }
+    CountedKey(CountedKey&&) = default;
+    CountedKey& operator=(const CountedKey&) = default;
+};
+int CountedKey::built = 0;
+
+struct CountedKeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+        return fengge::StringHash()(s);
+    }
+    size_t operator()(const CountedKey& k) const { return (*this)(k.s); }
+};
+
+struct CountedKeyEqual {
+    using is_transparent = void;
+    bool operator()(const CountedKey& a, std::string_view b) const {
+        return a.s == b;
+    }
+    bool operator()(const CountedKey& a, const CountedKey& b) const {
+        return a.s == b.s;
+    }
+};
+
+struct CountedKeyPolicy : fengge::DefaultARCPolicy {
+    template <typename Key>
+    using Hash = CountedKeyHash;
+    template <typename Key>
+    using KeyEqual = CountedKeyEqual;
+};
+
+TEST(ARCKeyTest, heterogeneous_lookup) {
+    ARC<CountedKey, int, CacheTraits<CountedKey>, CacheTraits<int>,
+        CountedKeyPolicy> cache(2);
+    std::string_view a = "a";
+    CountedKey::built = 0;
+
+    // only inserting a new key builds a CountedKey
+    cache.Put(a, 1);
+    ASSERT_EQ(CountedKey::built, 1);
+    cache.Put(a, 2);
+    int v = 0;
+    ASSERT_TRUE(cache.Get(a, &v));
+    ASSERT_EQ(v, 2);
+    ASSERT_TRUE(cache.Peek(a, &v));
+    ASSERT_FALSE(cache.Get(std::string_view("b"), &v));
+    cache.Remove(std::string_view("b"));
+    ASSERT_EQ(CountedKey::built, 1);
+
+    // a precomputed hash is the same for every representation of the key
+    size_t hash = cache.HashOf(a);
+    ASSERT_EQ(hash, cache.HashOf(CountedKey(a)));
+    ASSERT_TRUE(cache.Get(a, hash, &v));
+    cache.Put(a, hash, 3);
+    ASSERT_TRUE(cache.Peek(a, hash, &v));
+    ASSERT_EQ(v, 3);
+    cache.Put(a, hash, 4, [](const CountedKey&, int&&) {});
+    auto* handle = cache.Lookup(a, hash);
+    ASSERT_NE(handle, nullptr);
+    ASSERT_EQ(cache.Value(handle), 4);
+    cache.Release(handle);
+    cache.Remove(a, hash);
+    ASSERT_FALSE(cache.Get(a, &v));
+}
+
+TEST(ARCKeyTest, string_key_policy) {
+    ARC<std::string, int, CacheTraits<std::string>, CacheTraits<int>,
+        fengge::StringKeyPolicy> cache(4);
+    std::string buffer = "key=abc;";
+    std::string_view key = std::string_view(buffer).substr(4, 3);
+
+    cache.Put(key, 1);
+    int v = 0;
+    ASSERT_TRUE(cache.Get("abc", &v));
+    ASSERT_EQ(v, 1);
+    ASSERT_TRUE(cache.Get(std::string("abc"), &v));
+    ASSERT_EQ(cache.HashOf(key), cache.HashOf(std::string("abc")));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2).front(), "abc");
+}
+
+template <typename Policy>
+struct FingerprintPolicy : Policy {
+    using Ghosts = fengge::FingerprintGhosts;
+};
+
+// Run the same operations on a cache with full key ghosts and one with
+// fingerprint ghosts. Without fingerprint collisions they only differ in
+// the keys of B1/B2 they can list and in the bytes of those keys.
+template <typename Full, typename Compact, typename MakeKey>
+static void assert_same_as_key_ghosts(size_t capacity, MakeKey make_key) {
+    Full full(capacity);
+    Compact compact(capacity);
+
+    for (int i = 0; i < 20000; ++i) {
+        auto k = make_key((i * 7919) % 300 + (i / 5000) * 50);
+        if (i % 3 == 0) {
+            ASSERT_EQ(full.Get(k, nullptr), compact.Get(k, nullptr));
+        } else if (i % 17 == 0) {
+            full.Remove(k);
+            compact.Remove(k);
+        } else {
+            std::string v(i % 13, 'v');
+            full.Put(k, v);
+            compact.Put(k, v);
+        }
+        auto a = full.ARCSize();
+        auto b = compact.ARCSize();
+        ASSERT_EQ(a.b1, b.b1);
+        ASSERT_EQ(a.t1, b.t1);
+        ASSERT_EQ(a.b2, b.b2);
+        ASSERT_EQ(a.t2, b.t2);
+        ASSERT_EQ(full.TotalCharge(), compact.TotalCharge());
+    }
+    ASSERT_EQ(full.HitCount(), compact.HitCount());
+    for (auto q : {ARCQId::T1, ARCQId::T2}) {
+        ASSERT_EQ(full.GetKeysOfQ(q), compact.GetKeysOfQ(q));
+        ASSERT_EQ(full.GetValuesOfQ(q), compact.GetValuesOfQ(q));
+    }
+    size_t ghost_bytes = 0;
+    for (auto q : {ARCQId::B1, ARCQId::B2}) {
+        ASSERT_TRUE(compact.GetKeysOfQ(q).empty());
+        for (auto& k : full.GetKeysOfQ(q)) {
+            using Key = std::decay_t<decltype(k)>;
+            ASSERT_FALSE(compact.Get(k, nullptr));
+            ghost_bytes += CacheTraits<Key>::CountBytes(k);
+        }
+    }
+    ASSERT_GT(ghost_bytes, 0);
+    ASSERT_EQ(full.CachedByteCount(), compact.CachedByteCount() + ghost_bytes);
+
+    full.Clear();
+    compact.Clear();
+    ASSERT_EQ(compact.ARCSize().BSize(), 0);
+    compact.Put(make_key(1), "one");
+    ASSERT_EQ(compact.GetKeysOfQ(ARCQId::T1).size(), 1);
+}
+
+TEST(ARCGhostTest, fingerprint_int_keys) {
+    using Full = ARC<int, std::string>;
+    using Compact = ARC<int, std::string, CacheTraits<int>,
+                        CacheTraits<std::string>,
+                        FingerprintPolicy<FlatPolicy>>;
+    assert_same_as_key_ghosts<Full, Compact>(100, [](int i) { return i; });
+}
+
+TEST(ARCGhostTest, fingerprint_string_keys_by_bytes) {
+    using Full = ARC<std::string, std::string, CacheTraits<std::string>,
+                     CacheTraits<std::string>, BytePolicy>;
+    using Compact = ARC<std::string, std::string, CacheTraits<std::string>,
+                        CacheTraits<std::string>,
+                        FingerprintPolicy<BytePolicy>>;
+    assert_same_as_key_ghosts<Full, Compact>(1000, [](int i) {
+        return "key-" + std::to_string(i);
+    });
+}
+
+static std::string snapshot_path(const char* name) {
+    return testing::TempDir() + name;
+}
+
+// A cache restored from a snapshot has the queues and p of the saved one
+// and behaves the same from there on.
+template <typename Cache, typename MakeKey>
+static void assert_snapshot_round_trip(size_t capacity, MakeKey make_key) {
+    Cache saved(capacity);
+    uint32_t x = 1;
+    auto step = [&](Cache* cache, int i) {
+        x = x * 1103515245 + 12345;
+        auto k = make_key((x >> 8) % (i % 2 ? capacity : capacity * 4));
+        if (i % 3 == 0)
+            cache->Get(k, nullptr);
+        else
+            cache->Put(k, std::string(i % 13, 'v'));
+    };
+    for (int i = 0; i < 20000; ++i) step(&saved, i);
+    std::string path = snapshot_path("round_trip.snap");
+    ASSERT_TRUE(saved.SaveSnapshot(path));
+
+    Cache restored(capacity);
+    restored.Put(make_key(0), "dropped");
+    ASSERT_TRUE(restored.LoadSnapshot(path));
+    ASSERT_EQ(restored.P(), saved.P());
+    ASSERT_EQ(restored.TotalCharge(), saved.TotalCharge());
+    ASSERT_EQ(restored.CachedByteCount(), saved.CachedByteCount());
+    for (auto q : {ARCQId::B1, ARCQId::T1, ARCQId::B2, ARCQId::T2}) {
+        ASSERT_EQ(restored.GetKeysOfQ(q), saved.GetKeysOfQ(q));
+        ASSERT_EQ(restored.GetValuesOfQ(q), saved.GetValuesOfQ(q));
+    }
+    ASSERT_GT(restored.ARCSize().b1 + restored.ARCSize().b2, 0);
+    ASSERT_EQ(restored.HitCount(), 0);
+
+    uint64_t hits = saved.HitCount();
+    uint32_t start = x;
+    for (int i = 0; i < 5000; ++i) step(&saved, i);
+    x = start;
+    for (int i = 0; i < 5000; ++i) step(&restored, i);
+    ASSERT_EQ(restored.HitCount(), saved.HitCount() - hits);
+    ASSERT_EQ(restored.P(), saved.P());
+    ASSERT_EQ(restored.ARCSize().b1, saved.ARCSize().b1);
+    ASSERT_EQ(restored.ARCSize().b2, saved.ARCSize().b2);
+    ASSERT_EQ(restored.GetKeysOfQ(ARCQId::T2), saved.GetKeysOfQ(ARCQId::T2));
+}
+
+TEST(ARCSnapshotTest, round_trip) {
+    assert_snapshot_round_trip<ARC<int, std::string>>(
+        100, [](int i) { return i; });
+}
+
+TEST(ARCSnapshotTest, round_trip_fingerprints) {
+    using Cache = ARC<int, std::string, CacheTraits<int>,
+                      CacheTraits<std::string>,
+                      FingerprintPolicy<FlatPolicy>>;
+    assert_snapshot_round_trip<Cache>(100, [](int i) { return i; });
+}
+
+TEST(ARCSnapshotTest, round_trip_string_keys_by_bytes) {
+    using Cache = ARC<std::string, std::string, CacheTraits<std::string>,
+                      CacheTraits<std::string>, BytePolicy>;
+    assert_snapshot_round_trip<Cache>(1000, [](int i) {
+        return "key-" + std::to_string(i);
+    });
+}
+
+TEST(ARCSnapshotTest, load_into_smaller_cache) {
+    ARC<int, int> saved(100);
+    for (int i = 0; i < 300; ++i) saved.Put(i, i);
+    for (int i = 250; i < 300; ++i) saved.Get(i, nullptr);
+    std::string path = snapshot_path("smaller.snap");
+    ASSERT_TRUE(saved.SaveSnapshot(path));
+
+    ARC<int, int> restored(10);
+    ASSERT_TRUE(restored.LoadSnapshot(path));
+    ASSERT_EQ(restored.Size(), 10);
+    auto size = restored.ARCSize();
+    ASSERT_LE(size.t1 + size.b1, 10);
+    ASSERT_LE(size.TSize() + size.BSize(), 20);
+    // the most recently used entries stay
+    std::vector<int> t2 = restored.GetKeysOfQ(ARCQId::T2);
+    ASSERT_FALSE(t2.empty());
+    ASSERT_EQ(t2.back(), 299);
+}
+
+TEST(ARCSnapshotTest, load_into_smaller_cache_by_bytes) {
+    ByteARC saved(1000);
+    // t2 full of 20 byte entries, the b1 hit on 1 sets p to 20
+    for (int i = 100; i < 150; ++i) {
+        saved.Put(i, std::string(16, 'h'));
+        saved.Get(i, nullptr);
+    }
+    saved.Put(1, std::string(16, 's'));
+    saved.Put(2, std::string(16, 's'));
+    saved.Put(1, std::string(16, 's'));
+    ASSERT_EQ(saved.P(), 20);
+    // a 204 byte entry, then new keys until it is a b1 ghost
+    saved.Put(0, std::string(200, 'l'));
+    auto in_b1 = [&] {
+        std::vector<int> b1 = saved.GetKeysOfQ(ARCQId::B1);
+        return std::find(b1.begin(), b1.end(), 0) != b1.end();
+    };
+    for (int i = 200; !in_b1(); ++i) saved.Put(i, std::string(16, 's'));
+    ASSERT_EQ(saved.P(), 20);
+    std::string path = snapshot_path("smaller_bytes.snap");
+    ASSERT_TRUE(saved.SaveSnapshot(path));
+
+    // the ghost above the capacity is dropped, p keeps its share
+    ByteARC restored(100);
+    ASSERT_TRUE(restored.LoadSnapshot(path));
+    ASSERT_LE(restored.TotalCharge(), 100);
+    ASSERT_GT(restored.Size(), 0);
+    for (auto q : {ARCQId::B1, ARCQId::B2}) {
+        std::vector<int> keys = restored.GetKeysOfQ(q);
+        ASSERT_EQ(std::find(keys.begin(), keys.end(), 0), keys.end());
+    }
+    ASSERT_EQ(restored.P(), 2);
+
+    // nothing fits a cache of capacity 0, the snapshot still loads
+    ByteARC empty(0);
+    ASSERT_TRUE(empty.LoadSnapshot(path));
+    ASSERT_EQ(empty.Size(), 0);
+    ASSERT_EQ(empty.ARCSize().BSize(), 0);
+    ASSERT_EQ(empty.P(), 0);
+}
+
+TEST(ARCSnapshotTest, rejects_bad_files) {
+    ARC<int, int> cache(10);
+    for (int i = 0; i < 30; ++i) cache.Put(i, i);
+    std::string path = snapshot_path("bad.snap");
+    ASSERT_TRUE(cache.SaveSnapshot(path));
+
+    // ghosts saved as keys do not load as fingerprints
+    ARC<int, int, CacheTraits<int>, CacheTraits<int>,
+        FingerprintPolicy<fengge::DefaultARCPolicy>> fp_cache(10);
+    ASSERT_FALSE(fp_cache.LoadSnapshot(path));
+
+    // truncated
+    std::string bytes;
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        ASSERT_NE(f, nullptr);
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) != 0) bytes.append(buf, n);
+        fclose(f);
+    }
+    FILE* f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    fwrite(bytes.data(), 1, bytes.size() - 1, f);
+    fclose(f);
+    ARC<int, int> restored(10);
+    restored.Put(1, 1);
+    ASSERT_FALSE(restored.LoadSnapshot(path));
+    ASSERT_EQ(restored.Size(), 0);
+    ASSERT_EQ(restored.ARCSize().BSize(), 0);
+    ASSERT_EQ(restored.CachedByteCount(), 0);
+
+    // a ghost charged 0, B1 follows T1 and T2
+    for (int i = 0; i < 5; ++i) cache.Get(i + 20, nullptr);
+    for (int i = 30; i < 40; ++i) cache.Put(i, i);
+    ASSERT_TRUE(cache.SaveSnapshot(path));
+    bytes.clear();
+    f = fopen(path.c_str(), "rb");
+    ASSERT_NE(f, nullptr);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) != 0) bytes.append(buf, n);
+    fclose(f);
+    fengge::detail::SnapshotHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    ASSERT_GT(header.count[2], 0);
+    ASSERT_TRUE(restored.LoadSnapshot(path));
+    size_t ghost = sizeof(header) +
+                   (header.count[0] + header.count[1]) * 2 * sizeof(int);
+    uint32_t zero = 0;
+    memcpy(&bytes[ghost], &zero, sizeof(zero));
+    f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+    ASSERT_FALSE(restored.LoadSnapshot(path));
+
+    // charges in bytes do not load as entry counts
+    ARC<int, int, CacheTraits<int>, CacheTraits<int>, BytePolicy> bytes_cache(
+        1000);
+    for (int i = 0; i < 300; ++i) bytes_cache.Put(i, i);
+    ASSERT_TRUE(bytes_cache.SaveSnapshot(path));
+    ASSERT_FALSE(restored.LoadSnapshot(path));
+
+    ASSERT_FALSE(restored.LoadSnapshot(snapshot_path("missing.snap")));
+    ASSERT_FALSE(cache.SaveSnapshot(snapshot_path("no/such/dir.snap")));
+}
+
+// Upstream resource counting what goes through it.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+    size_t allocs = 0;
+    size_t outstanding = 0;
+
+ private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        allocs++;
+        outstanding += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        outstanding -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+template <typename Cache>
+static void churn(Cache* cache, ARC<int, int>* ref, int ops, int seed) {
+    for (int i = 0; i < ops; ++i) {
+        int k = static_cast<int>((i * 7919u + seed) % 10000);
+        if (i % 4 == 0) {
+            int a = 0, b = 0;
+            ASSERT_EQ(cache->Get(k, &a), ref->Get(k, &b));
+            ASSERT_EQ(a, b);
+        } else {
+            cache->Put(k, i);
+            ref->Put(k, i);
+        }
+    }
+}
+
+TEST(ARCAllocTest, slab_pool_recycles_nodes) {
+    CountingResource upstream;
+    {
+        fengge::SlabPool pool(64 << 10, &upstream);
+        ARC<int, int, CacheTraits<int>, CacheTraits<int>, fengge::PmrPolicy>
+            cache(1000, &pool);
+        ARC<int, int> ref(1000);
+
+        churn(&cache, &ref, 50000, 1);
+        size_t slabs = pool.SlabCount();
+        size_t allocs = upstream.allocs;
+        ASSERT_GT(slabs, 0);
+        // nodes freed by evictions are reused by the following inserts
+        churn(&cache, &ref, 100000, 2);
+        ASSERT_EQ(pool.SlabCount(), slabs);
+        ASSERT_EQ(upstream.allocs, allocs);
+        ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2), ref.GetKeysOfQ(ARCQId::T2));
+    }
+    ASSERT_EQ(upstream.outstanding, 0);
+}
+
+struct FlatPmrPolicy : FlatPolicy {
+    template <typename T>
+    using Allocator = std::pmr::polymorphic_allocator<T>;
+};
+
+TEST(ARCAllocTest, flat_storage_memory_resource) {
+    CountingResource upstream;
+    {
+        ARC<int, int, CacheTraits<int>, CacheTraits<int>, FlatPmrPolicy>
+            cache(1000, &upstream);
+        ARC<int, int> ref(1000);
+        // the slots and the index are reserved by the constructor
+        size_t allocs = upstream.allocs;
+        ASSERT_GT(allocs, 0);
+        churn(&cache, &ref, 100000, 1);
+        ASSERT_EQ(upstream.allocs, allocs);
+    }
+    ASSERT_EQ(upstream.outstanding, 0);
+}
+
+TEST(ARCAllocTest, fingerprint_ghosts_memory_resource) {
+    CountingResource upstream;
+    {
+        std::pmr::polymorphic_allocator<char> alloc(&upstream);
+        fengge::detail::GhostTable<std::pmr::polymorphic_allocator<char>>
+            ghosts(alloc);
+        ghosts.Reserve(100);
+        size_t allocs = upstream.allocs;
+        ASSERT_GT(allocs, 0);
+        for (int i = 0; i < 100; ++i) ghosts.Push(i % 2, i * 7919u, 1);
+        ASSERT_EQ(upstream.allocs, allocs);
+
+        ARC<int, int, CacheTraits<int>, CacheTraits<int>,
+            FingerprintPolicy<fengge::PmrPolicy>> cache(1000, &upstream);
+        ARC<int, int> ref(1000);
+        churn(&cache, &ref, 100000, 1);
+        ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2), ref.GetKeysOfQ(ARCQId::T2));
+    }
+    ASSERT_EQ(upstream.outstanding, 0);
+}
+
+TEST(ARCAllocTest, static_storage_never_allocates) {
+    CountingResource upstream;
+    using Small = fengge::StaticARC<int, int, 32, CacheTraits<int>,
+                                    CacheTraits<int>, fengge::PmrPolicy>;
+    using Large = fengge::StaticARC<int, int, 1000, CacheTraits<int>,
+                                    CacheTraits<int>, fengge::PmrPolicy>;
+    // the allocators of the policy would draw from upstream
+    std::pmr::memory_resource* saved =
+        std::pmr::set_default_resource(&upstream);
+    // the control bytes of Small are scanned, Large chains its slots
+    auto small = std::make_unique<Small>();
+    auto large = std::make_unique<Large>();
+    ARC<int, int> small_ref(32);
+    ARC<int, int> large_ref(1000);
+
+    churn(small.get(), &small_ref, 50000, 1);
+    churn(large.get(), &large_ref, 100000, 2);
+    std::pmr::set_default_resource(saved);
+    ASSERT_EQ(upstream.allocs, 0);
+    for (auto q : {ARCQId::B1, ARCQId::T1, ARCQId::B2, ARCQId::T2}) {
+        ASSERT_EQ(small->GetKeysOfQ(q), small_ref.GetKeysOfQ(q));
+        ASSERT_EQ(large->GetKeysOfQ(q), large_ref.GetKeysOfQ(q));
+    }
+    ASSERT_EQ(small->P(), small_ref.P());
+    ASSERT_EQ(large->P(), large_ref.P());
+
+    // the capacity never exceeds N, even through ARC
+    ASSERT_EQ(Small(100).Capacity(), 32);
+    auto& base = static_cast<Small::ARC&>(*small);
+    base.SetCapacity(1000);
+    ASSERT_EQ(small->Capacity(), 32);
+    for (int i = 0; i < 1000; ++i) small->Put(i, i);
+    ASSERT_EQ(small->Size(), 32);
+
+    // a snapshot is loaded only if its entries fit the slots
+    std::string path = snapshot_path("static.snap");
+    ASSERT_TRUE(large_ref.SaveSnapshot(path));
+    ASSERT_FALSE(small->LoadSnapshot(path));
+    ASSERT_TRUE(large->LoadSnapshot(path));
+    ASSERT_EQ(large->GetKeysOfQ(ARCQId::T2), large_ref.GetKeysOfQ(ARCQId::T2));
+}
+
+TEST(ARCStatsTest, counts_events) {
+    ARC<int, int> cache(2);
+    cache.Put(1, 1);
+    cache.Put(2, 2);
+    cache.Get(1, nullptr);   // T1 hit
+    cache.Get(1, nullptr);   // T2 hit
+    cache.Put(3, 3);         // evicts 2 from T1 to B1
+    cache.Put(2, 2);         // B1 ghost hit, evicts 3 from T1
+    cache.Put(2, 4);         // update
+    cache.Remove(1);
+    cache.Get(7, nullptr);
+
+    auto s = cache.GetStats();
+    ASSERT_EQ(s.hits, 3);
+    ASSERT_EQ(s.misses, 1);
+    ASSERT_EQ(s.t1_hits, 1);
+    ASSERT_EQ(s.t2_hits, 1);
+    ASSERT_EQ(s.b1_ghost_hits, 1);
+    ASSERT_EQ(s.b2_ghost_hits, 0);
+    ASSERT_EQ(s.t1_evictions, 2);
+    ASSERT_EQ(s.t2_evictions, 0);
+    ASSERT_EQ(s.inserts, 4);
+    ASSERT_EQ(s.updates, 1);
+    ASSERT_EQ(s.removes, 1);
+    ASSERT_EQ(s.p, cache.P());
+
+    cache.Clear();
+    s = cache.GetStats();
+    ASSERT_EQ(s.inserts, 0);
+    ASSERT_EQ(s.hits, 0);
+}
+
+TEST(ARCStatsTest, counters_are_consistent) {
+    ARC<int, int> cache(100);
+    uint32_t x = 1;
+    for (int i = 0; i < 20000; ++i) {
+        // half of the keys from a hot set
+        x = x * 1103515245 + 12345;
+        int k = (x >> 8) % (i % 2 ? 150 : 1000);
+        if (i % 3 == 0)
+            cache.Get(k, nullptr);
+        else if (i % 11 == 0)
+            cache.Remove(k);
+        else
+            cache.Put(k, i);
+    }
+    auto s = cache.GetStats();
+    ASSERT_EQ(s.t1_hits + s.t2_hits + s.updates, s.hits);
+    ASSERT_EQ(s.inserts - s.t1_evictions - s.t2_evictions - s.removes,
+              cache.Size());
+    ASSERT_GT(s.b1_drops + s.b2_drops, 0);
+    ASSERT_GT(s.b1_ghost_hits + s.b2_ghost_hits, 0);
+    ASSERT_LE(s.min_p, s.p);
+    ASSERT_LE(s.p, s.max_p);
+    ASSERT_LE(s.max_p, cache.Capacity());
+}
+
+struct NoStatsPolicy : fengge::DefaultARCPolicy {
+    static constexpr bool kStats = false;
+};
+
+TEST(ARCStatsTest, compiled_out) {
+    ARC<int, int, CacheTraits<int>, CacheTraits<int>, NoStatsPolicy> cache(2);
+    for (int i = 0; i < 10; ++i) {
+        cache.Put(i % 3, i);
+        cache.Get(i % 4, nullptr);
+    }
+    auto s = cache.GetStats();
+    ASSERT_EQ(s.hits, cache.HitCount());
+    ASSERT_EQ(s.misses, cache.MissCount());
+    ASSERT_EQ(s.t1_hits + s.t2_hits + s.inserts + s.t1_evictions, 0);
+    ASSERT_EQ(s.min_p, s.p);
+}
+
+// Clock of the expiry tests, moved by hand.
+struct FakeClock {
+    typedef std::chrono::milliseconds duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<FakeClock> time_point;
+    static constexpr bool is_steady = true;
+
+    static time_point now() { return time_point(duration(now_ms)); }
+    static inline int64_t now_ms = 0;
+};
+
+struct TTLPolicy : fengge::DefaultARCPolicy {
+    using Expiry = fengge::WheelExpiry<FakeClock>;
+};
+
+using TTLARC = ARC<int, std::string, CacheTraits<int>,
+                   CacheTraits<std::string>, TTLPolicy>;
+
+TEST(ARCExpiryTest, put_with_ttl) {
+    using std::chrono::milliseconds;
+    FakeClock::now_ms = 1000;
+    TTLARC cache(10);
+    cache.Put(1, "a", milliseconds(10));
+    cache.Put(2, "b");
+    cache.Put(3, "c", milliseconds(10));
+    cache.Put(3, "c2");  // no ttl any more
+    cache.Put(4, "d", milliseconds(5));
+    cache.Put(4, "d2", milliseconds(50));
+    cache.Put(5, "e", milliseconds(0));
+    ASSERT_FALSE(cache.Peek(5, nullptr));
+
+    FakeClock::now_ms = 1009;
+    std::string v;
+    ASSERT_TRUE(cache.Get(1, &v));
+    ASSERT_EQ(v, "a");
+    FakeClock::now_ms = 1010;
+    // Peek does not reclaim, but never returns an expired value
+    ASSERT_FALSE(cache.Peek(1, &v));
+    ASSERT_EQ(cache.Size(), 4);
+    ASSERT_FALSE(cache.Get(1, &v));
+    ASSERT_EQ(cache.Size(), 3);
+    ASSERT_TRUE(cache.Get(3, &v));
+    ASSERT_TRUE(cache.Get(4, &v));
+
+    FakeClock::now_ms = 100000;
+    cache.Expire();
+    ASSERT_EQ(cache.Size(), 2);
+    ASSERT_TRUE(cache.Peek(2, nullptr));
+    ASSERT_TRUE(cache.Peek(3, nullptr));
+    auto s = cache.GetStats();
+    ASSERT_EQ(s.expirations, 3);
+    // expired entries leave no ghosts
+    ASSERT_EQ(cache.ARCSize().BSize(), 0);
+    cache.Put(1, "a");
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T1).back(), 1);
+    ASSERT_EQ(cache.GetStats().b1_ghost_hits, 0);
+}
+
+TEST(ARCExpiryTest, evicted_entries_drop_their_timer) {
+    using std::chrono::milliseconds;
+    FakeClock::now_ms = 0;
+    TTLARC cache(4);
+    for (int i = 0; i < 100; ++i) {
+        cache.Put(i, "v", milliseconds(10 + i));
+        cache.Get(i, nullptr);
+    }
+    FakeClock::now_ms = 10000;
+    cache.Expire();
+    ASSERT_EQ(cache.Size(), 0);
+    ASSERT_EQ(cache.GetStats().expirations, 4);
+    ASSERT_GT(cache.ARCSize().BSize(), 0);
+}
+
+// Entries expire exactly at their deadline whatever the mix of ttls, from
+// one tick to days, and the steps the clock takes.
+template <typename Cache>
+static void assert_expires_on_time() {
+    using std::chrono::milliseconds;
+    FakeClock::now_ms = 123456789;
+    Cache cache(5000);
+    std::map<int, int64_t> deadlines;
+    uint32_t x = 7;
+    auto next = [&x]() {
+        x = x * 1103515245 + 12345;
+        return x >> 4;
+    };
+    for (int round = 0; round < 200; ++round) {
+        for (int i = 0; i < 20; ++i) {
+            int k = next() % 4000;
+            int64_t ttl;
+            switch (next() % 4) {
+            case 0: ttl = 1 + next() % 64; break;
+            case 1: ttl = 1 + next() % 5000; break;
+            case 2: ttl = 1 + next() % 10000000; break;
+            default: ttl = int64_t(1) << (30 + next() % 10); break;
+            }
+            cache.Put(k, "v", milliseconds(ttl));
+            deadlines[k] = FakeClock::now_ms + ttl;
+        }
+        int64_t step;
+        switch (next() % 3) {
+        case 0: step = next() % 10; break;
+        case 1: step = next() % 100000; break;
+        default: step = next() % 50000000; break;
+        }
+        FakeClock::now_ms += step;
+        cache.Expire();
+        for (auto it = deadlines.begin(); it != deadlines.end();) {
+            bool live = it->second > FakeClock::now_ms;
+            ASSERT_EQ(cache.Peek(it->first, nullptr), live) << it->first;
+            it = live ? std::next(it) : deadlines.erase(it);
+        }
+        ASSERT_EQ(cache.Size(), deadlines.size());
+    }
+    ASSERT_GT(cache.GetStats().expirations, 1000);
+}
+
+TEST(ARCExpiryTest, wheel_matches_deadlines) {
+    assert_expires_on_time<TTLARC>();
+}
+
+struct FlatTTLPolicy : TTLPolicy {
+    using Storage = fengge::FlatStorage;
+};
+
+TEST(ARCExpiryTest, wheel_matches_deadlines_flat) {
+    assert_expires_on_time<ARC<int, std::string, CacheTraits<int>,
+                               CacheTraits<std::string>, FlatTTLPolicy>>();
+}
+
+TEST(ARCExpiryTest, snapshot_keeps_deadlines) {
+    using std::chrono::milliseconds;
+    FakeClock::now_ms = 5000;
+    TTLARC saved(10);
+    saved.Put(1, "a", milliseconds(100));
+    saved.Put(2, "b");
+    saved.Put(3, "c", std::chrono::hours(1));
+    std::string path = snapshot_path("ttl.snap");
+    ASSERT_TRUE(saved.SaveSnapshot(path));
+    StringARC plain(10);
+    ASSERT_FALSE(plain.LoadSnapshot(path));
+
+    FakeClock::now_ms = 999999;
+    TTLARC restored(10);
+    ASSERT_TRUE(restored.LoadSnapshot(path));
+    ASSERT_EQ(restored.Size(), 3);
+    FakeClock::now_ms += 100;
+    restored.Expire();
+    ASSERT_EQ(restored.Size(), 2);
+    ASSERT_FALSE(restored.Peek(1, nullptr));
+    FakeClock::now_ms += 3600 * 1000;
+    restored.Expire();
+    ASSERT_EQ(restored.GetKeysOfQ(ARCQId::T1), std::vector<int>{2});
+}
+
+static std::vector<int> evicted_by_function;
+static void record_eviction(const int& k, std::string&&) {
+    evicted_by_function.push_back(k);
+}
+
+TEST(ARCEvictionTest, callback_kinds) {
+    StringARC cache(2);
+    std::vector<int> evicted;
+    auto lambda = [&evicted](const int& k, std::string&&) {
+        evicted.push_back(k);
+    };
+    StringARC::EvictionCB function = lambda;
+    StringARC::EvictionCB empty;
+    void (*null_pointer)(const int&, std::string&&) = nullptr;
+
+    cache.Put(1, "a", lambda);
+    cache.Put(2, "b", lambda);
+    cache.Put(3, "c", lambda);
+    ASSERT_EQ(evicted, std::vector<int>{1});
+    cache.Put(4, "d", function);
+    ASSERT_EQ(evicted, (std::vector<int>{1, 2}));
+    cache.Put(5, "e", empty);
+    cache.Put(6, "f", null_pointer);
+    ASSERT_EQ(evicted.size(), 2);
+    cache.Put(7, std::string("g"), &record_eviction);
+    cache.Put(8, std::string("h"), record_eviction);
+    ASSERT_EQ(evicted_by_function, (std::vector<int>{5, 6}));
+}
+
+TEST(ARCEvictionTest, deferred_queue) {
+    StringARC cache(100);
+    fengge::EvictionQueue<int, std::string> queue(16);
+    std::vector<int> drained;
+    auto collect = [&drained](std::pair<int, std::string>& item) {
+        ASSERT_EQ(item.second, std::to_string(item.first));
+        drained.push_back(item.first);
+    };
+
+    for (int i = 0; i < 150; ++i) cache.Put(i, std::to_string(i), queue);
+    ASSERT_EQ(queue.Size(), 50);
+    ASSERT_EQ(queue.Drain(collect), 50);
+    ASSERT_EQ(queue.Size(), 0);
+    ASSERT_EQ(queue.Drain(collect), 0);
+    for (int i = 0; i < 50; ++i) ASSERT_EQ(drained[i], i);
+
+    // a background thread drains what the Puts evict
+    std::atomic<bool> stop{false};
+    size_t background = 0;
+    std::thread drainer([&] {
+        auto count = [&background](std::pair<int, std::string>&) {
+            background++;
+        };
+        while (!stop) {
+            queue.WaitAndDrain(count, std::chrono::milliseconds(1));
+        }
+        queue.Drain(count);
+    });
+    for (int i = 150; i < 10150; ++i)
+        cache.Put(i, std::to_string(i), queue);
+    stop = true;
+    drainer.join();
+    ASSERT_EQ(background, 10000);
+}
+
+// the ARC invariants against the effective capacity c
+template <typename Cache>
+void assert_fits(const Cache& cache, size_t c) {
+    auto s = cache.ARCSize();
+    ASSERT_LE(s.t1 + s.t2, c);
+    ASSERT_LE(s.t1 + s.b1, c);
+    ASSERT_LE(s.t1 + s.t2 + s.b1 + s.b2, 2 * c);
+    ASSERT_LE(cache.P(), c);
+}
+
+TEST(ARCResizeTest, grow) {
+    ARC<int, int> cache(100);
+    for (int i = 0; i < 300; ++i) {
+        cache.Put(i % 150, i);
+        cache.Get(i % 120, nullptr);
+    }
+    size_t p = cache.P();
+    cache.SetCapacity(200);
+    ASSERT_EQ(cache.Capacity(), 200);
+    ASSERT_EQ(cache.P(), p * 2);
+    ASSERT_EQ(cache.Size(), 100);
+    for (int i = 1000; i < 1100; ++i) cache.Put(i, i);
+    ASSERT_EQ(cache.Size(), 200);
+    assert_fits(cache, 200);
+}
+
+TEST(ARCResizeTest, shrink_incrementally) {
+    ARC<int, int> cache(1000);
+    for (int i = 0; i < 3000; ++i) {
+        cache.Put(i % 1500, i);
+        if (i % 2) cache.Get(i % 700, nullptr);
+    }
+    ASSERT_EQ(cache.Size(), 1000);
+    cache.SetCapacity(200);
+    ASSERT_EQ(cache.Capacity(), 200);
+    ASSERT_EQ(cache.Size(), 1000);
+
+    // every Put evicts a bounded number of entries beyond its own
+    uint64_t evictions = 0;
+    auto count = [&evictions](const int&, int&&) { evictions++; };
+    for (int i = 0; i < 10; ++i) {
+        uint64_t before = evictions;
+        cache.Put(10000 + i, i, count);
+        ASSERT_LE(evictions - before, 17);
+        ASSERT_GT(evictions - before, 0);
+    }
+    ASSERT_LT(cache.Size(), 1000);
+    ASSERT_GT(cache.Size(), 200);
+
+    // Trim() gets the rest of the way
+    int calls = 0;
+    while (!cache.Trim(100)) {
+        calls++;
+        assert_fits(cache, cache.Size() + 100);
+    }
+    ASSERT_LE(calls, 8);
+    ASSERT_EQ(cache.Size(), 200);
+    assert_fits(cache, 200);
+    ASSERT_TRUE(cache.Trim(100));
+
+    for (int i = 0; i < 1000; ++i) {
+        cache.Put(i, i);
+        cache.Get(i / 2, nullptr);
+        assert_fits(cache, 200);
+    }
+    ASSERT_EQ(cache.Size(), 200);
+}
+
+TEST(ARCResizeTest, shrink_by_charge) {
+    ByteARC cache(1 << 17);
+    for (int i = 0; i < 1000; ++i) cache.Put(i, std::string(100, 'x'));
+    size_t charge = cache.TotalCharge();
+    cache.SetCapacity(charge / 4);
+    while (!cache.Trim(10)) ASSERT_LE(cache.TotalCharge(), charge);
+    ASSERT_LE(cache.TotalCharge(), charge / 4);
+    ASSERT_GT(cache.Size(), 0);
+}
+
+TEST(ARCResizeTest, clear_applies_capacity) {
+    ARC<int, int> cache(100);
+    for (int i = 0; i < 100; ++i) cache.Put(i, i);
+    cache.SetCapacity(10);
+    cache.Clear();
+    ASSERT_TRUE(cache.Trim(0));
+    for (int i = 0; i < 100; ++i) cache.Put(i, i);
+    ASSERT_EQ(cache.Size(), 10);
+}
+
+TEST(ARCBudgetTest, moves_capacity_to_ghost_hits) {
+    // 8 bytes an entry, 2000 entries in total
+    fengge::CacheBudget budget(16000);
+    ARC<int, int> starved(1000);
+    ARC<int, int> idle(1000);
+    budget.Register(&starved, 8);
+    budget.Register(&idle, 8, 50);
+    ASSERT_EQ(budget.Used(), 16000);
+
+    auto read = [](ARC<int, int>* cache, int key) {
+        if (!cache->Get(key, nullptr)) cache->Put(key, key);
+    };
+    uint32_t x = 1;
+    // the hits of the starved cache in 20000 reads
+    auto run = [&] {
+        uint64_t hits = starved.HitCount();
+        for (int i = 0; i < 20000; ++i) {
+            // the starved cache has a working set of 1500 keys, the idle
+            // one of 20
+            x = x * 1103515245 + 12345;
+            read(&starved, (x >> 8) % 1500);
+            read(&idle, (x >> 8) % 20);
+        }
+        return starved.HitCount() - hits;
+    };
+    uint64_t hits_before = run();
+    uint64_t hits_after = 0;
+    for (int round = 0; round < 20; ++round) {
+        budget.Rebalance();
+        ASSERT_LE(budget.Used(), 16000);
+        hits_after = run();
+    }
+    ASSERT_GT(starved.Capacity(), 1400);
+    ASSERT_GE(idle.Capacity(), 50);
+    ASSERT_LT(idle.Capacity(), 600);
+    ASSERT_LE(starved.Capacity() + idle.Capacity(), 2000);
+    ASSERT_GE(starved.Capacity() + idle.Capacity(), 1990);
+    ASSERT_LT(hits_before, 15000);
+    ASSERT_GT(hits_after, 19000);
+
+    // a lower limit is shared in proportion, the idle cache keeps its floor
+    budget.SetLimit(8000);
+    budget.Rebalance();
+    ASSERT_LE(budget.Used(), 8000);
+    ASSERT_GE(idle.Capacity(), 50);
+
+    budget.Unregister(&starved);
+    budget.Rebalance();
+    ASSERT_EQ(idle.Capacity(), 1000);
+}
+
+struct TinyLFUPolicy : fengge::DefaultARCPolicy {
+    using Admission = fengge::TinyLFUAdmission;
+};
+using TinyLFUARC = ARC<int, int, CacheTraits<int>, CacheTraits<int>,
+                       TinyLFUPolicy>;
+
+TEST(ARCAdmissionTest, frequency_sketch) {
+    fengge::detail::FrequencySketch sketch;
+    sketch.EnsureCapacity(1024);
+    uint64_t hot = 0x123456789abcdefULL;
+    ASSERT_EQ(sketch.Frequency(hot), 0);
+    for (int i = 1; i <= 5; ++i) {
+        sketch.Increment(hot);
+        ASSERT_EQ(sketch.Frequency(hot), i);
+    }
+    for (int i = 0; i < 20; ++i) sketch.Increment(hot);
+    ASSERT_EQ(sketch.Frequency(hot), 16);
+
+    // aging halves the counters and clears the doorkeeper
+    uint64_t x = 1;
+    for (int i = 0; i < 10 * 1024; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        sketch.Increment(x);
+    }
+    ASSERT_LE(sketch.Frequency(hot), 8);
+    ASSERT_GE(sketch.Frequency(hot), 7);
+}
+
+// T1 residents requested a few times before they were cached, then a
+// one-time scan three times the size of the cache, read through
+template <typename Cache>
+int t1_residents_after_scan(Cache* cache) {
+    for (int k = 0; k < 1000; ++k) {
+        for (int i = 0; i < 3; ++i) cache->Get(k, nullptr);
+        cache->Put(k, k);
+    }
+    for (int k = 0; k < 3000; ++k) {
+        if (!cache->Get(1000000 + k, nullptr)) cache->Put(1000000 + k, k);
+    }
+    int hits = 0;
+    for (int k = 0; k < 1000; ++k) hits += cache->Get(k, nullptr) ? 1 : 0;
+    return hits;
+}
+
+TEST(ARCAdmissionTest, scan_resistance) {
+    ARC<int, int> plain(1000);
+    TinyLFUARC filtered(1000);
+    ASSERT_EQ(t1_residents_after_scan(&plain), 0);
+    ASSERT_GT(t1_residents_after_scan(&filtered), 950);
+    auto s = filtered.GetStats();
+    ASSERT_GT(s.rejections, 2900);
+    ASSERT_EQ(s.inserts - s.t1_evictions - s.t2_evictions, filtered.Size());
+}
+
+TEST(ARCAdmissionTest, ghost_hits_bypass_the_filter) {
+    TinyLFUARC cache(4);
+    for (int k = 1; k <= 4; ++k) cache.Put(k, k);
+    for (int i = 0; i < 5; ++i)
+        for (int k = 2; k <= 4; ++k) cache.Get(k, nullptr);
+
+    // 5 is not more frequent than 1, the T1 victim, until its second Put
+    cache.Put(5, 5);
+    ASSERT_FALSE(cache.Get(5, nullptr));
+    ASSERT_EQ(cache.GetStats().rejections, 1);
+    cache.Put(5, 5);
+    ASSERT_TRUE(cache.Get(5, nullptr));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::B1), std::vector<int>({1}));
+
+    // 1 is rarer than any resident key but comes back from B1
+    cache.Put(1, 1);
+    ASSERT_TRUE(cache.Get(1, nullptr));
+    ASSERT_EQ(cache.GetStats().b1_ghost_hits, 1);
+    ASSERT_EQ(cache.GetStats().rejections, 1);
+}
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+#include <fengge/car.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using fengge::ARC;
+using fengge::ARCQId;
+using fengge::CAR;
+
+TEST(CARTest, clock_hands) {
+    CAR<int, int> cache(4);
+    for (int i = 1; i <= 4; ++i) cache.Put(i, i);
+    cache.Get(1, nullptr);
+    cache.Get(2, nullptr);
+
+    // the T1 hand moves the referenced 1 and 2 to T2 and evicts 3
+    cache.Put(5, 5);
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T1), std::vector<int>({4, 5}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2), std::vector<int>({1, 2}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::B1), std::vector<int>({3}));
+    ASSERT_EQ(cache.P(), 0);
+
+    // a B1 hit evicts 4 and grows p
+    cache.Put(3, 30);
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T1), std::vector<int>({5}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2), std::vector<int>({1, 2, 3}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::B1), std::vector<int>({4}));
+    ASSERT_EQ(cache.P(), 1);
+    int v = 0;
+    ASSERT_TRUE(cache.Get(3, &v));
+    ASSERT_EQ(v, 30);
+
+    // p is 1, the T1 hand still evicts 5
+    cache.Put(6, 6);
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T1), std::vector<int>({6}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::B1), std::vector<int>({4, 5}));
+    cache.Put(4, 40);
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T1), std::vector<int>());
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2), std::vector<int>({1, 2, 3, 4}));
+    ASSERT_EQ(cache.P(), 2);
+
+    // T1 is below p, the T2 hand gives 1 a second chance and evicts 2
+    cache.Get(1, nullptr);
+    cache.Put(7, 7);
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T1), std::vector<int>({7}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::T2), std::vector<int>({3, 4, 1}));
+    ASSERT_EQ(cache.GetKeysOfQ(ARCQId::B2), std::vector<int>({2}));
+    ASSERT_FALSE(cache.Get(2, nullptr));
+    ASSERT_EQ(cache.Size(), 4);
+
+    cache.Remove(2);
+    cache.Remove(1);
+    ASSERT_EQ(cache.Size(), 3);
+    ASSERT_EQ(cache.ARCSize().b2, 0);
+    cache.Clear();
+    ASSERT_EQ(cache.Size(), 0);
+    ASSERT_EQ(cache.HitCount(), 0);
+}
+
+template <typename Cache>
+void assert_car_invariants() {
+    const size_t c = 100;
+    Cache cache(c);
+    uint32_t x = 1;
+    for (int i = 0; i < 50000; ++i) {
+        x = x * 1103515245 + 12345;
+        int k = (x >> 8) % (i % 2 ? 150 : 1000);
+        int v;
+        if (i % 7 == 0) {
+            cache.Remove(k);
+        } else if (cache.Get(k, &v)) {
+            ASSERT_EQ(v, k * 3);
+        } else {
+            cache.Put(k, k * 3);
+        }
+        auto s = cache.ARCSize();
+        ASSERT_LE(s.t1 + s.t2, c);
+        ASSERT_LE(s.t1 + s.b1, c);
+        ASSERT_LE(s.t1 + s.t2 + s.b1 + s.b2, 2 * c);
+        ASSERT_LE(cache.P(), c);
+    }
+    ASSERT_GT(cache.HitCount(), 0);
+}
+
+struct FlatPolicy : fengge::DefaultARCPolicy {
+    using Storage = fengge::FlatStorage;
+};
+
+TEST(CARTest, invariants) {
+    assert_car_invariants<CAR<int, int>>();
+    assert_car_invariants<CAR<int, int, fengge::CacheTraits<int>,
+                              fengge::CacheTraits<int>, FlatPolicy>>();
+}
+
+// CAR approximates ARC: close hit ratios on a skewed trace with a scan
+TEST(CARTest, hit_ratio_close_to_arc) {
+    ARC<int, int> arc(1000);
+    CAR<int, int> car(1000);
+    uint64_t arc_hits = 0, car_hits = 0;
+    uint32_t x = 7;
+    int scan = 1 << 20;
+    for (int i = 0; i < 200000; ++i) {
+        x = x * 1103515245 + 12345;
+        // squaring skews the keys towards 0
+        uint64_t r = (x >> 8) % 4096;
+        int k = i % 5 == 0 ? scan++ : static_cast<int>(r * r / 4096);
+        if (arc.Get(k, nullptr))
+            arc_hits++;
+        else
+            arc.Put(k, k);
+        if (car.Get(k, nullptr))
+            car_hits++;
+        else
+            car.Put(k, k);
+    }
+    ASSERT_GT(car_hits, arc_hits * 95 / 100);
+    ASSERT_LT(car_hits, arc_hits * 105 / 100);
+}
+
+TEST(CARTest, shared_readers) {
+    CAR<int, std::string> cache(64);
+    std::shared_mutex mu;
+    for (int i = 0; i < 64; ++i) cache.Put(i, std::to_string(i));
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&, t] {
+            std::string v;
+            for (int i = 0; !stop; ++i) {
+                int k = (i * 7 + t) % 128;
+                std::shared_lock<std::shared_mutex> guard(mu);
+                if (cache.SharedGet(k, &v)) {
+                    ASSERT_EQ(v, std::to_string(k));
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 2000; ++i) {
+        std::lock_guard<std::shared_mutex> guard(mu);
+        cache.Put(i % 128, std::to_string(i % 128));
+    }
+    stop = true;
+    for (auto& r : readers) r.join();
+    ASSERT_EQ(cache.Size(), 64);
+}
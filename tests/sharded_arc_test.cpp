@@ -0,0 +1,364 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/sharded_arc.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using fengge::ShardedARC;
+
+TEST(ShardedARCTest, cache_create) {
+    ShardedARC<int, int> cache(100, 8);
+
+    ASSERT_EQ(cache.ShardCount(), 8);
+    ASSERT_EQ(cache.Capacity(), 100);
+    ASSERT_EQ(cache.Size(), 0);
+    ASSERT_EQ(cache.HitCount(), 0);
+    ASSERT_EQ(cache.MissCount(), 0);
+
+    // no empty shards
+    ShardedARC<int, int> small(3, 8);
+    ASSERT_EQ(small.ShardCount(), 2);
+    ASSERT_EQ(small.Capacity(), 3);
+}
+
+TEST(ShardedARCTest, cache_aggregate) {
+    const int maxCount = 64;
+    ShardedARC<int, int> cache(maxCount * 4, 4);
+
+    for (int i = 0; i < maxCount; ++i) {
+        cache.Put(i, i);
+    }
+    for (int i = 0; i < maxCount; ++i) {
+        int v;
+        ASSERT_TRUE(cache.Get(i, &v));
+        ASSERT_EQ(i, v);
+    }
+    ASSERT_FALSE(cache.Get(maxCount, nullptr));
+
+    auto size = cache.ARCSize();
+    ASSERT_EQ(size.TSize(), maxCount);
+    ASSERT_EQ(size.t2, maxCount);
+    ASSERT_EQ(cache.Size(), maxCount);
+    ASSERT_EQ(cache.HitCount(), maxCount);
+    ASSERT_EQ(cache.MissCount(), 1);
+    ASSERT_EQ(cache.CachedByteCount(), maxCount * 2 * sizeof(int));
+
+    auto stats = cache.GetStats();
+    ASSERT_EQ(stats.inserts, maxCount);
+    ASSERT_EQ(stats.t1_hits, maxCount);
+    ASSERT_EQ(stats.hits, maxCount);
+    ASSERT_EQ(stats.misses, 1);
+
+    cache.Remove(0);
+    ASSERT_FALSE(cache.Get(0, nullptr));
+    ASSERT_EQ(cache.GetStats().removes, 1);
+    cache.Clear();
+    ASSERT_EQ(cache.Size(), 0);
+}
+
+TEST(ShardedARCTest, cache_concurrent) {
+    const int maxCount = 1000;
+    const int threads = 4;
+    ShardedARC<int, int> cache(maxCount, 8);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, t] {
+            for (int i = 0; i < 20000; ++i) {
+                int k = (i * 31 + t) % (maxCount * 2);
+                int v;
+                if (cache.Get(k, &v)) {
+                    ASSERT_EQ(k, v);
+                } else {
+                    cache.Put(k, k);
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    ASSERT_LE(cache.Size(), maxCount);
+    // a Put racing with another thread's Put of the same key counts a hit
+    ASSERT_GE(cache.HitCount() + cache.MissCount(), threads * 20000);
+}
+
+TEST(ShardedARCTest, buffered_reads) {
+    fengge::ShardedARCOptions options;
+    options.num_shards = 1;
+    options.buffered_reads = true;
+    ShardedARC<int, int> cache(10, options);
+
+    for (int i = 0; i < 5; ++i) {
+        cache.Put(i, i);
+    }
+    for (int i = 0; i < 3; ++i) {
+        int v;
+        ASSERT_TRUE(cache.Get(i, &v));
+        ASSERT_EQ(i, v);
+    }
+    ASSERT_FALSE(cache.Get(5, nullptr));
+    ASSERT_EQ(cache.HitCount(), 3);
+    ASSERT_EQ(cache.MissCount(), 1);
+
+    // the promotions are not applied until the buffers are drained
+    ASSERT_EQ(cache.ARCSize().t2, 0);
+    cache.DrainReadBuffers();
+    ASSERT_EQ(cache.ARCSize().t1, 2);
+    ASSERT_EQ(cache.ARCSize().t2, 3);
+
+    // writes drain first
+    ASSERT_TRUE(cache.Get(3, nullptr));
+    cache.Put(6, 6);
+    ASSERT_EQ(cache.ARCSize().t2, 4);
+}
+
+TEST(ShardedARCTest, move_and_visit) {
+    for (bool buffered : {false, true}) {
+        fengge::ShardedARCOptions options;
+        options.num_shards = 4;
+        options.buffered_reads = buffered;
+        ShardedARC<int, std::string> cache(16, options);
+
+        std::string v(1000, 'a');
+        cache.Put(1, std::move(v));
+        cache.Emplace(2, 500, 'b');
+        size_t size = 0;
+        ASSERT_TRUE(cache.Get(1, [&](const std::string& s) {
+            size = s.size();
+        }));
+        ASSERT_EQ(size, 1000);
+        ASSERT_TRUE(cache.Get(2, [&](const std::string& s) {
+            size = s.size();
+        }));
+        ASSERT_EQ(size, 500);
+        ASSERT_FALSE(cache.Get(3, [&](const std::string&) { size = 0; }));
+        ASSERT_EQ(cache.HitCount(), 2);
+        ASSERT_EQ(cache.MissCount(), 1);
+    }
+}
+
+TEST(ShardedARCTest, buffered_reads_concurrent) {
+    const int maxCount = 1000;
+    const int threads = 4;
+    fengge::ShardedARCOptions options;
+    options.num_shards = 4;
+    options.buffered_reads = true;
+    ShardedARC<int, int> cache(maxCount, options);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, t] {
+            for (int i = 0; i < 20000; ++i) {
+                int k = (i * 31 + t) % (maxCount * 2);
+                int v;
+                if (cache.Get(k, &v)) {
+                    ASSERT_EQ(k, v);
+                } else {
+                    cache.Put(k, k);
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    cache.DrainReadBuffers();
+
+    ASSERT_LE(cache.Size(), maxCount);
+    // a Put racing with another thread's Put of the same key counts a hit
+    ASSERT_GE(cache.HitCount() + cache.MissCount(), threads * 20000);
+}
+
+TEST(ShardedARCTest, buffered_reads_promote_without_writes) {
+    const int keys = 500;
+    const int threads = 8;
+    fengge::ShardedARCOptions options;
+    options.num_shards = 1;
+    options.buffered_reads = true;
+    ShardedARC<int, int> cache(1000, options);
+    for (int i = 0; i < keys; ++i) cache.Put(i, i);
+
+    // readers alone keep the shared lock busy, full stripes still drain
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, t] {
+            for (int i = 0; i < keys * 20; ++i) {
+                int k = (i + t * 61) % keys;
+                int v;
+                ASSERT_TRUE(cache.Get(k, &v));
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    ASSERT_EQ(cache.ARCSize().t1, 0);
+    ASSERT_EQ(cache.ARCSize().t2, keys);
+}
+
+TEST(ShardedARCTest, get_or_load_single_flight) {
+    const int threads = 8;
+    ShardedARC<int, int> cache(100, 4);
+    std::atomic<int> arrived{0};
+    std::atomic<int> calls{0};
+    std::atomic<bool> fail{true};
+    auto loader = [&](const int& k, int* v) {
+        calls++;
+        // let every caller miss and find this load in flight
+        while (arrived < threads) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        *v = k + 1;
+        return !fail;
+    };
+
+    for (bool failing : {true, false}) {
+        fail = failing;
+        arrived = 0;
+        calls = 0;
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&] {
+                arrived++;
+                int v = 0;
+                bool ok = cache.GetOrLoad(7, &v, loader);
+                ASSERT_EQ(ok, !failing);
+                if (ok) {
+                    ASSERT_EQ(v, 8);
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        // a caller delayed past a failed load starts its own
+        if (!failing) {
+            ASSERT_EQ(calls, 1);
+        }
+        ASSERT_EQ(cache.Size(), failing ? 0 : 1);
+    }
+
+    fengge::LoadStats stats = cache.GetLoadStats();
+    ASSERT_GE(stats.loads, 2);
+    ASSERT_EQ(stats.load_failures, stats.loads - 1);
+    ASSERT_LE(stats.coalesced, 2 * (threads - 1));
+    ASSERT_GE(stats.max_load_nanos, 20 * 1000 * 1000);
+}
+
+TEST(ShardedARCTest, string_view_keys) {
+    for (bool buffered : {false, true}) {
+        fengge::ShardedARCOptions options;
+        options.num_shards = 4;
+        options.buffered_reads = buffered;
+        ShardedARC<std::string, int, fengge::CacheTraits<std::string>,
+                   fengge::CacheTraits<int>, fengge::StringKeyPolicy>
+            cache(64, options);
+
+        for (int i = 0; i < 32; ++i) {
+            std::string key = "key" + std::to_string(i);
+            cache.Put(std::string_view(key), i);
+        }
+        for (int i = 0; i < 32; ++i) {
+            std::string key = "key" + std::to_string(i);
+            std::string_view view = key;
+            int v = -1;
+            ASSERT_TRUE(cache.Get(view, cache.HashOf(view), &v));
+            ASSERT_EQ(v, i);
+        }
+        cache.Remove(std::string_view("key0"));
+        ASSERT_FALSE(cache.Get("key0", nullptr));
+        ASSERT_EQ(cache.Size(), 31);
+    }
+}
+
+TEST(ShardedARCTest, ttl) {
+    struct TTLPolicy : fengge::DefaultARCPolicy {
+        using Expiry = fengge::WheelExpiry<>;
+    };
+    fengge::ShardedARCOptions options;
+    options.num_shards = 4;
+    options.buffered_reads = true;
+    ShardedARC<int, int, fengge::CacheTraits<int>, fengge::CacheTraits<int>,
+               TTLPolicy> cache(64, options);
+
+    for (int i = 0; i < 32; ++i)
+        cache.Put(i, i, std::chrono::hours(i % 2 ? 1 : 0));
+    cache.Expire();
+    ASSERT_EQ(cache.Size(), 16);
+    ASSERT_EQ(cache.GetStats().expirations, 16);
+    ASSERT_FALSE(cache.Get(0, nullptr));
+    ASSERT_TRUE(cache.Get(1, nullptr));
+}
+
+TEST(ShardedARCTest, set_capacity) {
+    fengge::ShardedARCOptions options;
+    options.num_shards = 4;
+    ShardedARC<int, int> cache(400, options);
+    for (int i = 0; i < 400; ++i) cache.Put(i, i);
+    size_t size = cache.Size();
+
+    cache.SetCapacity(802);
+    ASSERT_EQ(cache.Capacity(), 802);
+    ASSERT_EQ(cache.Size(), size);
+
+    cache.SetCapacity(101);
+    ASSERT_EQ(cache.Capacity(), 101);
+    while (!cache.Trim(16)) {}
+    ASSERT_LE(cache.Size(), 101);
+    for (int i = 0; i < 1000; ++i) cache.Put(i, i);
+    ASSERT_LE(cache.Size(), 101);
+}
+
+TEST(ShardedARCTest, scan) {
+    ShardedARC<int, int> cache(8000, 16);
+    for (int i = 0; i < 1000; ++i) cache.Put(i, i);
+    for (int i = 0; i < 1000; i += 3) cache.Get(i, nullptr);
+
+    // other keys come in meanwhile, no entry is evicted or moved
+    std::atomic<bool> stop{false};
+    std::thread writer([&] {
+        for (int i = 1000; i < 3000 && !stop; ++i) cache.Put(i, i);
+    });
+    std::vector<int> seen(1000);
+    decltype(cache)::ScanCursor cursor;
+    size_t chunks = 0;
+    bool more = true;
+    while (more) {
+        size_t n = 0;
+        more = cache.Scan(&cursor, 7, [&](const int& k, const int& v) {
+            ASSERT_EQ(k, v);
+            if (k < 1000) seen[k]++;
+            n++;
+        });
+        ASSERT_LE(n, 7);
+        chunks++;
+    }
+    stop = true;
+    writer.join();
+    for (int i = 0; i < 1000; ++i) ASSERT_EQ(seen[i], 1) << i;
+    ASSERT_GE(chunks, 1000 / 7);
+
+    // hits move entries to the MRU end of T2 meanwhile, none is missed
+    std::thread reader([&] {
+        for (int i = 0; i < 20000; ++i) cache.Get(i % 1000, nullptr);
+    });
+    std::fill(seen.begin(), seen.end(), 0);
+    cursor = decltype(cache)::ScanCursor();
+    while (cache.Scan(&cursor, 7, [&](const int& k, const int&) {
+        if (k < 1000) seen[k]++;
+    })) {}
+    reader.join();
+    for (int i = 0; i < 1000; ++i) ASSERT_GE(seen[i], 1) << i;
+}
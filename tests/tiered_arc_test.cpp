@@ -0,0 +1,163 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/tiered_arc.h>
+#include <gtest/gtest.h>
+#include <string>
+
+using fengge::TieredARC;
+
+typedef TieredARC<int, std::string> StringTieredARC;
+
+static fengge::TierOptions tier_options(const char* name, size_t capacity,
+                                        size_t batch) {
+    fengge::TierOptions options;
+    options.path = testing::TempDir() + name;
+    options.capacity = capacity;
+    options.batch = batch;
+    // wait for the writer, nothing is dropped
+    options.backlog = 0;
+    return options;
+}
+
+static std::string value_of(int i) {
+    return "value" + std::to_string(i) + std::string(i % 50, 'x');
+}
+
+TEST(TieredARCTest, spills_and_promotes) {
+    StringTieredARC cache(100);
+    ASSERT_TRUE(cache.Open(tier_options("spill.log", 1 << 20, 4096)));
+    for (int i = 0; i < 1000; ++i) cache.Put(i, value_of(i));
+    ASSERT_EQ(cache.Size(), 100);
+    ASSERT_EQ(cache.TierSize(), 900);
+    ASSERT_EQ(cache.GetTierStats().spills, 900);
+
+    // the last batch is still buffered, the others are on disk
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            std::string v;
+            ASSERT_TRUE(cache.Get(i, &v));
+            ASSERT_EQ(v, value_of(i));
+        }
+        cache.Flush();
+    }
+    auto s = cache.GetTierStats();
+    ASSERT_GE(s.hits, 1800);
+    ASSERT_EQ(s.misses, 0);
+    ASSERT_EQ(s.reclaimed, 0);
+    ASSERT_EQ(s.write_errors, 0);
+    ASSERT_EQ(cache.Size() + cache.TierSize(), 1000);
+
+    ASSERT_FALSE(cache.Get(1000, nullptr));
+    ASSERT_EQ(cache.GetTierStats().misses, 1);
+}
+
+TEST(TieredARCTest, promotion_is_a_ghost_hit) {
+    StringTieredARC cache(4);
+    ASSERT_TRUE(cache.Open(tier_options("ghost.log", 1 << 16, 256)));
+    for (int i = 0; i < 4; ++i) {
+        cache.Put(i, value_of(i));
+        cache.Get(i, nullptr);
+    }
+    // 0 and 1 leave T2 for B2 and the log
+    cache.Put(4, value_of(4));
+    cache.Put(5, value_of(5));
+    ASSERT_EQ(cache.TierSize(), 2);
+    ASSERT_EQ(cache.GetStats().b2_ghost_hits, 0);
+
+    std::string v;
+    ASSERT_TRUE(cache.Get(0, &v));
+    ASSERT_EQ(v, value_of(0));
+    ASSERT_EQ(cache.GetStats().b2_ghost_hits, 1);
+    ASSERT_EQ(cache.GetTierStats().hits, 1);
+}
+
+TEST(TieredARCTest, stale_records_are_dropped) {
+    StringTieredARC cache(2);
+    ASSERT_TRUE(cache.Open(tier_options("stale.log", 1 << 16, 256)));
+    cache.Put(1, "old");
+    cache.Put(2, value_of(2));
+    cache.Put(3, value_of(3));
+    ASSERT_EQ(cache.TierSize(), 1);
+
+    // a Put replaces the record, the new value is evicted in turn
+    cache.Put(1, "new");
+    ASSERT_EQ(cache.TierSize(), 1);
+    cache.Put(4, value_of(4));
+    cache.Put(5, value_of(5));
+    cache.Flush();
+    std::string v;
+    ASSERT_TRUE(cache.Get(1, &v));
+    ASSERT_EQ(v, "new");
+
+    cache.Put(6, value_of(6));
+    cache.Put(7, value_of(7));
+    cache.Remove(1);
+    ASSERT_FALSE(cache.Get(1, &v));
+}
+
+TEST(TieredARCTest, log_wraps_around) {
+    // 1000 records of 60 to 110 bytes in a 16KiB ring
+    StringTieredARC cache(10);
+    ASSERT_TRUE(cache.Open(tier_options("ring.log", 1 << 14, 512)));
+    for (int i = 0; i < 1000; ++i) cache.Put(i, value_of(i));
+    auto s = cache.GetTierStats();
+    ASSERT_EQ(s.spills, 990);
+    ASSERT_GT(s.reclaimed, 500);
+    ASSERT_EQ(cache.TierSize(), 990 - s.reclaimed);
+
+    // the newest records are readable, buffered or not, the oldest are gone
+    std::string v;
+    ASSERT_FALSE(cache.Get(0, &v));
+    for (int i = 989; i >= 900; --i) {
+        ASSERT_TRUE(cache.Get(i, &v));
+        ASSERT_EQ(v, value_of(i));
+    }
+}
+
+TEST(TieredARCTest, backlog_drops_instead_of_waiting) {
+    StringTieredARC cache(10);
+    auto options = tier_options("backlog.log", 1 << 20, 256);
+    options.backlog = 1024;
+    ASSERT_TRUE(cache.Open(options));
+    for (int i = 0; i < 5000; ++i) cache.Put(i, value_of(i));
+    cache.Flush();
+    auto s = cache.GetTierStats();
+    ASSERT_EQ(s.spills + s.dropped, 4990);
+    ASSERT_EQ(cache.TierSize(), s.spills - s.reclaimed);
+
+    // what was written is read back, what was dropped is a miss
+    uint64_t hits = 0;
+    for (int i = 0; i < 4990; ++i) {
+        std::string v;
+        if (cache.Get(i, &v)) {
+            ASSERT_EQ(v, value_of(i));
+            hits++;
+        }
+    }
+    ASSERT_EQ(cache.GetTierStats().hits, s.spills - s.reclaimed);
+    ASSERT_LE(hits, s.spills);
+}
+
+TEST(TieredARCTest, without_tier) {
+    StringTieredARC cache(2);
+    fengge::TierOptions options;
+    options.path = testing::TempDir() + "no/such/dir/tier.log";
+    ASSERT_FALSE(cache.Open(options));
+    for (int i = 0; i < 10; ++i) cache.Put(i, value_of(i));
+    ASSERT_EQ(cache.TierSize(), 0);
+    ASSERT_FALSE(cache.Get(0, nullptr));
+    ASSERT_TRUE(cache.Get(9, nullptr));
+}
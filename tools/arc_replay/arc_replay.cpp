@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fengge/arc.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+// usage:
+//   arc_replay import <arc|umass|keys> <text trace|-> <output>
+//   arc_replay run [--interval=N] [--threads=N] [--timeline=FILE]
+//                  <trace> <capacity>...
+//
+// `run` streams the memory-mapped trace through one ARC per capacity, the
+// capacities are replayed in parallel. It prints the hit ratio of the Get
+// records and the final queue sizes per capacity, and with --timeline
+// writes T1/T2/B1/B2 occupancy, p and the hit ratio every N records as CSV.
+namespace {
+
+using arc_replay::Op;
+
+struct Sample {
+    uint64_t records;
+    uint64_t gets;   // in the interval ending here
+    uint64_t hits;   // in the interval ending here
+    fengge::ARCSizeInfo size;
+    size_t p;
+};
+
+struct Result {
+    size_t capacity;
+    uint64_t gets;
+    uint64_t hits;
+    uint64_t skipped;  // records with an unknown op
+    double seconds;
+    fengge::ARCSizeInfo size;
+    size_t p;
+    std::vector<Sample> timeline;
+};
+
+double Ratio(uint64_t hits, uint64_t gets) {
+    return gets == 0 ? 0 : double(hits) / gets;
+}
+
+void Replay(const arc_replay::TraceFile& trace, uint64_t interval,
+            Result* r) {
+    fengge::ARC<uint64_t, uint8_t> cache(r->capacity);
+    const uint64_t* records = trace.records();
+    uint64_t gets = 0, hits = 0, skipped = 0;
+    uint64_t window_gets = 0, window_hits = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < trace.count(); ++i) {
+        uint64_t key = arc_replay::KeyOf(records[i]);
+        switch (arc_replay::OpOf(records[i])) {
+        case Op::kGet:
+            window_gets++;
+            if (cache.Get(key, nullptr))
+                window_hits++;
+            else
+                cache.Put(key, 0);
+            break;
+        case Op::kPut:
+            cache.Put(key, 0);
+            break;
+        case Op::kRemove:
+            cache.Remove(key);
+            break;
+        default:
+            skipped++;
+            break;
+        }
+        if ((i + 1) % interval == 0 || i + 1 == trace.count()) {
+            r->timeline.push_back({i + 1, window_gets, window_hits,
+                                   cache.ARCSize(), cache.P()});
+            gets += window_gets;
+            hits += window_hits;
+            window_gets = window_hits = 0;
+        }
+    }
+    r->seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    r->gets = gets;
+    r->hits = hits;
+    r->skipped = skipped;
+    r->size = cache.ARCSize();
+    r->p = cache.P();
+}
+
+bool WriteTimeline(const std::string& path,
+                   const std::vector<Result>& results) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr) return false;
+    fprintf(f, "capacity,records,hit_ratio,t1,t2,b1,b2,p\n");
+    for (const Result& r : results) {
+        for (const Sample& s : r.timeline) {
+            fprintf(f, "%zu,%llu,%.6f,%zu,%zu,%zu,%zu,%zu\n", r.capacity,
+                    static_cast<unsigned long long>(s.records),
+                    Ratio(s.hits, s.gets), s.size.t1, s.size.t2, s.size.b1,
+                    s.size.b2, s.p);
+        }
+    }
+    return fclose(f) == 0;
+}
+
+int Usage() {
+    fprintf(stderr,
+            "usage: arc_replay import <arc|umass|keys> <text trace|-> "
+            "<output>\n"
+            "       arc_replay run [--interval=N] [--threads=N] "
+            "[--timeline=FILE] <trace> <capacity>...\n");
+    return 2;
+}
+
+int Import(int argc, char** argv) {
+    if (argc != 3) return Usage();
+    std::string error;
+    FILE* in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    if (in == nullptr) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    arc_replay::TraceWriter out;
+    bool ok = out.Open(argv[2], &error) &&
+              arc_replay::Import(argv[0], in, &out, &error) &&
+              out.Close(&error);
+    if (in != stdin) fclose(in);
+    if (!ok) {
+        fprintf(stderr, "arc_replay: %s\n", error.c_str());
+        return 1;
+    }
+    printf("%llu records\n", static_cast<unsigned long long>(out.count()));
+    return 0;
+}
+
+int Run(int argc, char** argv) {
+    uint64_t interval = 0;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string timeline;
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--interval=", 0) == 0)
+            interval = strtoull(arg.c_str() + 11, nullptr, 10);
+        else if (arg.rfind("--threads=", 0) == 0)
+            threads = std::max(1, atoi(arg.c_str() + 10));
+        else if (arg.rfind("--timeline=", 0) == 0)
+            timeline = arg.substr(11);
+        else if (arg.rfind("--", 0) == 0)
+            return Usage();
+        else
+            args.push_back(arg);
+    }
+    if (args.size() < 2) return Usage();
+
+    arc_replay::TraceFile trace;
+    std::string error;
+    if (!trace.Open(args[0], &error)) {
+        fprintf(stderr, "arc_replay: %s\n", error.c_str());
+        return 1;
+    }
+    // about 100 samples per capacity by default
+    if (interval == 0) interval = std::max<uint64_t>(1, trace.count() / 100);
+
+    std::vector<Result> results(args.size() - 1);
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].capacity = strtoull(args[i + 1].c_str(), nullptr, 10);
+        if (results[i].capacity == 0) return Usage();
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(threads, results.size()); ++t) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < results.size(); i = next++)
+                Replay(trace, interval, &results[i]);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    printf("%llu records\n", static_cast<unsigned long long>(trace.count()));
+    // every capacity replays the same records
+    if (results[0].skipped != 0) {
+        fprintf(stderr, "arc_replay: skipped %llu records with an unknown op\n",
+                static_cast<unsigned long long>(results[0].skipped));
+    }
+    printf("%12s %9s %10s %10s %10s %10s %10s %8s\n", "capacity",
+           "hit ratio", "t1", "t2", "b1", "b2", "p", "seconds");
+    for (const Result& r : results) {
+        printf("%12zu %8.2f%% %10zu %10zu %10zu %10zu %10zu %8.2f\n",
+               r.capacity, 100 * Ratio(r.hits, r.gets), r.size.t1, r.size.t2,
+               r.size.b1, r.size.b2, r.p, r.seconds);
+    }
+    if (!timeline.empty() && !WriteTimeline(timeline, results)) {
+        fprintf(stderr, "%s: %s\n", timeline.c_str(), strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) return Usage();
+    if (strcmp(argv[1], "import") == 0) return Import(argc - 2, argv + 2);
+    if (strcmp(argv[1], "run") == 0) return Run(argc - 2, argv + 2);
+    return Usage();
+}
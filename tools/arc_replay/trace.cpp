@@ -0,0 +1,262 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+namespace arc_replay {
+
+namespace {
+
+const char kMagic[8] = {'A', 'R', 'C', 'T', 'R', 'A', 'C', 'E'};
+const size_t kWriteBuffer = 1 << 16;
+const uint64_t kPageSize = 4096;
+const uint64_t kSectorSize = 512;
+
+std::string ErrnoMessage(const std::string& what) {
+    return what + ": " + strerror(errno);
+}
+
+// Split line on any of seps, empty fields are dropped.
+std::vector<std::string_view> Split(std::string_view line, const char* seps) {
+    std::vector<std::string_view> fields;
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t end = line.find_first_of(seps, pos);
+        if (end == std::string_view::npos) end = line.size();
+        if (end > pos) fields.push_back(line.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return fields;
+}
+
+bool ParseUint(std::string_view s, uint64_t* v) {
+    if (s.empty()) return false;
+    uint64_t x = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        // reject values above UINT64_MAX instead of wrapping around
+        if (x > (UINT64_MAX - (c - '0')) / 10) return false;
+        x = x * 10 + (c - '0');
+    }
+    *v = x;
+    return true;
+}
+
+// Call fn(line, lineno) for every non-empty line of in without its line
+// terminator, stop at the first false.
+bool ForEachLine(FILE* in,
+                 const std::function<bool(std::string_view, uint64_t)>& fn) {
+    std::string line;
+    uint64_t lineno = 0;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), in) != nullptr) {
+        line += buf;
+        if (line.back() != '\n' && !feof(in)) continue;
+        lineno++;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (!line.empty() && !fn(line, lineno)) return false;
+        line.clear();
+    }
+    return true;
+}
+
+std::string LineError(uint64_t lineno, const char* what) {
+    return "line " + std::to_string(lineno) + ": " + what;
+}
+
+bool ImportArc(FILE* in, TraceWriter* out, std::string* error) {
+    return ForEachLine(in, [&](std::string_view line, uint64_t lineno) {
+        auto f = Split(line, " \t");
+        uint64_t start, n;
+        if (f.size() < 2 || !ParseUint(f[0], &start) ||
+            !ParseUint(f[1], &n)) {
+            *error = LineError(lineno, "expected `start_block num_blocks`");
+            return false;
+        }
+        for (uint64_t b = 0; b < n; ++b) out->Append(Op::kGet, start + b);
+        return true;
+    });
+}
+
+bool ImportUMass(FILE* in, TraceWriter* out, std::string* error) {
+    return ForEachLine(in, [&](std::string_view line, uint64_t lineno) {
+        auto f = Split(line, ",");
+        uint64_t asu, lba, size;
+        if (f.size() < 4 || !ParseUint(f[0], &asu) ||
+            !ParseUint(f[1], &lba) || !ParseUint(f[2], &size)) {
+            *error = LineError(lineno, "expected `asu,lba,size,opcode`");
+            return false;
+        }
+        Op op;
+        if (f[3] == "r" || f[3] == "R") {
+            op = Op::kGet;
+        } else if (f[3] == "w" || f[3] == "W") {
+            op = Op::kPut;
+        } else {
+            *error = LineError(lineno, "opcode must be r or w");
+            return false;
+        }
+        uint64_t first = lba * kSectorSize / kPageSize;
+        uint64_t last = (lba * kSectorSize + std::max<uint64_t>(size, 1) - 1)
+                        / kPageSize;
+        for (uint64_t page = first; page <= last; ++page)
+            out->Append(op, (asu << 40) | (page & ((uint64_t(1) << 40) - 1)));
+        return true;
+    });
+}
+
+bool ImportKeys(FILE* in, TraceWriter* out, std::string* error) {
+    return ForEachLine(in, [&](std::string_view line, uint64_t lineno) {
+        auto f = Split(line, " \t,");
+        if (f.empty() || f.size() > 2) {
+            *error = LineError(lineno, "expected `key [op]`");
+            return false;
+        }
+        Op op = Op::kGet;
+        if (f.size() == 2) {
+            if (f[1] == "put") {
+                op = Op::kPut;
+            } else if (f[1] == "del") {
+                op = Op::kRemove;
+            } else if (f[1] != "get") {
+                *error = LineError(lineno, "op must be get, put or del");
+                return false;
+            }
+        }
+        uint64_t key;
+        if (!ParseUint(f[0], &key)) key = std::hash<std::string_view>()(f[0]);
+        out->Append(op, key);
+        return true;
+    });
+}
+
+}  // namespace
+
+TraceFile::~TraceFile() {
+    if (base_ != nullptr) munmap(base_, size_);
+}
+
+bool TraceFile::Open(const std::string& path, std::string* error) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        *error = ErrnoMessage(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        *error = ErrnoMessage(path);
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(TraceHeader)) {
+        *error = path + ": not a trace file";
+        close(fd);
+        return false;
+    }
+    void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        *error = ErrnoMessage(path);
+        return false;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    const TraceHeader* header = static_cast<const TraceHeader*>(base);
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+        header->version != kTraceVersion ||
+        header->count > (size - sizeof(TraceHeader)) / sizeof(uint64_t)) {
+        *error = path + ": not a trace file or truncated";
+        munmap(base, size);
+        return false;
+    }
+    base_ = base;
+    size_ = size;
+    records_ = reinterpret_cast<const uint64_t*>(header + 1);
+    count_ = header->count;
+    return true;
+}
+
+TraceWriter::~TraceWriter() {
+    if (file_ != nullptr) fclose(file_);
+}
+
+bool TraceWriter::Open(const std::string& path, std::string* error) {
+    file_ = fopen(path.c_str(), "wb");
+    if (file_ == nullptr) {
+        *error = ErrnoMessage(path);
+        return false;
+    }
+    // the count is filled in by Close()
+    TraceHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kTraceVersion;
+    if (fwrite(&header, sizeof(header), 1, file_) != 1) {
+        *error = ErrnoMessage(path);
+        return false;
+    }
+    buffer_.reserve(kWriteBuffer);
+    return true;
+}
+
+void TraceWriter::Append(Op op, uint64_t key) {
+    buffer_.push_back(MakeRecord(op, key));
+    count_++;
+    if (buffer_.size() == kWriteBuffer) Flush();
+}
+
+bool TraceWriter::Flush() {
+    bool ok = fwrite(buffer_.data(), sizeof(uint64_t), buffer_.size(),
+                     file_) == buffer_.size();
+    buffer_.clear();
+    return ok;
+}
+
+bool TraceWriter::Close(std::string* error) {
+    TraceHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kTraceVersion;
+    header.count = count_;
+    bool ok = Flush() && ferror(file_) == 0 &&
+              fseek(file_, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, file_) == 1;
+    ok = fclose(file_) == 0 && ok;
+    file_ = nullptr;
+    if (!ok) *error = ErrnoMessage("write failed");
+    return ok;
+}
+
+bool Import(const std::string& format, FILE* in, TraceWriter* out,
+            std::string* error) {
+    if (format == "arc") return ImportArc(in, out, error);
+    if (format == "umass") return ImportUMass(in, out, error);
+    if (format == "keys") return ImportKeys(in, out, error);
+    *error = "unknown format " + format + ", expected arc, umass or keys";
+    return false;
+}
+
+}  // namespace arc_replay
@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2024 Xu Yifeng
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef TOOLS_ARC_REPLAY_TRACE_H_
+#define TOOLS_ARC_REPLAY_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// Binary trace format of arc_replay: a TraceHeader followed by `count`
+// 64-bit records in host byte order, the top 2 bits of a record are the Op
+// and the low 62 bits the key id.
+namespace arc_replay {
+
+enum class Op : uint8_t {
+    kGet = 0,     // read-through: Get, Put on a miss
+    kPut = 1,
+    kRemove = 2,
+};
+
+struct TraceHeader {
+    char magic[8];  // "ARCTRACE"
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+const uint32_t kTraceVersion = 1;
+const uint64_t kKeyMask = (uint64_t(1) << 62) - 1;
+
+inline uint64_t MakeRecord(Op op, uint64_t key) {
+    return (uint64_t(op) << 62) | (key & kKeyMask);
+}
+inline Op OpOf(uint64_t record) { return static_cast<Op>(record >> 62); }
+inline uint64_t KeyOf(uint64_t record) { return record & kKeyMask; }
+
+// Read-only memory mapping of a trace file, the records are paged in by the
+// kernel as they are read.
+class TraceFile {
+ public:
+    TraceFile() : base_(nullptr), size_(0), records_(nullptr), count_(0) {}
+    ~TraceFile();
+
+    TraceFile(const TraceFile&) = delete;
+    void operator=(const TraceFile&) = delete;
+
+    bool Open(const std::string& path, std::string* error);
+    const uint64_t* records() const { return records_; }
+    uint64_t count() const { return count_; }
+
+ private:
+    void* base_;
+    size_t size_;
+    const uint64_t* records_;
+    uint64_t count_;
+};
+
+// Buffered writer of a trace file, the header gets its count on Close().
+class TraceWriter {
+ public:
+    TraceWriter() : file_(nullptr), count_(0) {}
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    void operator=(const TraceWriter&) = delete;
+
+    bool Open(const std::string& path, std::string* error);
+    void Append(Op op, uint64_t key);
+    bool Close(std::string* error);
+    uint64_t count() const { return count_; }
+
+ private:
+    bool Flush();
+
+    FILE* file_;
+    std::vector<uint64_t> buffer_;
+    uint64_t count_;
+};
+
+// Text importers, they stream `in` into `out`. Malformed lines are errors.
+//
+// "arc": traces of the ARC paper (Megiddo and Modha), one request per line
+//     `start_block num_blocks ignored request_id`, every block is a Get.
+// "umass": UMass/SPC storage traces, `asu,lba,size,opcode,timestamp` with
+//     512-byte sectors, every 4KB page touched is a Get (read) or a Put
+//     (write); the key is the page number tagged with the ASU.
+// "keys": one access per line, `key [op]` with op one of get (default),
+//     put or del; a key which is not a decimal number is hashed.
+bool Import(const std::string& format, FILE* in, TraceWriter* out,
+            std::string* error);
+
+}  // namespace arc_replay
+
+#endif  // TOOLS_ARC_REPLAY_TRACE_H_